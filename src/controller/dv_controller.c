@@ -2,6 +2,10 @@
 
 #include "../datavault.h"
 #include "dv_persistence.h"
+#include "dv_journal.h"
+#include "dv_wal.h"
+#include "dv_format.h"
+#include "dv_page.h"
 
 #include "../lib/cmathematics/util/numio.h"
 #include "../lib/cmathematics/data/encryption/aes.h"
@@ -13,6 +17,8 @@
 #include "../lib/ds/dynamicarray.h"
 #include "../lib/util/fileio.h"
 #include "../lib/util/mem.h"
+#include "../lib/util/thread.h"
+#include "../lib/util/timing.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -26,10 +32,6 @@ const unsigned int nameIdIV_offset = 0x40;
 const unsigned int idIdxIV_offset = 0x50;
 const unsigned int catIdIV_offset = 0x60;
 
-// shortcut for encryption/decryption calls
-#define AES_ENC_BLK(dv, in, iv, out) aes_encrypt_withSchedule(in, 16, dv->aes_key_schedule, AES_256_NR, AES_CTR, iv, out)
-#define AES_DEC_BLK(dv, in, iv, out) aes_decrypt_withSchedule(in, 16, dv->aes_key_schedule, AES_256_NR, AES_CTR, iv, out)
-
 int dv_createAccount(dv_app *dv, unsigned char *username, unsigned char *userPwd, int n)
 {
     dv_setUserDirectory(username);
@@ -87,9 +89,9 @@ int dv_createAccount(dv_app *dv, unsigned char *username, unsigned char *userPwd
                         random + kekSalt_offset, 16,
                         10, SHA512_STR, DV_KEYLEN, &kek);
 
-        // encrypt key
+        // encrypt key, dk.dv keeps the keystream it has always had, two blocks never repeat a counter
         aes_encrypt(dataKey, DV_KEYLEN,
-                    kek, AES_256, AES_CTR,
+                    kek, AES_256, AES_CTR_WRAP,
                     random + dataKeyIV_offset,
                     &encDataKey);
 
@@ -122,17 +124,76 @@ int dv_createAccount(dv_app *dv, unsigned char *username, unsigned char *userPwd
     return retCode;
 }
 
+typedef struct
+{
+    int hashLen;
+    char *expected;
+    char *encDataKey;
+    double elapsed;
+} dv_credentialJob;
+
+void dv_readCredentialsJob(void *arg)
+{
+    dv_credentialJob *job = (dv_credentialJob *)arg;
+    double start = timing_now();
+
+    // read expected password hash
+    file_struct pwdFile;
+    if (file_open(&pwdFile, pwd_fp, "rb"))
+    {
+        job->expected = file_read(&pwdFile, job->hashLen);
+        file_close(&pwdFile);
+    }
+
+    // read encrypted data key
+    job->encDataKey = file_readContents(dk_fp);
+
+    job->elapsed = timing_since(start);
+}
+
+typedef struct
+{
+    unsigned char *userPwd;
+    int n;
+    unsigned char *salt;
+    unsigned char *kek;
+    double elapsed;
+} dv_kdfJob;
+
+void dv_deriveKekJob(void *arg)
+{
+    dv_kdfJob *job = (dv_kdfJob *)arg;
+    double start = timing_now();
+
+    pbkdf2_hmac_sha(job->userPwd, job->n,
+                    job->salt, 16,
+                    10, SHA512_STR, DV_KEYLEN, &job->kek);
+
+    job->elapsed = timing_since(start);
+}
+
 int dv_login(dv_app *dv, unsigned char *username, unsigned char *userPwd, int n)
 {
     int retCode = DV_SUCCESS;
 
     sha3_context hashCtx;
     unsigned char *hash = NULL;
-    char *expected = NULL;
-    unsigned char *kek = NULL;
-    char *encDataKey = NULL;
     unsigned char *tmp = NULL;
 
+    // background stages
+    bool started = false;
+    dv_credentialJob credentials = { 0 };
+    dv_kdfJob kdf = { 0 };
+    dv_prefetch prefetch;
+    thread_struct credentialThread;
+    thread_struct kdfThread;
+
+    double start = timing_now();
+    double verifyElapsed = 0.0;
+    double keyElapsed = 0.0;
+    double loadElapsed = 0.0;
+    double stageStart;
+
     if (DV_DEBUG)
     {
         printf("Logging in for %s\n", username);
@@ -151,84 +212,165 @@ int dv_login(dv_app *dv, unsigned char *username, unsigned char *userPwd, int n)
             break;
         }
 
+        /**
+         * START BACKGROUND STAGES
+         */
+        // read credential files
+        credentials.hashLen = sha_getRetLenIdx(SHA3_512);
+        thread_start(&credentialThread, dv_readCredentialsJob, &credentials);
+
+        // derive key encryption key, independent of the password check
+        kdf.userPwd = userPwd;
+        kdf.n = n;
+        kdf.salt = dv->random + kekSalt_offset;
+        thread_start(&kdfThread, dv_deriveKekJob, &kdf);
+
+        // read map files unless loading lazily, and warm data.dv
+        dv_startPrefetch(&prefetch, !DV_LAZYLOAD);
+        started = true;
+
         /**
          * VALIDATE INPUT PASSWORD
          */
+        stageStart = timing_now();
+
         // generate input hash
         sha3_initContext(&hashCtx, SHA3_512);
         sha3_update(&hashCtx, userPwd, n);
         sha3_update(&hashCtx, dv->random + userPwdSalt_offset, 16); // concatenate salt
         sha3_digest(&hashCtx, &hash);
 
-        // read expected value
-        file_struct pwdFile;
-        if (file_open(&pwdFile, pwd_fp, "rb"))
+        // compare with expected value
+        thread_join(&credentialThread);
+        if (!credentials.expected)
         {
-            // read file
-            expected = file_read(&pwdFile, hashCtx.ret_len);
-
-            // compare
-            if (memcmp(hash, expected, hashCtx.ret_len))
-            {
-                dv_kill(dv);
-                retCode = DV_INVALID_INPUT;
-                break;
-            }
-            // else succeeded
-
-            file_close(&pwdFile);
+            retCode = DV_FILE_DNE;
+            break;
         }
-        else
+        if (memcmp(hash, credentials.expected, hashCtx.ret_len))
         {
-            retCode = DV_FILE_DNE;
+            retCode = DV_INVALID_INPUT;
             break;
         }
+        // else succeeded
+
+        verifyElapsed = timing_since(stageStart);
 
         /**
          * DATA KEY
          */
-        // derive key encryption key
-        pbkdf2_hmac_sha(userPwd, n,
-                        dv->random + kekSalt_offset, 16,
-                        10, SHA512_STR, DV_KEYLEN, &kek);
+        stageStart = timing_now();
 
-        if (!(encDataKey = file_readContents(dk_fp)))
+        if (!credentials.encDataKey)
         {
             retCode = DV_FILE_DNE;
             break;
         }
 
+        // wait for key encryption key
+        thread_join(&kdfThread);
+
         // decrypt
-        aes_decrypt(encDataKey, DV_KEYLEN,
-                    kek, AES_256, AES_CTR,
+        aes_decrypt(credentials.encDataKey, DV_KEYLEN,
+                    kdf.kek, AES_256, AES_CTR_WRAP,
                     dv->random + dataKeyIV_offset, &tmp);
         memcpy(dv->dataKey, tmp, DV_KEYLEN);
 
         // generate AES key schedule
         aes_generateKeySchedule(dv->dataKey, AES_256, dv->aes_key_schedule);
 
-        // call the load sequence
-        retCode = dv_load(dv);
+        // derive the index map subkeys
+        dv_deriveMapKeys(dv);
+
+        keyElapsed = timing_since(stageStart);
+
+        // finish data writes committed before an interruption
+        if (retCode = dv_walRecover(dv))
+        {
+            break;
+        }
+
+        // data.dv format decides how idIdxMap.dv is parsed
+        if (retCode = dv_readSuperblock(dv))
+        {
+            break;
+        }
+
+        // finish a migration interrupted after data.dv was replaced
+        if (dv_migrationStaged(dv))
+        {
+            // the prefetch read the maps being replaced
+            dv_endPrefetch(&prefetch);
+            dv_finishMigration(dv);
+            dv_startPrefetch(&prefetch, !DV_LAZYLOAD);
+        }
+
+        // call the load sequence, parsing each map once its file has been read
+        if (!DV_LAZYLOAD)
+        {
+            stageStart = timing_now();
+            retCode = dv_loadPrefetched(dv, &prefetch);
+            loadElapsed = timing_since(stageStart);
+        }
+
+        // bring an older data.dv up to the current format
+        if (!retCode)
+        {
+            retCode = dv_migrate(dv);
+        }
+
+        // homes moved by recovered groups, whose journal records may be lost
+        if (!retCode)
+        {
+            retCode = dv_walRecoverHomes(dv);
+        }
 
         if (DV_DEBUG)
         {
             printHexString(userPwd, n, "userPwd");
             printHexString(dv->random + userPwdSalt_offset, 16, "userPwdSalt");
             printHexString(hash, hashCtx.ret_len, "userPwdHash");
-            printHexString(expected, hashCtx.ret_len, "expectedHash");
+            printHexString(credentials.expected, hashCtx.ret_len, "expectedHash");
             printHexString(dv->random + kekSalt_offset, 16, "kekSalt");
-            printHexString(kek, DV_KEYLEN, "kek");
-            printHexString(encDataKey, DV_KEYLEN, "encDataKey");
+            printHexString(kdf.kek, DV_KEYLEN, "kek");
+            printHexString(credentials.encDataKey, DV_KEYLEN, "encDataKey");
             printHexString(dv->random + dataKeyIV_offset, 16, "dataKeyIV");
             printHexString(dv->dataKey, DV_KEYLEN, "decDataKey");
         }
     } while (false);
 
+    if (started)
+    {
+        // background stages must finish before their buffers are released
+        thread_join(&credentialThread);
+        thread_join(&kdfThread);
+        dv_endPrefetch(&prefetch);
+    }
+
+    if (DV_DEBUG && !retCode)
+    {
+        // stage timings, only for logins that completed
+        printf("[login] read credentials: %.3f ms\n", credentials.elapsed);
+        printf("[login] derive kek:       %.3f ms\n", kdf.elapsed);
+        printf("[login] verify password:  %.3f ms\n", verifyElapsed);
+        printf("[login] decrypt data key: %.3f ms\n", keyElapsed);
+        printf("[login] load maps:        %.3f ms\n", loadElapsed);
+        printf("[login] total:            %.3f ms\n", timing_since(start));
+    }
+
     conditionalFree(hash, free);
-    conditionalFree(expected, free);
-    conditionalFree(kek, free);
-    conditionalFree(encDataKey, free);
-    conditionalFree(tmp, free);
+    conditionalFree(credentials.expected, free);
+    conditionalFree(credentials.encDataKey, free);
+    if (kdf.kek)
+    {
+        memset(kdf.kek, 0, DV_KEYLEN);
+        free(kdf.kek);
+    }
+    if (tmp)
+    {
+        memset(tmp, 0, DV_KEYLEN);
+        free(tmp);
+    }
 
     if (retCode)
     {
@@ -253,6 +395,9 @@ int dv_logout(dv_app *dv)
             break;
         }
 
+        // the next session allocates without reading every page header
+        dv_pageSaveFreeSpace(dv);
+
         dv_kill(dv);
     } while (false);
 
@@ -266,307 +411,161 @@ int dv_createEntry(dv_app *dv, const char *name)
         return DV_LOGGED_OUT;
     }
 
+    // load index maps
+    int retCode = DV_SUCCESS;
+    if ((retCode = dv_requireMap(dv, DV_NAMEIDMAP)) ||
+        (retCode = dv_requireMap(dv, DV_IDIDXMAP)))
+    {
+        return retCode;
+    }
+
     if (avl_get(dv->nameIdMap, (void *)name))
     {
         // entry already exists
         return DV_INVALID_INPUT;
     }
 
+    // entry starts as a link record in a page with room
+    dv_pageSet pages;
+    if (retCode = dv_pageOpen(&pages, dv, NULL))
+    {
+        return retCode;
+    }
+    unsigned int home = 0;
+    if (!(retCode = dv_pageCreateEntry(&pages, dv->maxEntryId + 1, &home)))
+    {
+        retCode = dv_pageCommit(&pages);
+    }
+    dv_pageClose(&pages);
+    if (retCode)
+    {
+        return retCode;
+    }
+
     // make copy
     int len = strlen(name);
     char *nameCopy = malloc(len + 1);
     strcpy(nameCopy, name);
     nameCopy[len] = 0;
 
+    // insert into index map, journaled after the page is committed and before the name,
+    // so a crash in between leaves an unnamed entry instead of a name without a page
+    btree_insert(&dv->idIdxMap, ++dv->maxEntryId, (void *)home);
+    dv->mapDirty[DV_IDIDXMAP] = true;
+    if (retCode = dv_journalStart(dv, dv->maxEntryId, home))
+    {
+        free(nameCopy);
+        return retCode;
+    }
+
     // insert copy into name map
     dv->nameIdMap = avl_insert(dv->nameIdMap,
                                nameCopy,
-                               (void *)(++dv->maxEntryId));
+                               (void *)dv->maxEntryId);
+    dv->mapDirty[DV_NAMEIDMAP] = true;
+    retCode = dv_journalName(dv, name, dv->maxEntryId);
 
-    // create block
-    file_struct dataFile;
-    if (file_openBlocks(&dataFile, data_fp, "ab", 16))
+    if (DV_DEBUG)
     {
-        // find end of file
-        int initBlock = dataFile.len >> 4; // len / 16
-
-        // populate block: 0x22 * 12, smallEndian(0)
-        unsigned char *emptyBlock = malloc(16);
-        memset(emptyBlock, 0x22, 14);
-        memset(emptyBlock + 14, 0, 2);
-
-        // increment counter
-        unsigned char *ivCopy = malloc(16);
-        memcpy(ivCopy, dv->random + dataIV_offset, 16);
-        aes_incrementCounter(ivCopy, initBlock);
-
-        // encrypt
-        unsigned char *enc;
-        AES_ENC_BLK(dv, emptyBlock, ivCopy, &enc);
-
-        // append to file
-        file_writeBlocks(&dataFile, enc, 1);
-
-        // insert into index map
-        btree_insert(&dv->idIdxMap, dv->maxEntryId, (void *)initBlock);
+        printf("entryId: %d\n", dv->maxEntryId);
+        printf("page: %d\n", home);
+    }
 
-        if (DV_DEBUG)
-        {
-            printf("entryId: %d\n", dv->maxEntryId);
-            printf("blockIdx: %d\n", initBlock);
-            printHexString(emptyBlock, 16, "block");
-            printHexString(ivCopy, 16, "ivInc");
-            printHexString(enc, 16, "encBlock");
-        }
+    return retCode;
+}
 
-        // free variables
-        free(emptyBlock);
-        free(ivCopy);
-        free(enc);
+int dv_createEntryData(dv_app *dv, const char *name, const char *category, const char *data)
+{
+    // a new entry, a new category and the data are committed together, with one sync of each log
+    dv_walBatchBegin(dv);
+    int retCode = dv_writeEntryData(dv, name, category, data);
+    int commitCode = dv_walBatchEnd(dv);
 
-        // close file
-        file_close(&dataFile);
-    }
-    else
-    {
-        return DV_FILE_DNE;
-    }
+    return retCode ? retCode : commitCode;
+}
 
-    return DV_SUCCESS;
+int dv_writeEntryData(dv_app *dv, const char *name, const char *category, const char *data)
+{
+    return dv_writeEntryBytes(dv, name, category, data, strlen(data));
 }
 
-int dv_createEntryData(dv_app *dv, const char *name, const char *category, const char *data)
+/**
+ * write n bytes of any value, records carry their length,
+ * so a value may hold zeros
+ */
+int dv_writeEntryBytes(dv_app *dv, const char *name, const char *category, const void *data, int n)
 {
     if (!dv->loggedIn)
     {
         return DV_LOGGED_OUT;
     }
 
+    // load index maps
+    int retCode = DV_SUCCESS;
+    if ((retCode = dv_requireMap(dv, DV_NAMEIDMAP)) ||
+        (retCode = dv_requireMap(dv, DV_IDIDXMAP)) ||
+        (retCode = dv_requireMap(dv, DV_CATIDMAP)))
+    {
+        return retCode;
+    }
+
     // find entry id
     unsigned int entryId = (unsigned int)avl_get(dv->nameIdMap, (void *)name);
     if (!entryId)
     {
         // create entry
-        dv_createEntry(dv, name);
+        if (retCode = dv_createEntry(dv, name))
+        {
+            return retCode;
+        }
         entryId = dv->maxEntryId;
     }
 
     // find the category id
-    unsigned char catId = (unsigned char)(unsigned int)avl_get(dv->catIdMap, (void *)category);
+    unsigned int catId = (unsigned int)avl_get(dv->catIdMap, (void *)category);
     if (!catId)
     {
+        if (dv->formatVersion < DV_FORMAT_V5 && dv->maxCatId >= 0xff)
+        {
+            // the maps of version 4 hold 255 categories, defrag rewrites the vault in version 5
+            return DV_FILE_FULL;
+        }
+
         // create category
-        catId = ++dv->maxCatId;
+        catId = dv->maxCatId + 1;
         char *catCopy = malloc(strlen(category) + 1);
         memcpy(catCopy, category, strlen(category) + 1);
-        dv->catIdMap = avl_insert(dv->catIdMap, (void *)catCopy, (void *)(unsigned int)catId);
+        dv_insertCategory(dv, catCopy, catId);
+        dv->mapDirty[DV_CATIDMAP] = true;
+        if (retCode = dv_journalCategory(dv, category, catId))
+        {
+            return retCode;
+        }
     }
 
-    // cursor over input
-    int dataCursor = -1;
-    int dataLen = strlen(data) + 1;
-
-    // block cursors
-    unsigned int previousBlock = 1;
-    unsigned int currentBlock = (unsigned int)btree_search(dv->idIdxMap, entryId);
-    unsigned int nextBlock = 1;
+    unsigned int home = (unsigned int)btree_search(dv->idIdxMap, entryId);
 
     if (DV_DEBUG)
     {
         printf("Entry id for %s: %d\n", name, entryId);
         printf("Category id for %s: %d\n", category, catId);
-        printf("Insert data (%d): %s\n", dataLen, data);
-        printHexString((char*)data, dataLen, "data");
+        printf("Insert data (%d)\n", n);
+        printHexString((char*)data, n, "data");
     }
 
-    // write the data
-    file_struct dataFile;
-    file_struct dataOut;
-    if (file_openBlocks(&dataFile, data_fp, "rb", 16) &&
-        file_openBlocks(&dataOut, data_tmp_fp, "wb", 16))
+    // write the data, all changed pages go to the log as one group
+    dv_pageSet pages;
+    if (retCode = dv_pageOpen(&pages, dv, NULL))
     {
-        unsigned int noBlocks = dataFile.len >> 4; // len / 16
-
-        // copy first block
-        char *copy = file_readBlocks(&dataFile, 1);
-        file_writeBlocks(&dataOut, copy, 1);
-        free(copy);
-
-        // setup initialization vector
-        unsigned char *ivCopy = malloc(16);
-        memcpy(ivCopy, dv->random + dataIV_offset, 16);
-
-        // iterate through input
-        while (dataCursor < dataLen)
-        {
-            if (DV_DEBUG)
-            {
-                printf("==Block %d\n", currentBlock);
-            }
-
-            // determine increment and skip blocks
-            int increment = currentBlock - previousBlock;
-            if (currentBlock <= noBlocks && increment)
-            {
-                // content to copy (skipped)
-                copy = file_readBlocks(&dataFile, increment);
-                file_writeBlocks(&dataOut, copy, increment);
-                free(copy);
-            }
-            aes_incrementCounter(ivCopy, increment + 1);
-
-            char *enc = NULL;
-            unsigned char *dec = NULL;
-            unsigned int startIdx;
-            if (currentBlock < noBlocks)
-            {
-                // read and decrypt existing block
-                enc = file_readBlocks(&dataFile, 1);
-                AES_DEC_BLK(dv, enc, ivCopy, &dec);
-
-                if (DV_DEBUG)
-                {
-                    printHexString(enc, 16, "encBlk");
-                    printHexString(dec, 16, "decBlk");
-                }
-
-                // find continuation block
-                nextBlock = smallEndianValue(dec + 14, 2);
-                if (nextBlock)
-                {
-                    // data ends in another block, cannot write to this one
-
-                    // update counters
-                    previousBlock = currentBlock + 1;
-                    currentBlock = nextBlock;
-
-                    // write unmodified data
-                    file_writeBlocks(&dataOut, enc, 1);
-
-                    if (DV_DEBUG)
-                    {
-                        printf("nonMod\n");
-                    }
-
-                    free(dec);
-                    free(enc);
-
-                    continue;
-                }
-
-                // find first available character
-                int i = 16 - sizeof(unsigned short) - 1;
-                while (i >= 0 && dec[i])
-                {
-                    i--;
-                }
-
-                // start writing after 0
-                startIdx = i + 1;
-
-                // additional data written at end of file
-                nextBlock = noBlocks;
-            }
-            else
-            {
-                // create new block
-                dec = malloc(16);
-                memset(dec, 0x22, 16 - sizeof(unsigned short)); // arbitrary value
-                memset(dec + 14, 0, sizeof(unsigned short));    // continuation block
-
-                // start writing on first byte
-                startIdx = 0;
-
-                // additional data written immediately after
-                nextBlock = currentBlock + 1;
-            }
-
-            bool modified = false;
-            if (dataCursor == -1 && startIdx < 16 - sizeof(unsigned short))
-            {
-                // write category id
-                dec[startIdx] = catId;
-                modified = true;
-
-                // write data after category id
-                startIdx++;
-                dataCursor = 0;
-            }
-
-            if (startIdx < 16 - sizeof(unsigned short))
-            {
-                // write as much data as possible
-                int n = MIN(16 - sizeof(unsigned short) - startIdx,
-                            dataLen - dataCursor);
-
-                if (DV_DEBUG)
-                {
-                    printf("Write %d bytes from %d\n", n, startIdx);
-                }
-
-                if (n)
-                {
-                    memcpy(dec + startIdx, data + dataCursor, n);
-                    dataCursor += n;
-                    modified = true;
-                }
-            }
-
-            if (dataCursor < dataLen)
-            {
-                // more data to write
-                smallEndianStr(nextBlock, dec + 14, 2);
-                modified = true;
-            }
-
-            // update counters
-            previousBlock = currentBlock + 1;
-            currentBlock = nextBlock;
-
-            if (modified)
-            {
-                conditionalFree(enc, free);
-                AES_ENC_BLK(dv, dec, ivCopy, (unsigned char **)&enc);
-                file_writeBlocks(&dataOut, enc, 1);
-
-                if (DV_DEBUG)
-                {
-                    printHexString(ivCopy, 16, "iv");
-                    printHexString(dec, 16, "modBlk");
-                    printHexString(enc, 16, "encMod");
-                }
-            }
-
-            conditionalFree(enc, free);
-            conditionalFree(dec, free);
-        }
-
-        // determine increment and skip blocks
-        int increment = noBlocks - previousBlock;
-        if (increment)
-        {
-            // content to copy (skipped)
-            copy = file_readBlocks(&dataFile, increment);
-            file_writeBlocks(&dataOut, copy, increment);
-            free(copy);
-        }
-
-        free(ivCopy);
-
-        // close files
-        file_close(&dataOut);
-        file_close(&dataFile);
-
-        file_copy(data_fp, data_tmp_fp);
+        return retCode;
     }
-    else
+    if (!(retCode = dv_pageWriteData(&pages, entryId, home, catId, data, n)))
     {
-        file_close(&dataFile);
-        file_close(&dataOut);
-        return DV_FILE_DNE;
+        retCode = dv_pageCommit(&pages);
     }
+    dv_pageClose(&pages);
 
-    return DV_SUCCESS;
+    return retCode;
 }
 
 int dv_deleteEntryData(dv_app *dv, const char *name, const char *category)
@@ -577,6 +576,11 @@ int dv_deleteEntryData(dv_app *dv, const char *name, const char *category)
     }
 
     // find entry id
+    int loadCode = DV_SUCCESS;
+    if (loadCode = dv_requireMap(dv, DV_NAMEIDMAP))
+    {
+        return loadCode;
+    }
     unsigned int entryId = (unsigned int)avl_get(dv->nameIdMap, (void *)name);
     if (!entryId)
     {
@@ -584,16 +588,23 @@ int dv_deleteEntryData(dv_app *dv, const char *name, const char *category)
     }
 
     // find the category id
-    unsigned char catId = (unsigned char)(unsigned int)avl_get(dv->catIdMap, (void *)category);
+    if (loadCode = dv_requireMap(dv, DV_CATIDMAP))
+    {
+        return loadCode;
+    }
+    unsigned int catId = (unsigned int)avl_get(dv->catIdMap, (void *)category);
     if (!catId)
     {
         return DV_INVALID_INPUT;
     }
 
-    // block cursors
-    unsigned int previousBlock = 1;
-    unsigned int currentBlock = (unsigned int)btree_search(dv->idIdxMap, entryId);
-    unsigned int nextBlock = 1;
+    // find the start block
+    if (loadCode = dv_requireMap(dv, DV_IDIDXMAP))
+    {
+        return loadCode;
+    }
+
+    unsigned int home = (unsigned int)btree_search(dv->idIdxMap, entryId);
 
     if (DV_DEBUG)
     {
@@ -601,324 +612,49 @@ int dv_deleteEntryData(dv_app *dv, const char *name, const char *category)
         printf("Category id for %s: %d\n", category, catId);
     }
 
-    strstream entryData = strstream_allocDefault();
-
-    unsigned char *ivCopy = NULL;
-    unsigned char *ivCopyIn = NULL;
-    unsigned char *ivCopyOut = NULL;
-
-    char *enc = NULL;
-    unsigned char *dec = NULL;
-
+    // records after it move up within their page, other pages are untouched
+    dv_pageSet pages;
     int retCode = DV_SUCCESS;
-
-    do
+    if (retCode = dv_pageOpen(&pages, dv, NULL))
     {
-        file_struct dataFile;
-        if (!file_openBlocks(&dataFile, data_fp, "rb", 16))
-        {
-            retCode = DV_FILE_DNE;
-            break;
-        }
-        unsigned int noBlocks = dataFile.len >> 4; // len / 16
-        bool *occupiedBlocks = malloc(noBlocks);
-        memset(occupiedBlocks, 0, noBlocks);
-
-        // skip first block
-        file_advanceCursorBlocks(&dataFile, 1);
-
-        // copy IV
-        ivCopy = malloc(16);
-        memcpy(ivCopy, dv->random + dataIV_offset, 16);
-
-        bool onTarget = false;
-        bool scanData = false;
-        bool complete = false;
-        unsigned int startIdx;
-
-        while (currentBlock < noBlocks)
-        {
-            occupiedBlocks[currentBlock] = true;
-
-            // skip blocks
-            int increment = currentBlock - previousBlock;
-            file_advanceCursorBlocks(&dataFile, increment);
-            aes_incrementCounter(ivCopy, increment + 1);
-
-            // read block
-            enc = file_readBlocks(&dataFile, 1);
-            AES_DEC_BLK(dv, enc, ivCopy, &dec);
-            // read continuation block
-            nextBlock = smallEndianValue(dec + 14, 2);
-
-            if (DV_DEBUG)
-            {
-                printf("==Block %d: increment by %d\n", currentBlock, increment);
-                printHexString(enc, 16, "encBlock");
-                printHexString(ivCopy, 16, "ivInc");
-                printHexString(dec, 16, "decBlock");
-            }
-
-            if (complete)
-            {
-                int endIdx = 16 - sizeof(short);
-                while (!nextBlock && dec[endIdx - 1]) endIdx--;
-                strstream_read(&entryData, dec, endIdx);
-                if (DV_DEBUG)
-                {
-                    printf("Complete, reading 0 to %d\n", endIdx);
-                }
-            }
-            else
-            {
-                startIdx = 0;
-                for (int i = 0; i < 14; i++)
-                {
-                    if (!scanData)
-                    {
-                        scanData = true;
-
-                        if (dec[i] == catId)
-                        {
-                            // found target
-                            onTarget = true;
-                            startIdx = 16;
-
-                            // read into data stream until entry
-                            if (i)
-                            {
-                                if (DV_DEBUG)
-                                {
-                                    printf("%d: Reading 0 to %d\n", currentBlock, i);
-                                }
-                                strstream_read(&entryData, dec, i);
-                            }
-                        }
-                    }
-
-                    if (!dec[i])
-                    {
-                        // terminator character
-                        scanData = false;
-
-                        if (onTarget)
-                        {
-                            // finished reading target
-                            startIdx = i + 1;
-                            onTarget = false;
-                            complete = true;
-                            break;
-                        }
-                    }
-                }
-
-                // read after data
-                if (!onTarget && startIdx >= 0 && startIdx < 16 - sizeof(short))
-                {
-                    // read to end of block unless last block
-                    int endIdx = 16 - sizeof(short);
-                    while (!nextBlock && dec[endIdx - 1]) endIdx--;
-                    if (endIdx > 0 && endIdx > startIdx)
-                    {
-                        if (DV_DEBUG)
-                        {
-                            printf("%d: Reading %d to %d\n", currentBlock, startIdx, endIdx);
-                        }
-                        if (endIdx == 7 && startIdx == 0)
-                        {
-                            printf("Hello\n");
-                        }
-                        strstream_read(&entryData, dec + startIdx, endIdx - startIdx);
-                    }
-                }
-            }
-
-            free(enc);
-            free(dec);
-
-            if (!nextBlock)
-            {
-                // all data has been read
-                break;
-            }
-
-            // update counters
-            previousBlock = currentBlock + 1;
-            currentBlock = nextBlock;
-        }
-
-        file_close(&dataFile);
-        free(ivCopy);
-
-        if (!complete)
-        {
-            // not found
-            retCode = DV_INVALID_INPUT;
-            break;
-        }
-
-        if (!entryData.size)
-        {
-            strstream_concat(&entryData, "%c", 0x22);
-        }
-
-        // write to file
-        file_struct dataIn;
-        if (!file_openBlocks(&dataIn, data_fp, "rb", 16))
-        {
-            retCode = DV_FILE_DNE;
-            break;
-        }
-
-        file_struct dataOut;
-        if (!file_openBlocks(&dataOut, data_tmp_fp, "wb", 16))
-        {
-            retCode = DV_FILE_DNE;
-            break;
-        }
-
-        // copy first block
-        char *copy = file_readBlocks(&dataIn, 1);
-        file_writeBlocks(&dataOut, copy, 1);
-        free(copy);
-
-        ivCopyIn = malloc(16);
-        memcpy(ivCopyIn, dv->random + dataIV_offset, 16);
-        aes_incrementCounter(ivCopyIn, 1);
-        int ivCopyInInc = 0;
-        ivCopyOut = malloc(16);
-        memcpy(ivCopyOut, dv->random + dataIV_offset, 16);
-        aes_incrementCounter(ivCopyOut, 1);
-        int ivCopyOutInc = 0;
-
-        // write all blocks in order
-        previousBlock = 1;
-        int dataCursor = 0;
-        for (int listIdx = 1; listIdx < noBlocks; listIdx++)
-        {
-            int offset = (dataIn.cursor - dataOut.cursor) >> 4;
-            if (DV_DEBUG)
-            {
-                printf("blk %03d: (%d, %d; %d, %d); \n", listIdx, ivCopyInInc, dataIn.cursor, ivCopyOutInc, dataOut.cursor);
-            }
-            if (occupiedBlocks[listIdx])
-            {
-                // skip block
-                file_advanceCursorBlocks(&dataIn, 1);
-
-                if (dataCursor < entryData.size)
-                {
-                    // write entry data
-                    int n = MIN(14, entryData.size - dataCursor);
-                    dec = malloc(16);
-                    memcpy(dec, entryData.str + dataCursor, n); // copy data
-                    memset(dec + n, 0x22, 14 - n); // default value
-                    dataCursor += n;
-                    if (dataCursor < entryData.size)
-                    {
-                        // write continuation block
-                        unsigned int continuationBlock = listIdx + 1;
-                        while (continuationBlock < noBlocks && !occupiedBlocks[continuationBlock]) continuationBlock++;
-                        smallEndianStr(continuationBlock, dec + 14, 2);
-                    }
-                    else
-                    {
-                        // no continuation block
-                        memset(dec + 14, 0, 2);
-                    }
-
-                    AES_ENC_BLK(dv, dec, ivCopyOut, (unsigned char **)&enc);
-                    file_writeBlocks(&dataOut, enc, 1);
-                    // increment writer IV
-                    aes_incrementCounter(ivCopyOut, 1);
-                    ivCopyOutInc++;
-
-                    free(enc);
-                    free(dec);
-                }
-                else
-                {
-                    dv_advanceStartIdx(dv->idIdxMap.root, listIdx - 1);
-                }
-            }
-            else
-            {
-                enc = file_readBlocks(&dataIn, 1);
-
-                if (!offset)
-                {
-                    // copy blocks raw
-                    file_writeBlocks(&dataOut, enc, 1);
-                }
-                else
-                {
-                    // must decrypt then re-encrypt with unsynced IVs
-                    AES_DEC_BLK(dv, enc, ivCopyIn, &dec);
-
-                    // modify continuation block
-                    unsigned int continuationBlock = smallEndianValue(dec + 14, 2);
-                    if (continuationBlock)
-                    {
-                        int noBlocksLeft = (entryData.size - dataCursor + 13) / 14;
-                        unsigned int decrement = 0;
-                        for (int i = listIdx + 1; i < continuationBlock; i++)
-                        {
-                            if (occupiedBlocks[i])
-                            {
-                                noBlocksLeft--;
-                            }
-                        }
-                        decrement = noBlocksLeft < 0 ? -noBlocksLeft : 0;
-                        continuationBlock -= decrement + offset;
-                        smallEndianStr(continuationBlock, dec + 14, 2);
-                    }
-
-                    AES_ENC_BLK(dv, dec, ivCopyOut, (unsigned char **)&enc);
-                    file_writeBlocks(&dataOut, enc, 1);
-
-                    if (DV_DEBUG)
-                    {
-                        printHexString(dec, 16, "dec");
-                        printHexString(enc, 16, "enc");
-                    }
-
-                    free(dec);
-                }
-
-                free(enc);
-
-                // increment writer IV
-                aes_incrementCounter(ivCopyOut, 1);
-                ivCopyOutInc++;
-            }
-
-            // always increment reader IV
-            aes_incrementCounter(ivCopyIn, 1);
-            ivCopyInInc++;
-        }
-
-        file_close(&dataIn);
-        file_close(&dataOut);
-
-        file_copy(data_fp, data_tmp_fp);
-
-        free(occupiedBlocks);
-    } while (false);
-
-    conditionalFree(ivCopyIn, free);
-    conditionalFree(ivCopyOut, free);
-    strstream_clear(&entryData);
+        return retCode;
+    }
+    if (!(retCode = dv_pageDeleteData(&pages, entryId, home, catId)))
+    {
+        retCode = dv_pageCommit(&pages);
+    }
+    dv_pageClose(&pages);
 
     return retCode;
 }
 
 int dv_setEntryData(dv_app *dv, const char *name, const char *category, const char *data)
 {
+    return dv_setEntryBytes(dv, name, category, data, strlen(data));
+}
+
+int dv_setEntryBytes(dv_app *dv, const char *name, const char *category, const void *data, int n)
+{
+    // one group, a crash leaves either the old or the new value
+    dv_walBatchBegin(dv);
     dv_deleteEntryData(dv, name, category);
-    return dv_createEntryData(dv, name, category, data);
+    int retCode = dv_writeEntryBytes(dv, name, category, data, n);
+    int commitCode = dv_walBatchEnd(dv);
+
+    return retCode ? retCode : commitCode;
 }
 
 int dv_accessEntryData(dv_app *dv, const char *name, const char *category, char **buffer)
+{
+    int n = 0;
+    return dv_accessEntryBytes(dv, name, category, buffer, &n);
+}
+
+/**
+ * the value and its length, zeros in it included;
+ * the buffer is terminated after it all the same
+ */
+int dv_accessEntryBytes(dv_app *dv, const char *name, const char *category, char **buffer, int *n)
 {
     if (!dv->loggedIn)
     {
@@ -926,151 +662,66 @@ int dv_accessEntryData(dv_app *dv, const char *name, const char *category, char
     }
 
     // find entry id
+    int loadCode = DV_SUCCESS;
+    if (loadCode = dv_requireMap(dv, DV_NAMEIDMAP))
+    {
+        return loadCode;
+    }
     unsigned int entryId = (unsigned int)avl_get(dv->nameIdMap, (void *)name);
     if (!entryId)
     {
         return DV_INVALID_INPUT;
     }
 
-    unsigned char catId = (unsigned char)(unsigned int)avl_get(dv->catIdMap, (void *)category);
+    if (loadCode = dv_requireMap(dv, DV_CATIDMAP))
+    {
+        return loadCode;
+    }
+    unsigned int catId = (unsigned int)avl_get(dv->catIdMap, (void *)category);
     if (!catId)
     {
         return DV_INVALID_INPUT;
     }
 
+    if (loadCode = dv_requireMap(dv, DV_IDIDXMAP))
+    {
+        return loadCode;
+    }
+
     if (DV_DEBUG)
     {
         printf("Entry id for %s: %d\n", name, entryId);
         printf("Category id for %s: %d\n", category, catId);
     }
 
-    strstream ret = strstream_allocDefault();
-    unsigned int previousBlock = 0;
-    unsigned int currentBlock = (unsigned int)btree_search(dv->idIdxMap, entryId);
-    unsigned int nextBlock = 0;
+    unsigned int home = (unsigned int)btree_search(dv->idIdxMap, entryId);
 
+    dv_pageSet pages;
     int retCode = DV_SUCCESS;
-
-    do
+    if (retCode = dv_pageOpen(&pages, dv, NULL))
     {
-        file_struct dataFile;
-        if (!file_openBlocks(&dataFile, data_fp, "rb", 16))
-        {
-            retCode = DV_FILE_DNE;
-            break;
-        }
-        unsigned int noBlocks = dataFile.len >> 4; // len / 16
-
-        // skip first block
-        file_advanceCursorBlocks(&dataFile, 1);
-
-        // copy IV
-        unsigned char *ivCopy = malloc(16);
-        memcpy(ivCopy, dv->random + dataIV_offset, 16);
-
-        bool completed = false;
-        bool onTarget = false;
-        bool scanData = false;
-        unsigned int startIdx;
-
-        while (currentBlock < noBlocks)
-        {
-            // skip blocks
-            int increment = currentBlock - previousBlock;
-            file_advanceCursorBlocks(&dataFile, increment - 1);
-            aes_incrementCounter(ivCopy, increment);
-
-            // read block
-            char *enc = file_readBlocks(&dataFile, 1);
-            unsigned char *dec = NULL;
-            AES_DEC_BLK(dv, enc, ivCopy, &dec);
-
-            if (DV_DEBUG)
-            {
-                printf("==Block %d: increment by %d\n", currentBlock, increment);
-                printHexString(enc, 16, "encBlock");
-                printHexString(ivCopy, 16, "ivInc");
-                printHexString(dec, 16, "decBlock");
-            }
-
-            if (onTarget)
-            {
-                // read from beginning of block
-                startIdx = 0;
-            }
-
-            int i = 0;
-            for (; i < 16 - sizeof(unsigned short); i++)
-            {
-                if (!scanData)
-                {
-                    scanData = true;
-
-                    if (dec[i] == catId)
-                    {
-                        // found target
-                        onTarget = true;
-                        startIdx = i + 1;
-                    }
-                }
-
-                if (!dec[i])
-                {
-                    // terminator character
-                    scanData = false;
-
-                    if (onTarget)
-                    {
-                        // finished reading target
-                        completed = true;
-                        break;
-                    }
-                }
-            }
-
-            if (onTarget)
-            {
-                // write characters to the buffer
-                strstream_read(&ret, dec + startIdx, i - startIdx);
-            }
-
-            // read continuation block
-            nextBlock = smallEndianValue(dec + 14, 2);
-
-            free(enc);
-            free(dec);
-
-            if (completed || !nextBlock)
-            {
-                // either completed entry or read all data
-                break;
-            }
-
-            // update counters
-            previousBlock = currentBlock;
-            currentBlock = nextBlock;
-        }
+        return retCode;
+    }
 
-        file_close(&dataFile);
-        free(ivCopy);
-
-        if (!completed)
-        {
-            // data does not exist
-            retCode = DV_INVALID_INPUT;
-            break;
-        }
+    // chains mostly continue close to their home page
+    file_mapWillNeed(&pages.map, (file_off)home * DV_PAGE_LEN, DV_PREFETCH_DATA_LEN);
 
+    strstream ret = strstream_allocDefault();
+    if (!(retCode = dv_pageReadData(&pages, entryId, home, catId, &ret)))
+    {
         // set return value
         *buffer = malloc(ret.size + 1);
-        memcpy(*buffer, ret.str, ret.size + 1);
-    } while (false);
+        memcpy(*buffer, ret.str, ret.size);
+        (*buffer)[ret.size] = 0;
+        *n = ret.size;
+    }
 
+    dv_pageClose(&pages);
     strstream_clear(&ret);
     return retCode;
 }
 
-void dv_advanceStartIdx(btree_node *root, unsigned int skipBlock)
+void dv_advanceStartIdxNode(btree_node *root, unsigned int skipBlock)
 {
     // do an inorder traversal
     if (root)
@@ -1081,7 +732,7 @@ void dv_advanceStartIdx(btree_node *root, unsigned int skipBlock)
             // traverse to children
             if (root->noChildren)
             {
-                dv_advanceStartIdx(root->children[i], skipBlock);
+                dv_advanceStartIdxNode(root->children[i], skipBlock);
             }
 
             unsigned int idx = (unsigned int)root->vals[i];
@@ -1093,7 +744,7 @@ void dv_advanceStartIdx(btree_node *root, unsigned int skipBlock)
         // traverse to last child
         if (root->noChildren)
         {
-             dv_advanceStartIdx(root->children[i], skipBlock);
+             dv_advanceStartIdxNode(root->children[i], skipBlock);
         }
     }
 }
@@ -1105,43 +756,40 @@ int dv_printDataFile(dv_app *dv)
         return DV_LOGGED_OUT;
     }
 
-    file_struct dataFile;
-    if (!file_openBlocks(&dataFile, data_fp, "rb", 16))
+    dv_pageSet pages;
+    int retCode = DV_SUCCESS;
+    if (retCode = dv_pageOpen(&pages, dv, NULL))
     {
-        return DV_FILE_DNE;
+        return retCode;
     }
-    unsigned int currentBlock = 1;
-    unsigned int noBlocks = dataFile.len >> 4; // len / 16
 
-    printf("Opened %s, %d blocks to read\n", data_fp, noBlocks);
+    printf("Opened %s, %d pages to read\n", data_fp, pages.filePages);
 
-    // skip first block
-    file_advanceCursorBlocks(&dataFile, 1);
+    unsigned char dec[DV_PAGE_LEN];
+    for (unsigned int page = 1; page < pages.filePages; page++)
+    {
+        // decrypt straight out of the mapping
+        dv_pageCrypt(dv, pages.version, page, file_mapBlocks(&pages.map, page, 1), DV_PAGE_LEN, dec);
+        printf("==Page %d: %d slots, %d bytes free\n", page, dv_pageNoSlots(dec), dv_pageFree(dec));
 
-    // copy IV
-    unsigned char *ivCopy = malloc(16);
-    memcpy(ivCopy, dv->random + dataIV_offset, 16);
+        for (int i = 0; i < dv_pageNoSlots(dec); i++)
+        {
+            unsigned char *rec = dv_pageRecord(dec, i);
+            if (!rec)
+            {
+                printf("%d: invalid slot\n", i);
+                continue;
+            }
 
-    while (currentBlock < noBlocks)
-    {
-        // skip blocks
-        aes_incrementCounter(ivCopy, 1);
-
-        // read block
-        char *enc = file_readBlocks(&dataFile, 1);
-        unsigned char *dec = NULL;
-        AES_DEC_BLK(dv, enc, ivCopy, &dec);
-
-        char *encHex = printByteArr(enc, 16, 0, 0, 0);
-        printHexString(dec, 16, encHex);
-        free(encHex);
-        free(enc);
-        free(dec);
-        currentBlock++;
+            char title[64];
+            sprintf(title, "%d: entry %d, category %d%s", i,
+                    smallEndianValue(rec, 4), dv_recordCategory(rec), rec[5] & DV_RECORD_MORE ? ", continued" : "");
+            printHexString(dv_recordValue(rec), smallEndianValue(rec + 6, 2), title);
+        }
     }
+    memset(dec, 0, DV_PAGE_LEN);
 
-    file_close(&dataFile);
-    free(ivCopy);
+    dv_pageClose(&pages);
 
     return DV_SUCCESS;
-}
\ No newline at end of file
+}
@@ -17,12 +17,16 @@ int dv_logout(dv_app *dv);
 
 int dv_createEntry(dv_app *dv, const char *name);
 int dv_createEntryData(dv_app *dv, const char *name, const char *category, const char *data);
+int dv_writeEntryData(dv_app *dv, const char *name, const char *category, const char *data);
+int dv_writeEntryBytes(dv_app *dv, const char *name, const char *category, const void *data, int n);
 int dv_deleteEntryData(dv_app *dv, const char *name, const char *category);
 int dv_setEntryData(dv_app *dv, const char *name, const char *category, const char *data);
+int dv_setEntryBytes(dv_app *dv, const char *name, const char *category, const void *data, int n);
 
 int dv_accessEntryData(dv_app *dv, const char *name, const char *category, char **buffer);
+int dv_accessEntryBytes(dv_app *dv, const char *name, const char *category, char **buffer, int *n);
 
-void dv_advanceStartIdx(btree_node *root, unsigned int skipBlock);
+void dv_advanceStartIdxNode(btree_node *root, unsigned int skipBlock);
 
 int dv_printDataFile(dv_app *dv);
 
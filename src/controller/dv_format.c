@@ -0,0 +1,557 @@
+#include "dv_format.h"
+#include "dv_controller.h"
+#include "dv_persistence.h"
+#include "dv_wal.h"
+#include "dv_page.h"
+#include "dv_journal.h"
+
+#include "../lib/util/fileio.h"
+#include "../lib/util/mem.h"
+
+#include "../lib/cmathematics/util/numio.h"
+#include "../lib/cmathematics/data/encryption/aes.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// layout of the block formats, only read while migrating
+#define DV_V1_PAYLOAD_LEN 14
+#define DV_V1_POINTER_LEN 2
+#define DV_V2_PAYLOAD_LEN 12
+#define DV_V2_POINTER_LEN 4
+
+// state while rewriting data.dv in the current format
+typedef struct
+{
+    dv_app *dv;
+
+    file_mapping in;       // data.dv in the old format
+    file_struct out;       // data.dv in the current format
+    unsigned int noBlocks; // blocks in the old file, no chain is longer
+    int payloadLen;
+    int pointerLen;
+
+    // entry being moved
+    strstream payload;
+    unsigned int noEntries;
+
+    int retCode;
+} dv_migration;
+
+// link record of a page, collected while rebuilding the index
+typedef struct
+{
+    unsigned int entryId;
+    unsigned int page;
+    unsigned int next;
+} dv_pageLink;
+
+void dv_writeSuperblock(unsigned char *block, unsigned char version, unsigned int generation)
+{
+    memset(block, 0, 16);
+    memcpy(block, DV_SUPERBLOCK_MAGIC, DV_SUPERBLOCK_MAGIC_LEN);
+    block[4] = version;
+    smallEndianStr(generation, block + 8, 4);
+}
+
+int dv_readSuperblock(dv_app *dv)
+{
+    file_struct dataFile;
+    if (!file_open(&dataFile, data_fp, "rb"))
+    {
+        return DV_FILE_DNE;
+    }
+
+    unsigned char block[16];
+    int n = file_pread(&dataFile, 0, block, 16);
+    file_close(&dataFile);
+
+    if (n == 16 && !memcmp(block, DV_SUPERBLOCK_MAGIC, DV_SUPERBLOCK_MAGIC_LEN))
+    {
+        dv->formatVersion = block[4];
+        dv->formatGeneration = smallEndianValue(block + 8, 4);
+    }
+    else
+    {
+        // written before the superblock existed
+        dv->formatVersion = DV_FORMAT_V1;
+        dv->formatGeneration = 0;
+    }
+
+    if (dv->formatVersion > DV_FORMAT)
+    {
+        // written by a newer build
+        return DV_INVALID_INPUT;
+    }
+
+    if (DV_DEBUG)
+    {
+        printf("[format] version %d since generation %d\n", dv->formatVersion, dv->formatGeneration);
+    }
+
+    return DV_SUCCESS;
+}
+
+/**
+ * idIdxMap.dv was checkpointed before data.dv moved to pages,
+ * its indices are blocks of the old file
+ */
+bool dv_indexStale(dv_app *dv)
+{
+    return dv->formatVersion >= DV_FORMAT_V3 && dv->mapGeneration[DV_IDIDXMAP] < dv->formatGeneration;
+}
+
+/**
+ * bytes of an index in the loaded idIdxMap.dv, 0 if it is stale and rebuilt instead;
+ * maps checkpointed before the block migration keep the 2 byte indices
+ */
+int dv_idxLen(dv_app *dv)
+{
+    if (dv_indexStale(dv))
+    {
+        return 0;
+    }
+
+    return dv->formatVersion >= DV_FORMAT_V2 && dv->mapGeneration[DV_IDIDXMAP] >= dv->formatGeneration
+               ? 4
+               : 2;
+}
+
+/**
+ * category ids in the loaded catIdMap.dv are varints,
+ * maps checkpointed before the file was rewritten in version 5 keep 1 byte ids
+ */
+bool dv_catIdVarint(dv_app *dv)
+{
+    return dv->formatVersion >= DV_FORMAT_V5 && dv->mapGeneration[DV_CATIDMAP] >= dv->formatGeneration;
+}
+
+int dv_pageLinkCompare(const void *a, const void *b)
+{
+    unsigned int i1 = ((dv_pageLink *)a)->entryId;
+    unsigned int i2 = ((dv_pageLink *)b)->entryId;
+
+    return i1 < i2 ? -1 : i1 > i2;
+}
+
+/**
+ * recover idIdxMap from the link records in data.dv,
+ * after a migration interrupted before its checkpoint
+ */
+int dv_rebuildIndex(dv_app *dv)
+{
+    dv_walWait(dv);
+    file_mapping dataMap;
+    if (!file_map(&dataMap, data_fp, DV_PAGE_LEN, false))
+    {
+        return DV_FILE_DNE;
+    }
+    unsigned int noPages = (unsigned int)MIN(dataMap.len / DV_PAGE_LEN, (file_off)DV_MAX_PAGE + 1);
+
+    dv_pageLink *links = NULL;
+    int noLinks = 0;
+    int cap = 0;
+
+    unsigned char dec[DV_PAGE_LEN];
+    for (unsigned int page = 1; page < noPages; page++)
+    {
+        dv_pageCrypt(dv, dv->formatVersion, page, file_mapBlocks(&dataMap, page, 1), DV_PAGE_LEN, dec);
+        for (int i = 0; i < dv_pageNoSlots(dec); i++)
+        {
+            unsigned char *rec = dv_pageRecord(dec, i);
+            if (!rec || rec[4] != DV_LINK_CATEGORY || smallEndianValue(rec + 6, 2) != 4)
+            {
+                continue;
+            }
+
+            if (noLinks == cap)
+            {
+                cap = cap ? cap << 1 : 64;
+                links = realloc(links, cap * sizeof(dv_pageLink));
+            }
+            links[noLinks].entryId = smallEndianValue(rec, 4);
+            links[noLinks].page = page;
+            links[noLinks].next = smallEndianValue(rec + DV_RECORD_HEADER_LEN, 4);
+            noLinks++;
+        }
+    }
+    memset(dec, 0, DV_PAGE_LEN);
+    file_unmap(&dataMap);
+
+    qsort(links, noLinks, sizeof(dv_pageLink), dv_pageLinkCompare);
+
+    // an entry starts at the one page of its chain no other link points to
+    btree_free(&dv->idIdxMap);
+    int i = 0;
+    while (i < noLinks)
+    {
+        int j = i;
+        while (j < noLinks && links[j].entryId == links[i].entryId)
+        {
+            j++;
+        }
+
+        for (int k = i; k < j; k++)
+        {
+            bool linked = false;
+            for (int l = i; l < j && !linked; l++)
+            {
+                linked = links[l].next == links[k].page;
+            }
+
+            if (!linked)
+            {
+                btree_insert(&dv->idIdxMap, links[k].entryId, (void *)(uintptr_t)links[k].page);
+                dv->maxEntryId = MAX(dv->maxEntryId, links[k].entryId);
+                break;
+            }
+        }
+
+        i = j;
+    }
+    conditionalFree(links, free);
+
+    if (DV_DEBUG)
+    {
+        printf("[format] rebuilt the index from %d links in %d pages\n", noLinks, noPages);
+    }
+
+    dv->mapDirty[DV_IDIDXMAP] = true;
+    return DV_SUCCESS;
+}
+
+void dv_migrateEntry(dv_migration *m, unsigned int entryId, void **val)
+{
+    unsigned char dec[16];
+    unsigned char iv[16];
+    m->payload.size = 0;
+
+    // collect the old chain's data
+    unsigned int block = (unsigned int)(uintptr_t)*val;
+    unsigned int length = 0;
+    while (block)
+    {
+        if (block >= m->noBlocks || ++length > m->noBlocks)
+        {
+            // chain leaves the file or loops
+            m->retCode = DV_INVALID_INPUT;
+            return;
+        }
+
+        memcpy(iv, m->dv->random + dataIV_offset, 16);
+        aes_incrementCounter(iv, block);
+        aes_ctr_block(file_mapBlocks(&m->in, block, 1), 16, m->dv->aes_key_schedule, AES_256_NR, iv, dec);
+
+        unsigned int nextBlock = smallEndianValue(dec + m->payloadLen, m->pointerLen);
+        int n = m->payloadLen;
+        if (!nextBlock)
+        {
+            // last block is filled up to its final terminator
+            while (n > 0 && dec[n - 1])
+            {
+                n--;
+            }
+        }
+        strstream_read(&m->payload, dec, n);
+
+        block = nextBlock;
+    }
+
+    // one page set per entry keeps the pages in memory bounded
+    dv_pageSet s;
+    dv_pageOpen(&s, m->dv, &m->out);
+
+    unsigned int home = 0;
+    int retCode = dv_pageCreateEntry(&s, entryId, &home);
+
+    // payload: catId, value, '\0' for every category
+    unsigned char *p = (unsigned char *)m->payload.str;
+    int i = 0;
+    while (!retCode && i < m->payload.size)
+    {
+        int j = i + 1;
+        while (j < m->payload.size && p[j])
+        {
+            j++;
+        }
+
+        if (p[i] != DV_LINK_CATEGORY)
+        {
+            retCode = dv_pageWriteData(&s, entryId, home, p[i], p + i + 1, j - i - 1);
+        }
+        i = j + 1;
+    }
+
+    if (!retCode)
+    {
+        retCode = dv_pageCommit(&s);
+    }
+    dv_pageClose(&s);
+
+    if (DV_DEBUG)
+    {
+        printf("[format] moved %d bytes of entry %d to page %d\n", m->payload.size, entryId, home);
+    }
+
+    *val = (void *)(uintptr_t)home;
+    m->noEntries++;
+    m->retCode = retCode;
+}
+
+void dv_migrateNode(dv_migration *m, btree_node *root)
+{
+    if (!root)
+    {
+        return;
+    }
+
+    for (int i = 0; i < root->n && !m->retCode; i++)
+    {
+        if (root->noChildren)
+        {
+            dv_migrateNode(m, root->children[i]);
+        }
+        if (!m->retCode)
+        {
+            dv_migrateEntry(m, root->keys[i], root->vals + i);
+        }
+    }
+    if (root->noChildren && !m->retCode)
+    {
+        dv_migrateNode(m, root->children[root->n]);
+    }
+}
+
+void dv_stagedPath(int map, char *path)
+{
+    sprintf(path, "%s%s", dv_maps[map].path, DV_STAGED_SUFFIX);
+}
+
+/**
+ * highest generation of the maps an unfinished migration staged,
+ * a migration run again writes past it so no map keystream is used twice
+ */
+unsigned int dv_stagedGeneration()
+{
+    unsigned int ret = 0;
+    char path[64];
+
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        dv_stagedPath(i, path);
+        file_struct file;
+        if (!file_open(&file, path, "rb"))
+        {
+            continue;
+        }
+
+        unsigned char header[DV_MAP_HEADER_LEN];
+        if (file_pread(&file, 0, header, DV_MAP_HEADER_LEN) == DV_MAP_HEADER_LEN)
+        {
+            ret = MAX(ret, smallEndianValue(header, DV_MAP_HEADER_LEN));
+        }
+        file_close(&file);
+    }
+
+    return ret;
+}
+
+/**
+ * data.dv was rewritten but the maps staged for it were not moved into place;
+ * staged maps beside an older data.dv are removed by the next rewrite
+ */
+bool dv_migrationStaged(dv_app *dv)
+{
+    return dv->formatVersion >= DV_FORMAT_V3 && dv_stagedGeneration() == dv->formatGeneration &&
+           dv_latestMapGeneration(dv) <= dv->formatGeneration;
+}
+
+// false if a staged map is left in place of the one it replaces
+bool dv_finishMigration(dv_app *dv)
+{
+    bool ret = true;
+    char path[64];
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        dv_stagedPath(i, path);
+        file_struct file;
+        if (!file_open(&file, path, "rb"))
+        {
+            continue;
+        }
+        file_close(&file);
+
+        if (file_rename(path, dv_maps[i].path))
+        {
+            if (DV_DEBUG)
+            {
+                printf("[format] moved %s into place\n", path);
+            }
+        }
+        else
+        {
+            ret = false;
+        }
+    }
+
+    // scratch file of the first format
+    file_remove(data_tmp_fp);
+
+    // the maps in place carry the staged generation now
+    dv->mapFilesRead = false;
+
+    return ret;
+}
+
+/**
+ * rewrite data.dv in the current format, one entry at a time,
+ * and point idIdxMap at the pages the entries moved to;
+ * the changed maps are staged first and moved into place once data.dv is replaced,
+ * a login after an interruption in between moves them, and a stale idIdxMap.dv
+ * from an older build is rebuilt from the pages when the index is loaded
+ */
+int dv_migrate(dv_app *dv)
+{
+    if (dv->formatVersion >= DV_FORMAT_V3)
+    {
+        // pages of version 3 are still read and written, defrag rewrites them
+        return DV_SUCCESS;
+    }
+
+    int retCode = DV_SUCCESS;
+
+    // the entries come from the index maps with the journal applied,
+    // and the maps are written with it before the journal is emptied
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        if ((retCode = dv_requireMap(dv, i)))
+        {
+            return retCode;
+        }
+    }
+    unsigned int generation = MAX(dv_nextGeneration(dv), dv_stagedGeneration() + 1);
+
+    dv_walWait(dv);
+
+    dv_migration m;
+    memset(&m, 0, sizeof(dv_migration));
+    m.dv = dv;
+    m.payloadLen = dv->formatVersion >= DV_FORMAT_V2 ? DV_V2_PAYLOAD_LEN : DV_V1_PAYLOAD_LEN;
+    m.pointerLen = dv->formatVersion >= DV_FORMAT_V2 ? DV_V2_POINTER_LEN : DV_V1_POINTER_LEN;
+    m.payload = strstream_allocDefault();
+
+    if (!file_map(&m.in, data_fp, 16, false))
+    {
+        strstream_clear(&m.payload);
+        return DV_FILE_DNE;
+    }
+    if (!file_openTemp(&m.out, data_fp))
+    {
+        file_unmap(&m.in);
+        strstream_clear(&m.payload);
+        return DV_FILE_DNE;
+    }
+
+    m.noBlocks = (unsigned int)MIN(m.in.len >> 4, (file_off)0xffffffff);
+
+    // free space is tracked for the new file
+    dv_pageClearFreeSpace(dv);
+
+    // page 0 holds the superblock
+    unsigned char page[DV_PAGE_LEN];
+    memset(page, 0, DV_PAGE_LEN);
+    dv_writeSuperblock(page, DV_FORMAT, generation);
+    file_pwrite(&m.out, 0, page, DV_PAGE_LEN);
+
+    dv_migrateNode(&m, dv->idIdxMap.root);
+    retCode = m.retCode;
+
+    file_off len = m.out.len;
+    file_unmap(&m.in);
+    strstream_clear(&m.payload);
+
+    if (retCode)
+    {
+        file_abort(&m.out, data_fp);
+    }
+    else
+    {
+        retCode = dv_replaceData(dv, &m.out, generation);
+    }
+    if (retCode)
+    {
+        dv_pageClearFreeSpace(dv);
+        return retCode;
+    }
+
+    if (DV_DEBUG)
+    {
+        printf("[format] migrated %d entries into %lld pages, version %d at generation %d\n",
+               m.noEntries, (long long)(len / DV_PAGE_LEN), DV_FORMAT, generation);
+    }
+
+    return DV_SUCCESS;
+}
+
+/**
+ * replace data.dv with a rewritten file, written at generation with idIdxMap pointing into it;
+ * the changed maps are staged first and moved into place once data.dv is replaced
+ */
+int dv_replaceData(dv_app *dv, file_struct *out, unsigned int generation)
+{
+    int retCode = DV_SUCCESS;
+    char path[64];
+
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        // staged by a rewrite that never replaced data.dv
+        dv_stagedPath(i, path);
+        file_remove(path);
+    }
+
+    // the maps for the new file are durable before it replaces the old one,
+    // and written in its format
+    unsigned char version = dv->formatVersion;
+    dv->formatVersion = DV_FORMAT;
+    dv->mapDirty[DV_IDIDXMAP] = true;
+    for (int i = 0; i < DV_NO_MAPS && !retCode; i++)
+    {
+        if (dv->mapDirty[i])
+        {
+            dv_stagedPath(i, path);
+            retCode = dv_stringify(dv, i, generation, path);
+        }
+    }
+    dv->formatVersion = version;
+
+    if (retCode)
+    {
+        file_abort(out, data_fp);
+        return retCode;
+    }
+    if (!file_commit(out, data_fp))
+    {
+        return DV_FILE_DNE;
+    }
+
+    dv->formatVersion = DV_FORMAT;
+    dv->formatGeneration = generation;
+    if (!dv_finishMigration(dv))
+    {
+        // the maps in place no longer match data.dv, the next login moves the staged ones
+        return DV_FILE_DNE;
+    }
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        if (dv->mapDirty[i])
+        {
+            dv->mapGeneration[i] = generation;
+            dv->mapDirty[i] = false;
+        }
+    }
+
+    // the maps hold every journaled change
+    return dv_journalReset(dv, generation);
+}
@@ -0,0 +1,34 @@
+#include "../datavault.h"
+#include "../lib/util/fileio.h"
+
+#ifndef DV_FORMAT_H
+#define DV_FORMAT_H
+
+// data.dv formats, recorded in the superblock
+#define DV_FORMAT_V1 1 // payload(14), continuation block(2); block 0 holds random bytes
+#define DV_FORMAT_V2 2 // payload(12), continuation block(4); block 0 is the superblock
+#define DV_FORMAT_V3 3 // slotted pages, see dv_page.h; page 0 starts with the superblock
+#define DV_FORMAT_V4 4 // slotted pages ending in their own nonce, so they decrypt the same at any position
+#define DV_FORMAT_V5 5 // category ids past 255, varints in catIdMap.dv
+#define DV_FORMAT DV_FORMAT_V5
+
+// superblock, plaintext at the start of data.dv: magic(4), version(1), reserved(3), formatGeneration(4), reserved(4)
+#define DV_SUPERBLOCK_MAGIC "dvsb"
+#define DV_SUPERBLOCK_MAGIC_LEN 4
+
+// maps written by a migration before data.dv is replaced, moved over the maps once it is
+#define DV_STAGED_SUFFIX ".new"
+
+void dv_writeSuperblock(unsigned char *block, unsigned char version, unsigned int generation);
+int dv_readSuperblock(dv_app *dv);
+bool dv_indexStale(dv_app *dv);
+int dv_idxLen(dv_app *dv);
+bool dv_catIdVarint(dv_app *dv);
+int dv_rebuildIndex(dv_app *dv);
+unsigned int dv_stagedGeneration();
+bool dv_migrationStaged(dv_app *dv);
+bool dv_finishMigration(dv_app *dv);
+int dv_migrate(dv_app *dv);
+int dv_replaceData(dv_app *dv, file_struct *out, unsigned int generation);
+
+#endif // DV_FORMAT_H
@@ -0,0 +1,498 @@
+#include "dv_journal.h"
+#include "dv_controller.h"
+#include "dv_persistence.h"
+#include "dv_format.h"
+#include "dv_wal.h"
+
+#include "../lib/util/fileio.h"
+#include "../lib/util/mem.h"
+
+#include "../lib/cmathematics/util/numio.h"
+#include "../lib/cmathematics/lib/arrays.h"
+#include "../lib/cmathematics/data/hashing/hkdf.h"
+#include "../lib/cmathematics/data/hashing/sha.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+const char *journal_fp = "journal.dv";
+
+void dv_deriveJournalKey(dv_app *dv)
+{
+    unsigned char *subkey = NULL;
+
+    // subkey = HKDF(k = dataKey, info = file name)
+    hkdf_hmac_sha(dv->dataKey, DV_KEYLEN,
+                  NULL, 0,
+                  (unsigned char *)journal_fp, strlen(journal_fp),
+                  SHA512_STR, DV_KEYLEN, &subkey);
+
+    aes_generateKeySchedule(subkey, AES_256, dv->journal_key_schedule);
+
+    memset(subkey, 0, DV_KEYLEN);
+    free(subkey);
+}
+
+/**
+ * CTR keystream for the records starts at the nonce,
+ * so records can be encrypted at any offset when appended
+ */
+void dv_journalCrypt(dv_app *dv, int pos, unsigned char *in, int n, unsigned char *out)
+{
+    // start at the block containing pos
+    int skip = pos & 0x0f;
+    unsigned char iv[16];
+    memcpy(iv, dv->journalNonce, 16);
+    aes_incrementCounter(iv, pos >> 4);
+
+    unsigned char *padded = malloc(skip + n);
+    memset(padded, 0, skip);
+    memcpy(padded + skip, in, n);
+
+    unsigned char *enc = NULL;
+    aes_encrypt_withSchedule(padded, skip + n,
+                             dv->journal_key_schedule, AES_256_NR, AES_CTR,
+                             iv, &enc);
+    memcpy(out, enc + skip, n);
+
+    memset(padded, 0, skip + n);
+    free(padded);
+    free(enc);
+}
+
+/**
+ * highest generation among the map files, their headers are read once after login
+ * or a journal read and the checkpoints of this process keep it up to date
+ */
+unsigned int dv_latestMapGeneration(dv_app *dv)
+{
+    if (dv->mapFilesRead)
+    {
+        return dv->mapFileGeneration;
+    }
+
+    dv->mapFilesRead = true;
+    dv->mapFileGeneration = 0;
+    if (dv->formatVersion == DV_FORMAT_V1)
+    {
+        // maps without a header
+        return dv->mapFileGeneration;
+    }
+
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        file_struct file;
+        if (!file_open(&file, dv_maps[i].path, "rb"))
+        {
+            continue;
+        }
+
+        if (file.len >= DV_MAP_HEADER_LEN)
+        {
+            char *header = file_read(&file, DV_MAP_HEADER_LEN);
+            dv->mapFileGeneration = MAX(dv->mapFileGeneration, smallEndianValue(header, DV_MAP_HEADER_LEN));
+            free(header);
+        }
+        file_close(&file);
+    }
+
+    return dv->mapFileGeneration;
+}
+
+int dv_journalRead(dv_app *dv)
+{
+    if (dv->journalRead)
+    {
+        return DV_SUCCESS;
+    }
+
+    dv->journal = strstream_allocDefault();
+    dv->journalRead = true;
+    dv->mapFilesRead = false;
+
+    file_struct file;
+    if (!file_open(&file, journal_fp, "rb"))
+    {
+        // no journal, the maps apply as written
+        return dv_journalReset(dv, dv_latestMapGeneration(dv));
+    }
+
+    if (file.len < DV_JOURNAL_HEADER_LEN)
+    {
+        file_close(&file);
+        return dv_journalReset(dv, dv_latestMapGeneration(dv));
+    }
+
+    // read header
+    char *header = file_read(&file, DV_JOURNAL_HEADER_LEN);
+    memcpy(dv->journalNonce, header, 16);
+    dv->generation = smallEndianValue(header + 16, 4);
+    free(header);
+
+    // read and decrypt records
+    int n = file.len - DV_JOURNAL_HEADER_LEN;
+    if (n)
+    {
+        char *enc = file_read(&file, n);
+        unsigned char *dec = malloc(n);
+        dv_journalCrypt(dv, 0, enc, n, dec);
+        strstream_read(&dv->journal, dec, n);
+
+        memset(dec, 0, n);
+        free(dec);
+        free(enc);
+    }
+
+    file_close(&file);
+
+    if (DV_DEBUG)
+    {
+        printf("[journal] generation %d, %d bytes\n", dv->generation, dv->journal.size);
+    }
+
+    return DV_SUCCESS;
+}
+
+int dv_journalReset(dv_app *dv, unsigned int generation)
+{
+    // fresh nonce so no keystream is reused
+    randomBytes(dv->journalNonce, 16);
+    dv->generation = generation;
+
+    // discard records
+    if (dv->journal.str)
+    {
+        memset(dv->journal.str, 0, dv->journal.size);
+    }
+    dv->journal.size = 0;
+    dv->journalPending.size = 0;
+
+    unsigned char header[DV_JOURNAL_HEADER_LEN];
+    memcpy(header, dv->journalNonce, 16);
+    smallEndianStr(generation, header + 16, 4);
+
+    return file_writeContents(journal_fp, header, DV_JOURNAL_HEADER_LEN)
+        ? DV_SUCCESS
+        : DV_FILE_DNE;
+}
+
+void dv_journalClear(dv_app *dv)
+{
+    if (dv->journal.str)
+    {
+        memset(dv->journal.str, 0, dv->journal.size);
+    }
+    strstream_clear(&dv->journal);
+    strstream_clear(&dv->journalPending);
+
+    dv->journalRead = false;
+    dv->generation = 0;
+    dv->mapFilesRead = false;
+    dv->mapFileGeneration = 0;
+    memset(dv->journalNonce, 0, 16);
+}
+
+int dv_journalAppend(dv_app *dv, unsigned char op, unsigned char *payload, int n)
+{
+    int retCode = DV_SUCCESS;
+    if ((retCode = dv_journalRead(dv)))
+    {
+        return retCode;
+    }
+
+    if (!dv->walBatch && dv_latestMapGeneration(dv) > dv->generation)
+    {
+        // an interrupted checkpoint wrote maps past the journal, which would skip records for them
+        if ((retCode = dv_checkpoint(dv)))
+        {
+            return retCode;
+        }
+    }
+
+    // format: op, len, payload
+    int len = DV_JOURNAL_RECORD_HEADER_LEN + n;
+    unsigned char *record = malloc(len);
+    record[0] = op;
+    smallEndianStr(n, record + 1, 2);
+    memcpy(record + DV_JOURNAL_RECORD_HEADER_LEN, payload, n);
+
+    // encrypt at the end of the journal
+    unsigned char *enc = malloc(len);
+    dv_journalCrypt(dv, dv->journal.size, record, len, enc);
+
+    // durable before the operation returns
+    file_struct file;
+    if (dv->walBatch)
+    {
+        // written once the pages of the batch are committed
+        strstream_read(&dv->journalPending, enc, len);
+        strstream_read(&dv->journal, record, len);
+    }
+    else if (file_open(&file, journal_fp, "ab"))
+    {
+        file_write(&file, enc, len);
+        retCode = file_sync(&file) ? DV_SUCCESS : DV_FILE_DNE;
+        file_close(&file);
+
+        // keep in memory for the next checkpoint decision and replay
+        if (!retCode)
+        {
+            strstream_read(&dv->journal, record, len);
+        }
+    }
+    else
+    {
+        retCode = DV_FILE_DNE;
+    }
+
+    if (DV_DEBUG)
+    {
+        printHexString(record, len, "journal");
+    }
+
+    memset(record, 0, len);
+    free(record);
+    free(enc);
+
+    return retCode;
+}
+
+int dv_journalFlush(dv_app *dv)
+{
+    if (!dv->journalPending.size)
+    {
+        return DV_SUCCESS;
+    }
+
+    int retCode = DV_SUCCESS;
+    if (dv_latestMapGeneration(dv) > dv->generation)
+    {
+        // the checkpoint writes the maps with the held back records applied
+        dv->journalPending.size = 0;
+        return dv_checkpoint(dv);
+    }
+
+    // one append and one sync for the records of the batch
+    file_struct file;
+    if (file_open(&file, journal_fp, "ab"))
+    {
+        file_write(&file, dv->journalPending.str, dv->journalPending.size);
+        retCode = file_sync(&file) ? DV_SUCCESS : DV_FILE_DNE;
+        file_close(&file);
+    }
+    else
+    {
+        retCode = DV_FILE_DNE;
+    }
+
+    if (retCode)
+    {
+        dv_journalDiscardPending(dv);
+    }
+    dv->journalPending.size = 0;
+
+    return retCode;
+}
+
+/**
+ * drop the records held back for a batch that never reached journal.dv:
+ * they come off the end of the journal, so the next record is encrypted where the file ends,
+ * and the maps they changed are read again from their files and the journal
+ */
+void dv_journalDiscardPending(dv_app *dv)
+{
+    if (!dv->journalPending.size)
+    {
+        return;
+    }
+
+    dv->journal.size -= dv->journalPending.size;
+    unsigned char *str = (unsigned char *)dv->journal.str + dv->journal.size;
+    for (int i = 0; i + DV_JOURNAL_RECORD_HEADER_LEN <= dv->journalPending.size;)
+    {
+        switch (str[i])
+        {
+        case DV_JOURNAL_NAME:
+            dv->mapLoaded[DV_NAMEIDMAP] = false;
+            break;
+        case DV_JOURNAL_START:
+        case DV_JOURNAL_SHIFT:
+            dv->mapLoaded[DV_IDIDXMAP] = false;
+            break;
+        case DV_JOURNAL_CATEGORY:
+        case DV_JOURNAL_WIDE_CATEGORY:
+            dv->mapLoaded[DV_CATIDMAP] = false;
+            break;
+        }
+        i += DV_JOURNAL_RECORD_HEADER_LEN + smallEndianValue(str + i + 1, 2);
+    }
+
+    memset(str, 0, dv->journalPending.size);
+    dv->journalPending.size = 0;
+}
+
+int dv_journalName(dv_app *dv, const char *name, unsigned int id)
+{
+    int n = strlen(name) + 1;
+    unsigned char *payload = malloc(4 + n);
+    smallEndianStr(id, payload, 4);
+    memcpy(payload + 4, name, n);
+
+    int retCode = dv_journalAppend(dv, DV_JOURNAL_NAME, payload, 4 + n);
+    free(payload);
+
+    return retCode;
+}
+
+int dv_journalStart(dv_app *dv, unsigned int id, unsigned int home)
+{
+    unsigned char payload[8];
+    smallEndianStr(id, payload, 4);
+    smallEndianStr(home, payload + 4, 4);
+
+    return dv_journalAppend(dv, DV_JOURNAL_START, payload, 8);
+}
+
+int dv_journalCategory(dv_app *dv, const char *name, unsigned int catId)
+{
+    // ids that fit keep the record older builds read
+    int n = strlen(name) + 1;
+    unsigned char *payload = malloc(VARINT_MAX_LEN + n);
+    int idLen = 1;
+    if (catId > 0xff)
+    {
+        idLen = varintStr(catId, payload);
+    }
+    else
+    {
+        payload[0] = catId;
+    }
+    memcpy(payload + idLen, name, n);
+
+    int retCode = dv_journalAppend(dv, catId > 0xff ? DV_JOURNAL_WIDE_CATEGORY : DV_JOURNAL_CATEGORY,
+                                   payload, idLen + n);
+    free(payload);
+
+    return retCode;
+}
+
+char *copyName(unsigned char *name, int maxLen)
+{
+    int len = strnlen((char *)name, maxLen);
+    char *ret = malloc(len + 1);
+    memcpy(ret, name, len);
+    ret[len] = 0;
+    return ret;
+}
+
+int dv_journalReplay(dv_app *dv, int map)
+{
+    int retCode = DV_SUCCESS;
+    if (retCode = dv_journalRead(dv))
+    {
+        return retCode;
+    }
+
+    if (dv->mapGeneration[map] > dv->generation)
+    {
+        // an interrupted checkpoint already wrote this map, records are included
+        return DV_SUCCESS;
+    }
+
+    if (map == DV_IDIDXMAP && dv_indexStale(dv))
+    {
+        // records point into the old format, the pages hold the current indices
+        return dv_rebuildIndex(dv);
+    }
+
+    int noApplied = 0;
+    unsigned char *str = (unsigned char *)dv->journal.str;
+    int i = 0;
+    while (i + DV_JOURNAL_RECORD_HEADER_LEN <= dv->journal.size)
+    {
+        unsigned char op = str[i];
+        int n = smallEndianValue(str + i + 1, 2);
+        unsigned char *payload = str + i + DV_JOURNAL_RECORD_HEADER_LEN;
+        if (i + DV_JOURNAL_RECORD_HEADER_LEN + n > dv->journal.size)
+        {
+            // torn record at the end
+            break;
+        }
+        i += DV_JOURNAL_RECORD_HEADER_LEN + n;
+
+        switch (op)
+        {
+        case DV_JOURNAL_NAME:
+            if (map == DV_NAMEIDMAP && n > 4)
+            {
+                char *name = copyName(payload + 4, n - 4);
+                if (avl_get(dv->nameIdMap, name))
+                {
+                    free(name);
+                }
+                else
+                {
+                    dv->nameIdMap = avl_insert(dv->nameIdMap, name,
+                                               (void *)(uintptr_t)smallEndianValue(payload, 4));
+                }
+                noApplied++;
+            }
+            break;
+        case DV_JOURNAL_START:
+            if (map == DV_IDIDXMAP && n == 8)
+            {
+                unsigned int id = smallEndianValue(payload, 4);
+                btree_insert(&dv->idIdxMap, id, (void *)(uintptr_t)smallEndianValue(payload + 4, 4));
+                dv->maxEntryId = MAX(dv->maxEntryId, id);
+                noApplied++;
+            }
+            break;
+        case DV_JOURNAL_CATEGORY:
+        case DV_JOURNAL_WIDE_CATEGORY:
+            if (map == DV_CATIDMAP && n > 1)
+            {
+                unsigned int catId = payload[0];
+                int idLen = op == DV_JOURNAL_WIDE_CATEGORY ? varintValue(payload, n - 1, &catId) : 1;
+                if (!idLen || !catId)
+                {
+                    break;
+                }
+
+                char *name = copyName(payload + idLen, n - idLen);
+                if (avl_get(dv->catIdMap, name))
+                {
+                    free(name);
+                    dv->maxCatId = MAX(dv->maxCatId, catId);
+                }
+                else
+                {
+                    dv_insertCategory(dv, name, catId);
+                }
+                noApplied++;
+            }
+            break;
+        case DV_JOURNAL_SHIFT:
+            if (map == DV_IDIDXMAP && n == 4)
+            {
+                dv_advanceStartIdxNode(dv->idIdxMap.root, smallEndianValue(payload, 4));
+                noApplied++;
+            }
+            break;
+        }
+    }
+
+    if (noApplied)
+    {
+        // differs from the checkpoint
+        dv->mapDirty[map] = true;
+    }
+
+    if (DV_DEBUG)
+    {
+        printf("[journal] replayed %d records onto %s\n", noApplied, dv_maps[map].path);
+    }
+
+    return DV_SUCCESS;
+}
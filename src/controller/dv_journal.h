@@ -0,0 +1,42 @@
+#include "../datavault.h"
+
+#ifndef DV_JOURNAL_H
+#define DV_JOURNAL_H
+
+extern const char *journal_fp;
+
+// header: nonce, small endian checkpoint generation
+#define DV_JOURNAL_HEADER_LEN 20
+
+// record: op, small endian payload length, payload
+#define DV_JOURNAL_RECORD_HEADER_LEN 3
+
+// journal operations
+#define DV_JOURNAL_NAME 1     // id(4), name, '\0'             --> nameIdMap
+#define DV_JOURNAL_START 2    // id(4), home page(4)           --> idIdxMap
+#define DV_JOURNAL_CATEGORY 3 // catId(1), name, '\0'          --> catIdMap
+#define DV_JOURNAL_SHIFT 4    // skipBlock(4)                  --> idIdxMap, format 2 and earlier
+#define DV_JOURNAL_WIDE_CATEGORY 5 // varint(catId), name, '\0' --> catIdMap, ids past 255
+
+// checkpoint once the journal outgrows the map files by this factor
+#define DV_JOURNAL_RATIO 1
+// never checkpoint smaller journals
+#define DV_JOURNAL_MIN_LEN (4 << 10)
+
+void dv_deriveJournalKey(dv_app *dv);
+
+unsigned int dv_latestMapGeneration(dv_app *dv);
+int dv_journalRead(dv_app *dv);
+int dv_journalReset(dv_app *dv, unsigned int generation);
+void dv_journalClear(dv_app *dv);
+
+int dv_journalAppend(dv_app *dv, unsigned char op, unsigned char *payload, int n);
+int dv_journalFlush(dv_app *dv);
+void dv_journalDiscardPending(dv_app *dv);
+int dv_journalName(dv_app *dv, const char *name, unsigned int id);
+int dv_journalStart(dv_app *dv, unsigned int id, unsigned int home);
+int dv_journalCategory(dv_app *dv, const char *name, unsigned int catId);
+
+int dv_journalReplay(dv_app *dv, int map);
+
+#endif // DV_JOURNAL_H
@@ -0,0 +1,1621 @@
+#include "dv_page.h"
+#include "dv_controller.h"
+#include "dv_persistence.h"
+#include "dv_wal.h"
+#include "dv_format.h"
+
+#include "../lib/util/mem.h"
+
+#include "../lib/cmathematics/util/numio.h"
+#include "../lib/cmathematics/lib/arrays.h"
+#include "../lib/cmathematics/data/encryption/aes.h"
+#include "../lib/cmathematics/data/hashing/hkdf.h"
+#include "../lib/cmathematics/data/hashing/sha.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+const char *freeSpace_fp = "freeSpace.dv";
+
+/**
+ * CTR over the first n bytes of a page, in holds the whole page;
+ * from version 4 the counters start from the nonce at its end, which is copied as it is,
+ * before that page i uses the counters from dataIV + i * DV_PAGE_BLOCKS
+ */
+void dv_pageCrypt(dv_app *dv, unsigned char version, unsigned int page, unsigned char *in, int n,
+                  unsigned char *out)
+{
+    unsigned char iv[16];
+    if (version >= DV_FORMAT_V4)
+    {
+        memcpy(iv, in + DV_PAGE_LEN - DV_PAGE_NONCE_LEN, 16);
+        if (n == DV_PAGE_LEN)
+        {
+            n -= DV_PAGE_NONCE_LEN;
+            memmove(out + n, in + n, DV_PAGE_NONCE_LEN);
+        }
+    }
+    else
+    {
+        memcpy(iv, dv->random + dataIV_offset, 16);
+        aes_incrementCounter(iv, page * DV_PAGE_BLOCKS);
+    }
+
+    for (int i = 0; i < n; i += 16)
+    {
+        aes_ctr_block(in + i, n - i, dv->aes_key_schedule, AES_256_NR, iv, out + i);
+        aes_incrementCounter(iv, 1);
+    }
+}
+
+void dv_pageInit(unsigned char *dec)
+{
+    // no slots, records start before the nonce
+    memset(dec, 0, DV_PAGE_LEN);
+    smallEndianStr(DV_PAGE_LEN - DV_PAGE_NONCE_LEN, dec + 2, 2);
+}
+
+int dv_pageOpen(dv_pageSet *s, dv_app *dv, file_struct *file)
+{
+    memset(s, 0, sizeof(dv_pageSet));
+    s->dv = dv;
+    s->file = file;
+
+    // a file written directly is a new one
+    s->version = file ? DV_FORMAT : dv->formatVersion;
+
+    file_off len = 0;
+    if (file)
+    {
+        len = file->len;
+    }
+    else
+    {
+        // pending groups must reach data.dv first
+        dv_walWait(dv);
+        if (!file_map(&s->map, data_fp, DV_PAGE_LEN, false))
+        {
+            return DV_FILE_DNE;
+        }
+        len = s->map.len;
+        if (dv->walPending)
+        {
+            // earlier mutations of the batch are not in data.dv yet
+            len = (file_off)dv->walNoBlocks << 4;
+        }
+    }
+
+    // pages past the last addressable one are never read
+    s->filePages = (unsigned int)MIN(len / DV_PAGE_LEN, (file_off)DV_MAX_PAGE + 1);
+    s->noPages = MAX(s->filePages, 1);
+
+    return DV_SUCCESS;
+}
+
+/**
+ * encrypted page from the group of the open batch, else from the mapping,
+ * NULL if it is in neither
+ */
+unsigned char *dv_pageMapped(dv_pageSet *s, unsigned int page)
+{
+    unsigned char *enc = s->dv->walBatch ? dv_walPendingPage(s->dv, page) : NULL;
+
+    return enc ? enc : file_mapBlocks(&s->map, page, 1);
+}
+
+unsigned char *dv_pageLoaded(dv_pageSet *s, unsigned int page)
+{
+    for (int i = 0; i < s->n; i++)
+    {
+        if (s->pages[i] == page)
+        {
+            return s->dec[i];
+        }
+    }
+
+    return NULL;
+}
+
+unsigned char *dv_pageGet(dv_pageSet *s, unsigned int page)
+{
+    unsigned char *dec = dv_pageLoaded(s, page);
+    if (dec)
+    {
+        return dec;
+    }
+
+    if (!page || page >= s->noPages)
+    {
+        // superblock or past the end
+        return NULL;
+    }
+
+    dec = malloc(DV_PAGE_LEN);
+    if (page >= s->filePages)
+    {
+        // added by this operation
+        dv_pageInit(dec);
+    }
+    else if (s->file)
+    {
+        unsigned char enc[DV_PAGE_LEN];
+        if (file_pread(s->file, (file_off)page * DV_PAGE_LEN, enc, DV_PAGE_LEN) != DV_PAGE_LEN)
+        {
+            free(dec);
+            return NULL;
+        }
+        dv_pageCrypt(s->dv, s->version, page, enc, DV_PAGE_LEN, dec);
+    }
+    else
+    {
+        // decrypt straight out of the mapping
+        unsigned char *enc = dv_pageMapped(s, page);
+        if (!enc)
+        {
+            free(dec);
+            return NULL;
+        }
+        dv_pageCrypt(s->dv, s->version, page, enc, DV_PAGE_LEN, dec);
+    }
+
+    if (s->n == s->cap)
+    {
+        s->cap = s->cap ? s->cap << 1 : 8;
+        s->pages = realloc(s->pages, s->cap * sizeof(unsigned int));
+        s->dec = realloc(s->dec, s->cap * sizeof(unsigned char *));
+        s->raw = realloc(s->raw, s->cap * sizeof(unsigned char *));
+        s->dirty = realloc(s->dirty, s->cap * sizeof(bool));
+    }
+    s->pages[s->n] = page;
+    s->dec[s->n] = dec;
+    s->raw[s->n] = NULL;
+    s->dirty[s->n] = false;
+    s->n++;
+
+    return dec;
+}
+
+void dv_pageTouch(dv_pageSet *s, unsigned int page)
+{
+    for (int i = 0; i < s->n; i++)
+    {
+        if (s->pages[i] == page)
+        {
+            // changed, so encrypted again
+            s->dirty[i] = true;
+            conditionalFree(s->raw[i], free);
+            s->raw[i] = NULL;
+        }
+    }
+}
+
+void dv_pageTrackFreeSpace(dv_pageSet *s)
+{
+    dv_app *dv = s->dv;
+    if (!dv->freeSpace)
+    {
+        // built from the file on first use
+        return;
+    }
+
+    if (dv->freeSpaceLen < s->noPages)
+    {
+        // pages added by this operation are among the dirty ones
+        dv->freeSpace = realloc(dv->freeSpace, s->noPages * sizeof(unsigned short));
+        memset(dv->freeSpace + dv->freeSpaceLen, 0, (s->noPages - dv->freeSpaceLen) * sizeof(unsigned short));
+    }
+    dv->freeSpaceLen = s->noPages;
+
+    for (int i = 0; i < s->n; i++)
+    {
+        if (s->dirty[i] && s->pages[i] < s->noPages)
+        {
+            dv->freeSpace[s->pages[i]] = MAX(dv_pageFree(s->dec[i]), 0);
+        }
+    }
+}
+
+/**
+ * encrypt the changed pages and write them as one log group,
+ * or straight into the file while migrating
+ */
+int dv_pageCommit(dv_pageSet *s)
+{
+    dv_app *dv = s->dv;
+    unsigned char enc[DV_PAGE_LEN];
+
+    if (dv->freeSpaceSaved)
+    {
+        // no longer describes data.dv once this is committed, saved again at logout
+        file_remove(freeSpace_fp);
+        dv->freeSpaceSaved = false;
+    }
+
+    bool logged = false;
+    for (int i = 0; !s->file && i < s->n; i++)
+    {
+        logged |= s->dirty[i] && s->pages[i] < s->noPages;
+    }
+    logged |= !s->file && s->noPages < s->filePages;
+    if (logged)
+    {
+        // pages cut from the end are dropped when the group is applied
+        dv_walBegin(dv, s->noPages * DV_PAGE_BLOCKS);
+    }
+
+    for (int i = 0; i < s->n; i++)
+    {
+        if (!s->dirty[i] || s->pages[i] >= s->noPages)
+        {
+            continue;
+        }
+
+        if (s->raw[i])
+        {
+            memcpy(enc, s->raw[i], DV_PAGE_LEN);
+        }
+        else
+        {
+            if (s->version >= DV_FORMAT_V4)
+            {
+                // fresh nonce every write, so no keystream is reused
+                randomBytes((char *)s->dec[i] + DV_PAGE_LEN - DV_PAGE_NONCE_LEN, DV_PAGE_NONCE_LEN);
+            }
+            dv_pageCrypt(dv, s->version, s->pages[i], s->dec[i], DV_PAGE_LEN, enc);
+        }
+        if (s->file)
+        {
+            file_pwrite(s->file, (file_off)s->pages[i] * DV_PAGE_LEN, enc, DV_PAGE_LEN);
+        }
+        else
+        {
+            dv_walWritePage(dv, s->pages[i], enc);
+        }
+
+        if (DV_DEBUG)
+        {
+            printf("[page] write page %d, %d slots, %d bytes free\n",
+                   s->pages[i], dv_pageNoSlots(s->dec[i]), dv_pageFree(s->dec[i]));
+        }
+    }
+
+    int retCode = DV_SUCCESS;
+    if (logged)
+    {
+        retCode = dv_walCommit(dv);
+    }
+
+    if (!retCode)
+    {
+        dv_pageTrackFreeSpace(s);
+        for (int i = 0; i < s->n; i++)
+        {
+            s->dirty[i] = false;
+        }
+        s->filePages = s->noPages;
+    }
+
+    return retCode;
+}
+
+// drop the decrypted pages, changes not committed are lost
+void dv_pageForget(dv_pageSet *s)
+{
+    for (int i = 0; i < s->n; i++)
+    {
+        // plaintext does not outlive the operation
+        memset(s->dec[i], 0, DV_PAGE_LEN);
+        free(s->dec[i]);
+        conditionalFree(s->raw[i], free);
+    }
+    conditionalFree(s->pages, free);
+    conditionalFree(s->dec, free);
+    conditionalFree(s->raw, free);
+    conditionalFree(s->dirty, free);
+    s->pages = NULL;
+    s->dec = NULL;
+    s->raw = NULL;
+    s->dirty = NULL;
+    s->n = 0;
+    s->cap = 0;
+}
+
+void dv_pageClose(dv_pageSet *s)
+{
+    dv_pageForget(s);
+
+    if (!s->file)
+    {
+        file_unmap(&s->map);
+    }
+}
+
+int dv_pageNoSlots(unsigned char *dec)
+{
+    return smallEndianValue(dec, 2);
+}
+
+/**
+ * bytes between the slot directory and the records,
+ * -1 if the header is damaged
+ */
+int dv_pageFree(unsigned char *dec)
+{
+    int dirEnd = DV_PAGE_HEADER_LEN + dv_pageNoSlots(dec) * DV_SLOT_LEN;
+    int dataStart = smallEndianValue(dec + 2, 2);
+
+    return dataStart > DV_PAGE_LEN || dirEnd > dataStart ? -1 : dataStart - dirEnd;
+}
+
+unsigned char *dv_pageRecord(unsigned char *dec, int slot)
+{
+    if (slot < 0 || slot >= dv_pageNoSlots(dec) || dv_pageFree(dec) < 0)
+    {
+        return NULL;
+    }
+
+    unsigned char *slotPtr = dec + DV_PAGE_HEADER_LEN + slot * DV_SLOT_LEN;
+    int offset = smallEndianValue(slotPtr, 2);
+    int len = smallEndianValue(slotPtr + 2, 2);
+    if (offset < smallEndianValue(dec + 2, 2) || len < DV_RECORD_HEADER_LEN || offset + len > DV_PAGE_LEN)
+    {
+        // does not decrypt to a record
+        return NULL;
+    }
+
+    unsigned char *rec = dec + offset;
+    unsigned int catId = 0;
+    int header = DV_RECORD_HEADER_LEN;
+    if (rec[5] & DV_RECORD_WIDE)
+    {
+        int idLen = varintValue(rec + header, len - header, &catId);
+        header = idLen ? header + idLen : len + 1;
+    }
+    if (header + smallEndianValue(rec + 6, 2) != len)
+    {
+        return NULL;
+    }
+
+    return rec;
+}
+
+// category of a record, ids past 255 follow the header
+unsigned int dv_recordCategory(unsigned char *rec)
+{
+    unsigned int ret = rec[4];
+    if (rec[5] & DV_RECORD_WIDE)
+    {
+        varintValue(rec + DV_RECORD_HEADER_LEN, VARINT_MAX_LEN, &ret);
+    }
+
+    return ret;
+}
+
+// bytes of a record for the category before its value
+int dv_recordHeaderLen(unsigned int catId)
+{
+    return catId > 0xff ? DV_RECORD_HEADER_LEN + varintLen(catId) : DV_RECORD_HEADER_LEN;
+}
+
+unsigned char *dv_recordValue(unsigned char *rec)
+{
+    return rec + dv_recordHeaderLen(dv_recordCategory(rec));
+}
+
+bool dv_pageInsert(dv_pageSet *s, unsigned int page, unsigned int entryId, unsigned int catId,
+                   unsigned char flags, const void *value, int n)
+{
+    unsigned char *dec = dv_pageGet(s, page);
+    int header = dv_recordHeaderLen(catId);
+    int len = header + n;
+    if (!dec || dv_pageFree(dec) < DV_SLOT_LEN + len)
+    {
+        return false;
+    }
+
+    int noSlots = dv_pageNoSlots(dec);
+    int dataStart = smallEndianValue(dec + 2, 2) - len;
+
+    // record below the others
+    unsigned char *rec = dec + dataStart;
+    smallEndianStr(entryId, rec, 4);
+    rec[4] = catId > 0xff ? DV_WIDE_CATEGORY : catId;
+    rec[5] = catId > 0xff ? flags | DV_RECORD_WIDE : flags & ~DV_RECORD_WIDE;
+    smallEndianStr(n, rec + 6, 2);
+    if (catId > 0xff)
+    {
+        varintStr(catId, rec + DV_RECORD_HEADER_LEN);
+    }
+    if (n)
+    {
+        memcpy(rec + header, value, n);
+    }
+
+    // slot after the others, records keep the order they were written in
+    unsigned char *slotPtr = dec + DV_PAGE_HEADER_LEN + noSlots * DV_SLOT_LEN;
+    smallEndianStr(dataStart, slotPtr, 2);
+    smallEndianStr(len, slotPtr + 2, 2);
+
+    smallEndianStr(noSlots + 1, dec, 2);
+    smallEndianStr(dataStart, dec + 2, 2);
+
+    dv_pageTouch(s, page);
+    return true;
+}
+
+void dv_pageRemove(dv_pageSet *s, unsigned int page, int slot)
+{
+    unsigned char *dec = dv_pageGet(s, page);
+    unsigned char *rec = dec ? dv_pageRecord(dec, slot) : NULL;
+    if (!rec)
+    {
+        return;
+    }
+
+    int noSlots = dv_pageNoSlots(dec);
+    int dataStart = smallEndianValue(dec + 2, 2);
+    int offset = rec - dec;
+    int len = smallEndianValue(dec + DV_PAGE_HEADER_LEN + slot * DV_SLOT_LEN + 2, 2);
+
+    // records below it move up to close the gap, pages stay compact
+    memmove(dec + dataStart + len, dec + dataStart, offset - dataStart);
+    memset(dec + dataStart, 0, len);
+    for (int i = 0; i < noSlots; i++)
+    {
+        unsigned char *other = dec + DV_PAGE_HEADER_LEN + i * DV_SLOT_LEN;
+        int otherOffset = smallEndianValue(other, 2);
+        if (otherOffset < offset)
+        {
+            smallEndianStr(otherOffset + len, other, 2);
+        }
+    }
+
+    // and the slots after it move down
+    unsigned char *slotPtr = dec + DV_PAGE_HEADER_LEN + slot * DV_SLOT_LEN;
+    memmove(slotPtr, slotPtr + DV_SLOT_LEN, (noSlots - slot - 1) * DV_SLOT_LEN);
+    memset(dec + DV_PAGE_HEADER_LEN + (noSlots - 1) * DV_SLOT_LEN, 0, DV_SLOT_LEN);
+
+    smallEndianStr(noSlots - 1, dec, 2);
+    smallEndianStr(dataStart + len, dec + 2, 2);
+
+    dv_pageTouch(s, page);
+}
+
+void dv_pageFreeSpaceKey(dv_app *dv, unsigned char schedule[AES_256_NR + 1][AES_BLOCK_SIDE][AES_BLOCK_SIDE])
+{
+    unsigned char *subkey = NULL;
+
+    // subkey = HKDF(k = dataKey, info = file name)
+    hkdf_hmac_sha(dv->dataKey, DV_KEYLEN,
+                  NULL, 0,
+                  (unsigned char *)freeSpace_fp, strlen(freeSpace_fp),
+                  SHA512_STR, DV_KEYLEN, &subkey);
+
+    aes_generateKeySchedule(subkey, AES_256, schedule);
+
+    memset(subkey, 0, DV_KEYLEN);
+    free(subkey);
+}
+
+/**
+ * free space saved at the last logout, if data.dv has not changed since;
+ * a damaged value only costs a page read when the allocator checks it
+ */
+bool dv_pageReadFreeSpace(dv_app *dv, unsigned int noPages)
+{
+    if (!dv->freeSpaceSaved)
+    {
+        return false;
+    }
+
+    file_struct file;
+    if (!file_open(&file, freeSpace_fp, "rb"))
+    {
+        return false;
+    }
+
+    int len = (int)file.len;
+    unsigned char *contents = (unsigned char *)file_read(&file, len);
+    file_close(&file);
+
+    bool ret = contents && len >= DV_FREESPACE_HEADER_LEN &&
+               smallEndianValue(contents + 16, 4) == noPages &&
+               len == DV_FREESPACE_HEADER_LEN + (int)noPages * 2;
+    if (ret)
+    {
+        unsigned char schedule[AES_256_NR + 1][AES_BLOCK_SIDE][AES_BLOCK_SIDE];
+        dv_pageFreeSpaceKey(dv, schedule);
+        unsigned char *dec = NULL;
+        aes_decrypt_withSchedule(contents + DV_FREESPACE_HEADER_LEN, noPages * 2,
+                                 schedule, AES_256_NR, AES_CTR,
+                                 contents, &dec);
+        memset(schedule, 0, sizeof(schedule));
+
+        dv->freeSpaceLen = noPages;
+        dv->freeSpace = malloc(MAX(noPages, 1) * sizeof(unsigned short));
+        for (unsigned int page = 0; page < noPages; page++)
+        {
+            dv->freeSpace[page] = (unsigned short)MIN(smallEndianValue(dec + page * 2, 2),
+                                                      DV_PAGE_LEN - DV_PAGE_HEADER_LEN);
+        }
+        free(dec);
+    }
+    conditionalFree(contents, free);
+
+    if (DV_DEBUG)
+    {
+        printf("[page] %s free space of %d pages\n", ret ? "read" : "could not read", noPages);
+    }
+
+    return ret;
+}
+
+/**
+ * write the free space of every page for the next session,
+ * which would otherwise read every page header on its first allocation
+ */
+int dv_pageSaveFreeSpace(dv_app *dv)
+{
+    if (!dv->freeSpace || dv->freeSpaceSaved)
+    {
+        return DV_SUCCESS;
+    }
+
+    int n = dv->freeSpaceLen * 2;
+    unsigned char *plain = malloc(MAX(n, 1));
+    for (unsigned int page = 0; page < dv->freeSpaceLen; page++)
+    {
+        smallEndianStr(dv->freeSpace[page], plain + page * 2, 2);
+    }
+
+    // fresh nonce every time, so no keystream is reused
+    unsigned char *contents = malloc(DV_FREESPACE_HEADER_LEN + n);
+    randomBytes((char *)contents, 16);
+    smallEndianStr(dv->freeSpaceLen, contents + 16, 4);
+
+    unsigned char schedule[AES_256_NR + 1][AES_BLOCK_SIDE][AES_BLOCK_SIDE];
+    dv_pageFreeSpaceKey(dv, schedule);
+    unsigned char *enc = NULL;
+    aes_encrypt_withSchedule(plain, n, schedule, AES_256_NR, AES_CTR, contents, &enc);
+    memset(schedule, 0, sizeof(schedule));
+    if (n)
+    {
+        memcpy(contents + DV_FREESPACE_HEADER_LEN, enc, n);
+    }
+
+    dv->freeSpaceSaved = file_writeContents(freeSpace_fp, contents, DV_FREESPACE_HEADER_LEN + n);
+
+    conditionalFree(enc, free);
+    free(contents);
+    free(plain);
+
+    return dv->freeSpaceSaved ? DV_SUCCESS : DV_FILE_DNE;
+}
+
+/**
+ * free bytes in every page of data.dv, from the file saved at the last logout
+ * or else from the page headers alone;
+ * kept for the session and updated as groups are committed
+ */
+void dv_pageLoadFreeSpace(dv_pageSet *s)
+{
+    dv_app *dv = s->dv;
+    if (dv->freeSpace)
+    {
+        // pages the file grew by since are left out until written
+        dv->freeSpaceLen = MIN(dv->freeSpaceLen, s->filePages);
+        return;
+    }
+
+    if (!s->file && dv_pageReadFreeSpace(dv, s->filePages))
+    {
+        return;
+    }
+
+    dv->freeSpaceLen = s->filePages;
+    dv->freeSpace = malloc(MAX(dv->freeSpaceLen, 1) * sizeof(unsigned short));
+    if (dv->freeSpaceLen)
+    {
+        // superblock
+        dv->freeSpace[0] = 0;
+    }
+
+    unsigned char buf[DV_PAGE_LEN];
+    unsigned char header[16];
+    for (unsigned int page = 1; page < dv->freeSpaceLen; page++)
+    {
+        unsigned char *enc = buf;
+        if (s->file)
+        {
+            if (file_pread(s->file, (file_off)page * DV_PAGE_LEN, buf, DV_PAGE_LEN) != DV_PAGE_LEN)
+            {
+                memset(buf, 0xff, DV_PAGE_LEN);
+            }
+        }
+        else if (!(enc = dv_pageMapped(s, page)))
+        {
+            memset(buf, 0xff, DV_PAGE_LEN);
+            enc = buf;
+        }
+
+        // only the block with the header is decrypted
+        dv_pageCrypt(dv, s->version, page, enc, 16, header);
+        dv->freeSpace[page] = MAX(dv_pageFree(header), 0);
+    }
+
+    if (DV_DEBUG)
+    {
+        printf("[page] free space of %d pages\n", dv->freeSpaceLen);
+    }
+}
+
+bool dv_pageFits(dv_pageSet *s, unsigned int page, int need, unsigned int *exclude, int noExclude)
+{
+    if (s->dv->freeSpace[page] < need)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < noExclude; i++)
+    {
+        if (exclude[i] == page)
+        {
+            return false;
+        }
+    }
+
+    // this operation may have filled it already, and the page itself is the authority
+    unsigned char *dec = dv_pageGet(s, page);
+    return dec && dv_pageFree(dec) >= need;
+}
+
+/**
+ * a page outside exclude with need bytes free, the ones from near first,
+ * then the first from the floor, otherwise a new page at the end;
+ * 0 once data.dv cannot grow
+ */
+unsigned int dv_pageAllocate(dv_pageSet *s, int need, unsigned int near, unsigned int *exclude, int noExclude)
+{
+    dv_pageLoadFreeSpace(s);
+    dv_app *dv = s->dv;
+    unsigned int floor = MAX(s->floor, 1);
+
+    if (near >= floor)
+    {
+        for (unsigned int page = near; page < MIN(near + DV_PAGE_NEAR, dv->freeSpaceLen); page++)
+        {
+            if (dv_pageFits(s, page, need, exclude, noExclude))
+            {
+                return page;
+            }
+        }
+    }
+
+    for (unsigned int page = floor; page < dv->freeSpaceLen; page++)
+    {
+        if (dv_pageFits(s, page, need, exclude, noExclude))
+        {
+            return page;
+        }
+    }
+
+    if (s->noPages > DV_MAX_PAGE)
+    {
+        // a page past this could not be addressed
+        return 0;
+    }
+
+    return s->noPages++;
+}
+
+void dv_pageClearFreeSpace(dv_app *dv)
+{
+    conditionalFree(dv->freeSpace, free);
+    dv->freeSpace = NULL;
+    dv->freeSpaceLen = 0;
+}
+
+// slot of the entry's link record in a page, -1 if it has none
+int dv_pageFindLink(unsigned char *dec, unsigned int entryId)
+{
+    for (int i = 0; i < dv_pageNoSlots(dec); i++)
+    {
+        unsigned char *rec = dv_pageRecord(dec, i);
+        if (rec && smallEndianValue(rec, 4) == entryId &&
+            rec[4] == DV_LINK_CATEGORY && smallEndianValue(rec + 6, 2) == 4)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// slot of the record listing the entry's chain in its home page, -1 if it has none
+int dv_pageFindChain(unsigned char *dec, unsigned int entryId)
+{
+    for (int i = 0; i < dv_pageNoSlots(dec); i++)
+    {
+        unsigned char *rec = dv_pageRecord(dec, i);
+        if (rec && smallEndianValue(rec, 4) == entryId &&
+            rec[4] == DV_LINK_CATEGORY && (rec[5] & DV_RECORD_CHAIN))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+unsigned int dv_pageNext(unsigned char *dec, int link)
+{
+    return smallEndianValue(dv_pageRecord(dec, link) + DV_RECORD_HEADER_LEN, 4);
+}
+
+void dv_pageSetNext(dv_pageSet *s, unsigned int page, unsigned int entryId, unsigned int next)
+{
+    unsigned char *dec = dv_pageGet(s, page);
+    int link = dv_pageFindLink(dec, entryId);
+    smallEndianStr(next, dv_pageRecord(dec, link) + DV_RECORD_HEADER_LEN, 4);
+    dv_pageTouch(s, page);
+}
+
+/**
+ * load the pages of an entry's chain in order,
+ * returns their number or -1 if the chain is damaged
+ */
+int dv_pageChain(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int **chain)
+{
+    *chain = NULL;
+    int n = 0;
+    int cap = 0;
+
+    unsigned int page = home;
+    while (page)
+    {
+        unsigned char *dec = dv_pageGet(s, page);
+        int link = dec ? dv_pageFindLink(dec, entryId) : -1;
+        if (link < 0 || n >= s->noPages)
+        {
+            // chain leaves the file or loops
+            conditionalFree(*chain, free);
+            *chain = NULL;
+            return -1;
+        }
+
+        if (n == cap)
+        {
+            cap = cap ? cap << 1 : 4;
+            *chain = realloc(*chain, cap * sizeof(unsigned int));
+        }
+        (*chain)[n++] = page;
+
+        page = dv_pageNext(dec, link);
+    }
+
+    return n;
+}
+
+/**
+ * the chain as the home page lists it, only the home page and the tail are read;
+ * -1 without a list or if the tail does not end the chain, the links decide then
+ */
+int dv_pageListedChain(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int **chain)
+{
+    *chain = NULL;
+    unsigned char *dec = dv_pageGet(s, home);
+    int slot = dec ? dv_pageFindChain(dec, entryId) : -1;
+    if (slot < 0)
+    {
+        return -1;
+    }
+
+    unsigned char *rec = dv_pageRecord(dec, slot);
+    int len = smallEndianValue(rec + 6, 2);
+    int n = 1;
+    for (int i = 0; i + DV_EXTENT_LEN <= len; i += DV_EXTENT_LEN)
+    {
+        n += smallEndianValue(rec + DV_RECORD_HEADER_LEN + i + 4, 2);
+    }
+    if (n > s->noPages)
+    {
+        return -1;
+    }
+
+    *chain = malloc(n * sizeof(unsigned int));
+    (*chain)[0] = home;
+    n = 1;
+    for (int i = 0; i + DV_EXTENT_LEN <= len; i += DV_EXTENT_LEN)
+    {
+        unsigned int first = smallEndianValue(rec + DV_RECORD_HEADER_LEN + i, 4);
+        unsigned int count = smallEndianValue(rec + DV_RECORD_HEADER_LEN + i + 4, 2);
+        for (unsigned int j = 0; j < count; j++)
+        {
+            (*chain)[n++] = first + j;
+        }
+    }
+
+    dec = dv_pageGet(s, (*chain)[n - 1]);
+    int link = dec ? dv_pageFindLink(dec, entryId) : -1;
+    if (link < 0 || dv_pageNext(dec, link))
+    {
+        free(*chain);
+        *chain = NULL;
+        return -1;
+    }
+
+    return n;
+}
+
+/**
+ * list the pages after the home page in it, so a read can ask for all of them at once;
+ * left out if the home page has no room, reads then only follow the links
+ */
+void dv_pageSaveChain(dv_pageSet *s, unsigned int entryId, unsigned int home)
+{
+    unsigned int *chain = NULL;
+    int noChain = dv_pageChain(s, entryId, home, &chain);
+    if (noChain > 0)
+    {
+        dv_pageListChain(s, entryId, chain, noChain);
+    }
+    conditionalFree(chain, free);
+}
+
+// write the list for a chain already known, starting at the home page
+void dv_pageListChain(dv_pageSet *s, unsigned int entryId, unsigned int *chain, int noChain)
+{
+    unsigned int home = chain[0];
+
+    // runs of consecutive pages are one extent
+    unsigned char *extents = malloc(noChain * DV_EXTENT_LEN);
+    int n = 0;
+    for (int i = 1; i < noChain; i++)
+    {
+        unsigned int count = n ? smallEndianValue(extents + n - 2, 2) : 0;
+        if (n && chain[i] == smallEndianValue(extents + n - DV_EXTENT_LEN, 4) + count && count < 0xffff)
+        {
+            smallEndianStr(count + 1, extents + n - 2, 2);
+        }
+        else
+        {
+            smallEndianStr(chain[i], extents + n, 4);
+            smallEndianStr(1, extents + n + 4, 2);
+            n += DV_EXTENT_LEN;
+        }
+    }
+
+    unsigned char *dec = dv_pageGet(s, home);
+    int slot = dv_pageFindChain(dec, entryId);
+    unsigned char *rec = slot >= 0 ? dv_pageRecord(dec, slot) : NULL;
+    if (rec ? smallEndianValue(rec + 6, 2) != n || memcmp(rec + DV_RECORD_HEADER_LEN, extents, n) : n)
+    {
+        if (rec)
+        {
+            dv_pageRemove(s, home, slot);
+        }
+        if (n)
+        {
+            dv_pageInsert(s, home, entryId, DV_LINK_CATEGORY, DV_RECORD_CHAIN, extents, n);
+        }
+    }
+    free(extents);
+}
+
+/**
+ * ask for every page the home page lists at once instead of one link at a time,
+ * the links are still followed and checked as the pages are read
+ */
+void dv_pagePrefetchChain(dv_pageSet *s, unsigned int entryId, unsigned char *home)
+{
+    int slot = dv_pageFindChain(home, entryId);
+    if (slot < 0 || s->file)
+    {
+        return;
+    }
+
+    unsigned char *rec = dv_pageRecord(home, slot);
+    int n = smallEndianValue(rec + 6, 2);
+    for (int i = 0; i + DV_EXTENT_LEN <= n; i += DV_EXTENT_LEN)
+    {
+        unsigned int first = smallEndianValue(rec + DV_RECORD_HEADER_LEN + i, 4);
+        unsigned int count = smallEndianValue(rec + DV_RECORD_HEADER_LEN + i + 4, 2);
+        if (first < s->filePages)
+        {
+            count = MIN(count, s->filePages - first);
+            file_mapWillNeed(&s->map, (file_off)first * DV_PAGE_LEN, (file_off)count * DV_PAGE_LEN);
+        }
+    }
+}
+
+// slot of the entry's directory in its home page, -1 if it has none
+int dv_pageFindDirectory(unsigned char *dec, unsigned int entryId)
+{
+    for (int i = 0; i < dv_pageNoSlots(dec); i++)
+    {
+        unsigned char *rec = dv_pageRecord(dec, i);
+        if (rec && smallEndianValue(rec, 4) == entryId &&
+            rec[4] == DV_LINK_CATEGORY && (rec[5] & DV_RECORD_DIRECTORY))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * next entry of a directory record's value from offset i, its length, 0 at the end;
+ * a damaged entry ends the directory
+ */
+int dv_pageDirectoryEntry(unsigned char *value, int n, int i, unsigned int *catId, unsigned int *page)
+{
+    int idLen = i < n ? varintValue(value + i, n - i, catId) : 0;
+    if (!idLen || i + idLen + 4 > n)
+    {
+        return 0;
+    }
+
+    *page = smallEndianValue(value + i + idLen, 4);
+    return idLen + 4;
+}
+
+// page the directory names for a category, 0 if the entry has no value for it
+unsigned int dv_pageDirectoryStart(unsigned char *dec, int slot, unsigned int catId)
+{
+    unsigned char *rec = dv_pageRecord(dec, slot);
+    int n = smallEndianValue(rec + 6, 2);
+    unsigned int id, page;
+    for (int i = 0, k; k = dv_pageDirectoryEntry(rec + DV_RECORD_HEADER_LEN, n, i, &id, &page); i += k)
+    {
+        if (id == catId)
+        {
+            return page;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * replace the directory with n bytes of entries;
+ * without room for them the entry goes without one, reads then walk the chain
+ */
+void dv_pageRewriteDirectory(dv_pageSet *s, unsigned int entryId, unsigned int home, int slot,
+                             unsigned char *value, int n)
+{
+    dv_pageRemove(s, home, slot);
+    if (!dv_pageInsert(s, home, entryId, DV_LINK_CATEGORY, DV_RECORD_DIRECTORY, value, n) && DV_DEBUG)
+    {
+        printf("[page] no room for the directory of entry %d\n", entryId);
+    }
+}
+
+/**
+ * record the page a value of the category starts in, page 0 once it is deleted;
+ * a second value of a category drops the directory, which one reads first is
+ * then decided by the chain
+ */
+void dv_pageSetDirectory(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int catId,
+                         unsigned int page)
+{
+    unsigned char *dec = dv_pageGet(s, home);
+    int slot = dec ? dv_pageFindDirectory(dec, entryId) : -1;
+    if (slot < 0)
+    {
+        return;
+    }
+
+    unsigned char *rec = dv_pageRecord(dec, slot);
+    int n = smallEndianValue(rec + 6, 2);
+    unsigned char *value = malloc(n + DV_DIRECTORY_MAX_LEN);
+    int len = 0;
+    bool found = false;
+    unsigned int id, start;
+    for (int i = 0, k; k = dv_pageDirectoryEntry(rec + DV_RECORD_HEADER_LEN, n, i, &id, &start); i += k)
+    {
+        if (id == catId)
+        {
+            found = true;
+        }
+        else
+        {
+            memcpy(value + len, rec + DV_RECORD_HEADER_LEN + i, k);
+            len += k;
+        }
+    }
+
+    if (page && found)
+    {
+        dv_pageRemove(s, home, slot);
+    }
+    else if (page || found)
+    {
+        if (page)
+        {
+            len += varintStr(catId, value + len);
+            smallEndianStr(page, value + len, 4);
+            len += 4;
+        }
+        dv_pageRewriteDirectory(s, entryId, home, slot, value, len);
+    }
+    free(value);
+}
+
+// values that started in one page start in another
+void dv_pageMoveDirectory(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int from,
+                          unsigned int to)
+{
+    unsigned char *dec = dv_pageGet(s, home);
+    int slot = dec ? dv_pageFindDirectory(dec, entryId) : -1;
+    if (slot < 0)
+    {
+        return;
+    }
+
+    unsigned char *rec = dv_pageRecord(dec, slot);
+    int n = smallEndianValue(rec + 6, 2);
+    unsigned char *value = malloc(MAX(n, 1));
+    memcpy(value, rec + DV_RECORD_HEADER_LEN, n);
+    bool changed = false;
+    unsigned int id, start;
+    for (int i = 0, k; k = dv_pageDirectoryEntry(value, n, i, &id, &start); i += k)
+    {
+        if (start == from)
+        {
+            smallEndianStr(to, value + i + k - 4, 4);
+            changed = true;
+        }
+    }
+
+    if (changed)
+    {
+        dv_pageRewriteDirectory(s, entryId, home, slot, value, n);
+    }
+    free(value);
+}
+
+int dv_pageCreateEntry(dv_pageSet *s, unsigned int entryId, unsigned int *home)
+{
+    // an entry starts as its link record and an empty directory, in any page with room
+    unsigned char next[4] = { 0 };
+    unsigned int page = dv_pageAllocate(s, DV_LINK_LEN + DV_SLOT_LEN + DV_RECORD_HEADER_LEN, 0, NULL, 0);
+    if (!page || !dv_pageInsert(s, page, entryId, DV_LINK_CATEGORY, 0, next, 4) ||
+        !dv_pageInsert(s, page, entryId, DV_LINK_CATEGORY, DV_RECORD_DIRECTORY, next, 0))
+    {
+        return DV_FILE_FULL;
+    }
+
+    *home = page;
+    return DV_SUCCESS;
+}
+
+int dv_pageWriteData(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int catId,
+                     const void *data, int n)
+{
+    // the list in the home page saves reading the whole chain to find its tail
+    unsigned int *chain = NULL;
+    bool listed = true;
+    int noChain = dv_pageListedChain(s, entryId, home, &chain);
+    if (noChain <= 0)
+    {
+        listed = false;
+        noChain = dv_pageChain(s, entryId, home, &chain);
+    }
+    if (noChain <= 0)
+    {
+        return DV_INVALID_INPUT;
+    }
+
+    // whole value in the first page of the chain with room, pages the free space map
+    // counts as full are not read
+    dv_pageLoadFreeSpace(s);
+    int header = dv_recordHeaderLen(catId);
+    int need = DV_SLOT_LEN + header + n;
+    for (int i = s->append ? noChain - 1 : 0; i < noChain; i++)
+    {
+        if (!dv_pageLoaded(s, chain[i]) && chain[i] < s->dv->freeSpaceLen && s->dv->freeSpace[chain[i]] < need)
+        {
+            continue;
+        }
+
+        unsigned char *dec = dv_pageGet(s, chain[i]);
+        if (listed && (!dec || dv_pageFindLink(dec, entryId) < 0))
+        {
+            // the list is out of date, the links decide
+            free(chain);
+            listed = false;
+            if ((noChain = dv_pageChain(s, entryId, home, &chain)) <= 0)
+            {
+                return DV_INVALID_INPUT;
+            }
+            i = (s->append ? noChain - 1 : 0) - 1;
+            continue;
+        }
+
+        if (dv_pageInsert(s, chain[i], entryId, catId, 0, data, n))
+        {
+            dv_pageSetDirectory(s, entryId, home, catId, chain[i]);
+            free(chain);
+            return DV_SUCCESS;
+        }
+    }
+
+    // otherwise in pages added to the end of the chain, one piece each
+    int retCode = DV_SUCCESS;
+    unsigned char next[4] = { 0 };
+    int cursor = 0;
+    unsigned int first = 0;
+    if (s->append)
+    {
+        // the first piece fills the rest of the last page, no piece there is continued yet,
+        // a home page keeps room to list the run of pages that follows
+        unsigned int last = chain[noChain - 1];
+        int k = dv_pageFree(dv_pageGet(s, last)) - DV_SLOT_LEN - header;
+        if (last == home)
+        {
+            k -= DV_SLOT_LEN + DV_RECORD_HEADER_LEN + DV_EXTENT_LEN;
+        }
+        if (k > 0 && dv_pageInsert(s, last, entryId, catId, DV_RECORD_MORE, data, k))
+        {
+            cursor = k;
+            first = last;
+        }
+    }
+    do
+    {
+        // wider category ids leave less of the page for the piece
+        int k = MIN(n - cursor, DV_MAX_FRAGMENT - (header - DV_RECORD_HEADER_LEN));
+        unsigned int page = dv_pageAllocate(s, DV_LINK_LEN + DV_SLOT_LEN + header + k,
+                                            chain[noChain - 1] + 1, chain, noChain);
+        if (!page)
+        {
+            retCode = DV_FILE_FULL;
+            break;
+        }
+
+        dv_pageInsert(s, page, entryId, DV_LINK_CATEGORY, 0, next, 4);
+        dv_pageSetNext(s, chain[noChain - 1], entryId, page);
+        chain = realloc(chain, (noChain + 1) * sizeof(unsigned int));
+        chain[noChain++] = page;
+
+        dv_pageInsert(s, page, entryId, catId, cursor + k < n ? DV_RECORD_MORE : 0,
+                      (const unsigned char *)data + cursor, k);
+        cursor += k;
+        first = first ? first : page;
+    } while (cursor < n);
+
+    dv_pageListChain(s, entryId, chain, noChain);
+    if (first)
+    {
+        dv_pageSetDirectory(s, entryId, home, catId, first);
+    }
+    free(chain);
+    return retCode;
+}
+
+// records of the entry in a page, its link included
+int dv_pageNoRecords(unsigned char *dec, unsigned int entryId)
+{
+    int ret = 0;
+    for (int i = 0; i < dv_pageNoSlots(dec); i++)
+    {
+        unsigned char *rec = dv_pageRecord(dec, i);
+        if (rec && smallEndianValue(rec, 4) == entryId)
+        {
+            ret++;
+        }
+    }
+
+    return ret;
+}
+
+int dv_pageDeleteData(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int catId)
+{
+    unsigned int *chain = NULL;
+    int noChain = dv_pageChain(s, entryId, home, &chain);
+    if (noChain <= 0)
+    {
+        return DV_INVALID_INPUT;
+    }
+
+    // remove the first value of the category, piece by piece
+    bool found = false;
+    bool complete = false;
+    for (int i = 0; i < noChain && !complete; i++)
+    {
+        unsigned char *dec = dv_pageGet(s, chain[i]);
+        int slot = 0;
+        while (slot < dv_pageNoSlots(dec) && !complete)
+        {
+            unsigned char *rec = dv_pageRecord(dec, slot);
+            if (rec && smallEndianValue(rec, 4) == entryId && dv_recordCategory(rec) == catId)
+            {
+                found = true;
+                complete = !(rec[5] & DV_RECORD_MORE);
+                dv_pageRemove(s, chain[i], slot);
+                if (!complete)
+                {
+                    // next piece is the first for the category in the next page
+                    break;
+                }
+            }
+            else
+            {
+                slot++;
+            }
+        }
+    }
+
+    if (!found)
+    {
+        free(chain);
+        return DV_INVALID_INPUT;
+    }
+    dv_pageSetDirectory(s, entryId, home, catId, 0);
+
+    // pages left with only the link leave the chain, the home page stays
+    unsigned int prev = chain[0];
+    bool shortened = false;
+    for (int i = 1; i < noChain; i++)
+    {
+        unsigned char *dec = dv_pageGet(s, chain[i]);
+        if (dv_pageNoRecords(dec, entryId) > 1)
+        {
+            prev = chain[i];
+            continue;
+        }
+
+        int link = dv_pageFindLink(dec, entryId);
+        dv_pageSetNext(s, prev, entryId, dv_pageNext(dec, link));
+        dv_pageRemove(s, chain[i], link);
+        shortened = true;
+    }
+    free(chain);
+
+    if (shortened)
+    {
+        dv_pageSaveChain(s, entryId, home);
+    }
+
+    dv_pageCutEmpty(s);
+
+    return DV_SUCCESS;
+}
+
+/**
+ * move the entry's records in a page into an earlier page outside its chain,
+ * the chain keeps its order and home changes if it was the page moved
+ */
+int dv_pageMoveRecords(dv_pageSet *s, unsigned int entryId, unsigned int *home, unsigned int from)
+{
+    unsigned int *chain = NULL;
+    int noChain = dv_pageChain(s, entryId, *home, &chain);
+    int pos = 0;
+    while (pos < noChain && chain[pos] != from)
+    {
+        pos++;
+    }
+    if (pos >= noChain)
+    {
+        // not part of the entry
+        conditionalFree(chain, free);
+        return DV_INVALID_INPUT;
+    }
+
+    unsigned char *dec = dv_pageGet(s, from);
+    int need = 0;
+    for (int i = 0; i < dv_pageNoSlots(dec); i++)
+    {
+        unsigned char *rec = dv_pageRecord(dec, i);
+        if (rec && smallEndianValue(rec, 4) == entryId)
+        {
+            need += DV_SLOT_LEN + dv_recordHeaderLen(dv_recordCategory(rec)) + smallEndianValue(rec + 6, 2);
+        }
+    }
+
+    unsigned int noPages = s->noPages;
+    unsigned int to = dv_pageAllocate(s, need, 0, chain, noChain);
+    if (!to || to >= from)
+    {
+        // no room before it, a page added at the end is not kept
+        s->noPages = noPages;
+        free(chain);
+        return DV_FILE_FULL;
+    }
+
+    // copied in slot order, so the link still comes first
+    for (int i = 0; i < dv_pageNoSlots(dec); i++)
+    {
+        unsigned char *rec = dv_pageRecord(dec, i);
+        if (rec && smallEndianValue(rec, 4) == entryId)
+        {
+            dv_pageInsert(s, to, entryId, dv_recordCategory(rec), rec[5], dv_recordValue(rec),
+                          smallEndianValue(rec + 6, 2));
+        }
+    }
+    for (int i = dv_pageNoSlots(dec) - 1; i >= 0; i--)
+    {
+        unsigned char *rec = dv_pageRecord(dec, i);
+        if (rec && smallEndianValue(rec, 4) == entryId)
+        {
+            dv_pageRemove(s, from, i);
+        }
+    }
+
+    if (pos)
+    {
+        dv_pageSetNext(s, chain[pos - 1], entryId, to);
+    }
+    else
+    {
+        *home = to;
+    }
+    free(chain);
+
+    dv_pageSaveChain(s, entryId, *home);
+    dv_pageMoveDirectory(s, entryId, *home, from, to);
+    return DV_SUCCESS;
+}
+
+/**
+ * move a whole page into an empty one before it by copying its ciphertext, pages that carry
+ * their nonce decrypt the same anywhere; the chains of the n entries in it are relinked,
+ * homes of those whose home page it was become to; from is left empty
+ */
+int dv_pageMovePage(dv_pageSet *s, unsigned int from, unsigned int to, unsigned int *entryIds,
+                    unsigned int *homes, int n)
+{
+    unsigned char *dec = dv_pageGet(s, from);
+    unsigned char *empty = dv_pageGet(s, to);
+    unsigned char *enc = s->file ? NULL : dv_pageMapped(s, from);
+    if (s->version < DV_FORMAT_V4 || !enc || !dec || !empty || dv_pageNoSlots(empty) || to >= from)
+    {
+        return DV_INVALID_INPUT;
+    }
+
+    // the page before it in every chain, found while the links still point at it
+    unsigned int *prev = malloc(MAX(n, 1) * sizeof(unsigned int));
+    int retCode = DV_SUCCESS;
+    for (int i = 0; i < n && !retCode; i++)
+    {
+        unsigned int *chain = NULL;
+        int noChain = dv_pageChain(s, entryIds[i], homes[i], &chain);
+        int pos = 0;
+        while (pos < noChain && chain[pos] != from)
+        {
+            pos++;
+        }
+        if (pos >= noChain)
+        {
+            retCode = DV_INVALID_INPUT;
+        }
+        else
+        {
+            prev[i] = pos ? chain[pos - 1] : 0;
+        }
+        conditionalFree(chain, free);
+    }
+
+    for (int i = 0; i < s->n && !retCode; i++)
+    {
+        if (s->pages[i] == from && s->dirty[i])
+        {
+            // its ciphertext is out of date
+            retCode = DV_INVALID_INPUT;
+        }
+    }
+    if (retCode)
+    {
+        free(prev);
+        return retCode;
+    }
+
+    for (int i = 0; i < s->n; i++)
+    {
+        if (s->pages[i] == to)
+        {
+            memcpy(s->dec[i], dec, DV_PAGE_LEN);
+            s->raw[i] = malloc(DV_PAGE_LEN);
+            memcpy(s->raw[i], enc, DV_PAGE_LEN);
+            s->dirty[i] = true;
+        }
+    }
+    dv_pageInit(dec);
+    dv_pageTouch(s, from);
+
+    for (int i = 0; i < n; i++)
+    {
+        if (prev[i])
+        {
+            dv_pageSetNext(s, prev[i], entryIds[i], to);
+        }
+        else
+        {
+            homes[i] = to;
+        }
+        dv_pageSaveChain(s, entryIds[i], homes[i]);
+        dv_pageMoveDirectory(s, entryIds[i], homes[i], from, to);
+    }
+    free(prev);
+
+    return DV_SUCCESS;
+}
+
+/**
+ * write an entry into another set value by value, in the order the values start in its chain,
+ * so the one read first for a category stays first
+ */
+int dv_pageCopyEntry(dv_pageSet *in, dv_pageSet *out, unsigned int entryId, unsigned int home,
+                     unsigned int *newHome)
+{
+    unsigned int *chain = NULL;
+    int noChain = dv_pageChain(in, entryId, home, &chain);
+    if (noChain <= 0)
+    {
+        return DV_INVALID_INPUT;
+    }
+
+    strstream *values = NULL;
+    unsigned int *catIds = NULL;
+    int *open = NULL; // page of the chain the value's last piece is in, -1 once it ends
+    int noValues = 0;
+
+    for (int i = 0; i < noChain; i++)
+    {
+        unsigned char *dec = dv_pageGet(in, chain[i]);
+        for (int slot = 0; slot < dv_pageNoSlots(dec); slot++)
+        {
+            unsigned char *rec = dv_pageRecord(dec, slot);
+            if (!rec || smallEndianValue(rec, 4) != entryId || rec[4] == DV_LINK_CATEGORY)
+            {
+                continue;
+            }
+
+            // the next piece is the first for the category in the next page
+            unsigned int catId = dv_recordCategory(rec);
+            int value = -1;
+            for (int v = 0; v < noValues && value < 0; v++)
+            {
+                if (catIds[v] == catId && open[v] == i - 1)
+                {
+                    value = v;
+                }
+            }
+            if (value < 0)
+            {
+                values = realloc(values, (noValues + 1) * sizeof(strstream));
+                catIds = realloc(catIds, (noValues + 1) * sizeof(unsigned int));
+                open = realloc(open, (noValues + 1) * sizeof(int));
+                values[noValues] = strstream_allocDefault();
+                catIds[noValues] = catId;
+                value = noValues++;
+            }
+            strstream_read(values + value, dv_recordValue(rec), smallEndianValue(rec + 6, 2));
+
+            open[value] = rec[5] & DV_RECORD_MORE ? i : -1;
+        }
+    }
+    free(chain);
+
+    int retCode = dv_pageCreateEntry(out, entryId, newHome);
+    if (out->append)
+    {
+        // pages before the home are left to the entries written earlier
+        out->floor = MAX(out->floor, *newHome);
+    }
+    for (int i = 0; i < noValues; i++)
+    {
+        if (!retCode)
+        {
+            retCode = dv_pageWriteData(out, entryId, *newHome, catIds[i], values[i].str, values[i].size);
+        }
+        memset(values[i].str, 0, values[i].size);
+        strstream_clear(values + i);
+    }
+    conditionalFree(values, free);
+    conditionalFree(catIds, free);
+    conditionalFree(open, free);
+
+    return retCode;
+}
+
+// empty pages at the end are cut from the file
+void dv_pageCutEmpty(dv_pageSet *s)
+{
+    dv_pageLoadFreeSpace(s);
+    while (s->noPages > 1)
+    {
+        // only pages the map calls empty are read to make sure
+        unsigned int last = s->noPages - 1;
+        unsigned char *dec = dv_pageLoaded(s, last);
+        if (!dec && last < s->dv->freeSpaceLen && s->dv->freeSpace[last] >= DV_PAGE_EMPTY)
+        {
+            dec = dv_pageGet(s, last);
+        }
+        if (!dec || dv_pageNoSlots(dec))
+        {
+            break;
+        }
+        s->noPages--;
+    }
+}
+
+int dv_pageReadData(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int catId,
+                    strstream *out)
+{
+    unsigned char *homeDec = dv_pageGet(s, home);
+    if (!homeDec)
+    {
+        return DV_INVALID_INPUT;
+    }
+
+    // the directory names the page the value starts in, the pages before it are not read
+    unsigned int page = home;
+    int directory = dv_pageFindDirectory(homeDec, entryId);
+    if (directory >= 0 && !(page = dv_pageDirectoryStart(homeDec, directory, catId)))
+    {
+        return DV_INVALID_INPUT;
+    }
+
+    // pages are read as the chain is followed
+    unsigned int noPages = 0;
+    bool started = false;
+    while (page && noPages++ < s->noPages)
+    {
+        unsigned char *dec = dv_pageGet(s, page);
+        if (!dec)
+        {
+            return DV_INVALID_INPUT;
+        }
+
+        unsigned int next = 0;
+        for (int i = 0; i < dv_pageNoSlots(dec); i++)
+        {
+            unsigned char *rec = dv_pageRecord(dec, i);
+            if (!rec || smallEndianValue(rec, 4) != entryId)
+            {
+                continue;
+            }
+
+            if (rec[4] == DV_LINK_CATEGORY)
+            {
+                if (!(rec[5] & (DV_RECORD_CHAIN | DV_RECORD_DIRECTORY)))
+                {
+                    next = smallEndianValue(rec + DV_RECORD_HEADER_LEN, 4);
+                }
+            }
+            else if (dv_recordCategory(rec) == catId)
+            {
+                started = true;
+                strstream_read(out, dv_recordValue(rec), smallEndianValue(rec + 6, 2));
+                if (!(rec[5] & DV_RECORD_MORE))
+                {
+                    return DV_SUCCESS;
+                }
+
+                // next piece is the first for the category in the next page,
+                // the link always comes before the entry's other records
+                break;
+            }
+        }
+
+        if (!started && directory >= 0)
+        {
+            // the directory is out of date, the chain decides
+            directory = -1;
+            page = home;
+            noPages = 0;
+            continue;
+        }
+        if (noPages == 1 && next)
+        {
+            // the value goes on past the first page, the rest can be asked for together
+            dv_pagePrefetchChain(s, entryId, homeDec);
+        }
+        page = next;
+    }
+
+    return DV_INVALID_INPUT;
+}
@@ -0,0 +1,130 @@
+#include "../datavault.h"
+#include "../lib/ds/strstream.h"
+#include "../lib/util/fileio.h"
+#include "../lib/cmathematics/util/numio.h"
+
+#ifndef DV_PAGE_H
+#define DV_PAGE_H
+
+extern const char *freeSpace_fp;
+
+// free space file: nonce(16), noPages(4), then the encrypted free bytes(2) of every page
+#define DV_FREESPACE_HEADER_LEN 20
+
+// data.dv is a list of pages, page 0 holds the superblock
+#define DV_PAGE_LEN 4096
+#define DV_PAGE_BLOCKS (DV_PAGE_LEN >> 4) // AES blocks, and so CTR counters, in a page
+
+// last page, the length of data.dv in blocks stays within 4 bytes
+#define DV_MAX_PAGE 0xfffffe
+
+// page: header, slot directory growing up, records packed down from the end
+#define DV_PAGE_HEADER_LEN 4 // noSlots(2), dataStart(2)
+#define DV_SLOT_LEN 4        // offset(2), len(2)
+
+// plaintext at the end of a page from version 4, the counter its CTR starts from
+#define DV_PAGE_NONCE_LEN 16
+
+// free bytes of an empty page, pages of version 3 may have the nonce's bytes too
+#define DV_PAGE_EMPTY (DV_PAGE_LEN - DV_PAGE_NONCE_LEN - DV_PAGE_HEADER_LEN)
+
+// record: entryId(4), catId(1), flags(1), len(2), value; a wide id goes between len and the value
+#define DV_RECORD_HEADER_LEN 8
+#define DV_RECORD_MORE 0x01 // value continues in the next record for the category
+#define DV_RECORD_CHAIN 0x02 // link category record in the home page listing the rest of the chain
+#define DV_RECORD_DIRECTORY 0x04 // link category record in the home page naming where each value starts
+#define DV_RECORD_WIDE 0x08 // category id past 255, a varint between the header and the value
+
+// category byte of a record with a wide id
+#define DV_WIDE_CATEGORY 0xff
+
+// every page of an entry's chain holds one link record for it, value: next page(4)
+#define DV_LINK_CATEGORY 0
+#define DV_LINK_LEN (DV_SLOT_LEN + DV_RECORD_HEADER_LEN + 4)
+
+// chain record value: extents of first page(4), noPages(2), in chain order
+#define DV_EXTENT_LEN 6
+
+// directory record value: varint(catId), page the value starts in(4), for every value of the entry
+#define DV_DIRECTORY_MAX_LEN (VARINT_MAX_LEN + 4)
+
+// longest piece of a value, a page added to a chain holds its link and one piece
+#define DV_MAX_FRAGMENT (DV_PAGE_EMPTY - DV_LINK_LEN - DV_SLOT_LEN - DV_RECORD_HEADER_LEN)
+
+// pages after the end of a chain tried first when it grows, so it stays in file order
+#define DV_PAGE_NEAR 8
+
+// pages read and changed by one operation, kept decrypted until committed
+typedef struct
+{
+    dv_app *dv;
+
+    file_mapping map;      // data.dv once the log is applied
+    file_struct *file;     // read and written directly instead, while migrating
+    unsigned char version; // format of the file, from version 4 pages carry their nonce
+    unsigned int filePages; // pages in the file
+    unsigned int noPages;   // pages once committed
+
+    unsigned int floor; // first page allocations may use
+    bool append;        // values only go into the last page of a chain, or pages added after it
+
+    unsigned int *pages;
+    unsigned char **dec;
+    unsigned char **raw; // ciphertext of a page moved unchanged, written as it is
+    bool *dirty;
+    int n;
+    int cap;
+} dv_pageSet;
+
+void dv_pageCrypt(dv_app *dv, unsigned char version, unsigned int page, unsigned char *in, int n,
+                  unsigned char *out);
+void dv_pageInit(unsigned char *dec);
+
+int dv_pageOpen(dv_pageSet *s, dv_app *dv, file_struct *file);
+unsigned char *dv_pageGet(dv_pageSet *s, unsigned int page);
+int dv_pageCommit(dv_pageSet *s);
+void dv_pageForget(dv_pageSet *s);
+void dv_pageClose(dv_pageSet *s);
+
+int dv_pageNoSlots(unsigned char *dec);
+int dv_pageFree(unsigned char *dec);
+unsigned char *dv_pageRecord(unsigned char *dec, int slot);
+unsigned int dv_recordCategory(unsigned char *rec);
+int dv_recordHeaderLen(unsigned int catId);
+unsigned char *dv_recordValue(unsigned char *rec);
+bool dv_pageInsert(dv_pageSet *s, unsigned int page, unsigned int entryId, unsigned int catId,
+                   unsigned char flags, const void *value, int n);
+void dv_pageRemove(dv_pageSet *s, unsigned int page, int slot);
+
+void dv_pageLoadFreeSpace(dv_pageSet *s);
+bool dv_pageReadFreeSpace(dv_app *dv, unsigned int noPages);
+int dv_pageSaveFreeSpace(dv_app *dv);
+unsigned int dv_pageAllocate(dv_pageSet *s, int need, unsigned int near, unsigned int *exclude, int noExclude);
+void dv_pageClearFreeSpace(dv_app *dv);
+
+int dv_pageChain(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int **chain);
+int dv_pageFindChain(unsigned char *dec, unsigned int entryId);
+int dv_pageListedChain(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int **chain);
+void dv_pageSaveChain(dv_pageSet *s, unsigned int entryId, unsigned int home);
+void dv_pageListChain(dv_pageSet *s, unsigned int entryId, unsigned int *chain, int noChain);
+void dv_pagePrefetchChain(dv_pageSet *s, unsigned int entryId, unsigned char *home);
+int dv_pageFindDirectory(unsigned char *dec, unsigned int entryId);
+unsigned int dv_pageDirectoryStart(unsigned char *dec, int slot, unsigned int catId);
+void dv_pageSetDirectory(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int catId,
+                         unsigned int page);
+void dv_pageMoveDirectory(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int from,
+                          unsigned int to);
+int dv_pageCreateEntry(dv_pageSet *s, unsigned int entryId, unsigned int *home);
+int dv_pageWriteData(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int catId,
+                     const void *data, int n);
+int dv_pageDeleteData(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int catId);
+int dv_pageReadData(dv_pageSet *s, unsigned int entryId, unsigned int home, unsigned int catId,
+                    strstream *out);
+int dv_pageMoveRecords(dv_pageSet *s, unsigned int entryId, unsigned int *home, unsigned int from);
+int dv_pageMovePage(dv_pageSet *s, unsigned int from, unsigned int to, unsigned int *entryIds,
+                    unsigned int *homes, int n);
+int dv_pageCopyEntry(dv_pageSet *in, dv_pageSet *out, unsigned int entryId, unsigned int home,
+                     unsigned int *newHome);
+void dv_pageCutEmpty(dv_pageSet *s);
+
+#endif // DV_PAGE_H
@@ -1,17 +1,25 @@
 #include "dv_persistence.h"
 #include "dv_controller.h"
+#include "dv_journal.h"
+#include "dv_format.h"
+#include "dv_page.h"
 
 #include "../lib/util/fileio.h"
 #include "../lib/util/mem.h"
+#include "../lib/util/thread.h"
+#include "../lib/util/timing.h"
 
 #include "../lib/cmathematics/util/numio.h"
+#include "../lib/cmathematics/data/hashing/hkdf.h"
+#include "../lib/cmathematics/data/hashing/sha.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
-#define NO_FILES 7
-#define EXTENDED_NO_FILES 8
+#define NO_FILES 10
+#define EXTENDED_NO_FILES 11
 
 #define IV_FP "iv.dv"
 #define DATA_FP "data.dv"
@@ -20,6 +28,9 @@
 #define CATEGORYIDMAP_FP "catIdMap.dv"
 #define PWD_FP "pwd.dv"
 #define DK_FP "dk.dv"
+#define JOURNAL_FP "journal.dv"
+#define WAL_FP "wal.dv"
+#define FREESPACE_FP "freeSpace.dv"
 #define DATA_TMP_FP "data_tmp.dv"
 
 const char *iv_fp = "iv.dv";
@@ -39,11 +50,22 @@ const char *filePaths[EXTENDED_NO_FILES] = {
     CATEGORYIDMAP_FP,
     PWD_FP,
     DK_FP,
+    JOURNAL_FP,
+    WAL_FP,
+    FREESPACE_FP,
     DATA_TMP_FP
 };
 
 void dv_initPersistence()
 {
+    // files stay on disk unless DV_VFS names another backend
+    const char *backend = getenv("DV_VFS");
+    if (backend && !vfs_find(backend))
+    {
+        printf("Unknown storage backend %s\n", backend);
+    }
+    vfs_use(vfs_find(backend));
+
     char *envPath = GET_HOME_DIR();
     file_setDefaultPath(envPath);
     FREE_HOME_DIR(envPath);
@@ -61,10 +83,7 @@ void dv_setUserDirectory(char *user)
     if (!directoryExists(path))
     {
         printf("Creating directory %s\n", path);
-        strstream dirCmd = strstream_fromStr("mkdir ");
-        strstream_concat(&dirCmd, path);
-        system(dirCmd.str);
-        strstream_clear(&dirCmd);
+        directoryCreate(path);
     }
 
     file_setDefaultPath(path);
@@ -84,8 +103,11 @@ int dv_initFiles(unsigned char *random)
     // write into iv file
     ret = file_writeContents(iv_fp, random, 0x70);
 
-    // write dataIV into data.dv
-    ret = file_writeContents(data_fp, random, 16);
+    // superblock into data.dv, page 0 is never part of an entry
+    unsigned char page[DV_PAGE_LEN];
+    memset(page, 0, DV_PAGE_LEN);
+    dv_writeSuperblock(page, DV_FORMAT, 0);
+    ret = file_writeContents(data_fp, page, DV_PAGE_LEN);
 
     return ret ? DV_SUCCESS : DV_FILE_DNE;
 }
@@ -119,67 +141,161 @@ void dv_copyFiles(char *dstDir, char *srcDir)
     }
 }
 
+void dv_removeTemp(const char *name, void *arg)
+{
+    // left behind by a rewrite or a migration that never committed
+    int len = strlen(name) - strlen(TEMP_SUFFIX);
+    int stagedLen = strlen(name) - strlen(DV_STAGED_SUFFIX);
+    if ((len > 0 && !strcmp(name + len, TEMP_SUFFIX)) ||
+        (stagedLen > 0 && !strcmp(name + stagedLen, DV_STAGED_SUFFIX)))
+    {
+        file_remove(name);
+    }
+}
+
 void dv_deleteFiles()
 {
     for (int i = 0; i < EXTENDED_NO_FILES; i++)
     {
-        strstream cmd = strstream_fromStr(
-        #ifdef DV_WINDOWS
-            "del -f "
-        #else
-            "rm"
-        #endif
-        );
-        strstream_concat(&cmd, "%s 2>nul", filePaths[i]);
-        system(cmd.str);
+        file_remove(filePaths[i]);
     }
+
+    file_list(dv_removeTemp, NULL);
 }
 
-void readNameIdMap(dv_app *dv, strstream stream)
+void initNameIdMap(dv_app *dv);
+void initIdIdxMap(dv_app *dv);
+void initCatIdMap(dv_app *dv);
+int readNameIdMap(dv_app *dv, strstream stream);
+int readIdIdxMap(dv_app *dv, strstream stream);
+int readCatIdMap(dv_app *dv, strstream stream);
+void writeNameIdMap(dv_app *dv, strstream *stream);
+void writeIdIdxMap(dv_app *dv, strstream *stream);
+void writeCatIdMap(dv_app *dv, strstream *stream);
+
+// file, IV and (de)serializers for each index map, ordered by map id
+const dv_mapFile dv_maps[DV_NO_MAPS] = {
+    { NAMEIDMAP_FP, &nameIdIV_offset, initNameIdMap, readNameIdMap, writeNameIdMap },
+    { IDIDXMAP_FP, &idIdxIV_offset, initIdIdxMap, readIdIdxMap, writeIdIdxMap },
+    { CATEGORYIDMAP_FP, &catIdIV_offset, initCatIdMap, readCatIdMap, writeCatIdMap }
+};
+
+void dv_deriveMapKeys(dv_app *dv)
+{
+    unsigned char *subkey = NULL;
+
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        // subkey = HKDF(k = dataKey, salt = map IV, info = file name)
+        hkdf_hmac_sha(dv->dataKey, DV_KEYLEN,
+                      dv->random + *dv_maps[i].ivOffset, 16,
+                      (unsigned char *)dv_maps[i].path, strlen(dv_maps[i].path),
+                      SHA512_STR, DV_KEYLEN, &subkey);
+
+        aes_generateKeySchedule(subkey, AES_256, dv->map_key_schedules[i]);
+
+        memset(subkey, 0, DV_KEYLEN);
+        free(subkey);
+    }
+
+    dv_deriveJournalKey(dv);
+}
+
+void dv_mapIV(dv_app *dv, int map, unsigned int generation, unsigned char iv[16])
+{
+    // distinct keystream for every checkpoint of the same map
+    memcpy(iv, dv->random + *dv_maps[map].ivOffset, 16);
+    for (int i = 0; i < 4; i++)
+    {
+        iv[i] ^= (unsigned char)(generation >> (i << 3));
+    }
+}
+
+void initNameIdMap(dv_app *dv)
+{
+    // drop what a failed parse left behind
+    avl_freeKey(dv->nameIdMap);
+    dv->nameIdMap = avl_createEmptyRoot(strkeycmp);
+}
+
+void initIdIdxMap(dv_app *dv)
+{
+    btree_free(&dv->idIdxMap);
+    dv->idIdxMap = btree_new(5);
+}
+
+void initCatIdMap(dv_app *dv)
+{
+    avl_freeKey(dv->catIdMap);
+    dv->catIdMap = avl_createEmptyRoot(strkeycmp);
+    if (dv->catNames)
+    {
+        memset(dv->catNames, 0, dv->catNamesLen * sizeof(char *));
+    }
+}
+
+int readNameIdMap(dv_app *dv, strstream stream)
 {
     int startOfEntryIdx = 0;
     char *name = NULL;
-    char *idStr = NULL;
 
     for (int i = 0; i < stream.size; i++)
     {
         if (!stream.str[i])
         {
-            // encountered end of string
-            name = strstream_substrRange(&stream, startOfEntryIdx, i);
-            idStr = strstream_substrLength(&stream, i + 1, 4);
+            // encountered end of string, the id follows
+            if (i == startOfEntryIdx || i + 4 >= stream.size)
+            {
+                return DV_INVALID_INPUT;
+            }
+
+            unsigned int id = smallEndianValue((unsigned char *)stream.str + i + 1, 4);
+            if (!id)
+            {
+                return DV_INVALID_INPUT;
+            }
 
             // insert into map
+            name = strstream_substrRange(&stream, startOfEntryIdx, i);
             dv->nameIdMap = avl_insert(
                 dv->nameIdMap,
-                name, (void *)smallEndianValue(idStr, 4));
+                name, (void *)id);
 
             // update cursors
             startOfEntryIdx = i + 5;
             i += 4;
-
-            free(idStr);
         }
     }
+
+    // name without its id
+    return startOfEntryIdx == stream.size ? DV_SUCCESS : DV_INVALID_INPUT;
 }
 
-void readIdIdxMap(dv_app *dv, strstream stream)
+int readIdIdxMap(dv_app *dv, strstream stream)
 {
-    char *numStr = NULL;
-    int id;
-    int idx;
+    unsigned int id;
+    unsigned int idx;
+    int idxLen = dv_idxLen(dv);
+    if (!idxLen)
+    {
+        // rebuilt from data.dv once the journal is read
+        return DV_SUCCESS;
+    }
 
-    for (int i = 0; i < stream.size; i += 6)
+    if (stream.size % (4 + idxLen))
     {
-        // read and parse id
-        numStr = strstream_substrLength(&stream, i, 4);
-        id = smallEndianValue(numStr, 4);
-        free(numStr);
+        return DV_INVALID_INPUT;
+    }
 
-        // read and parse idx
-        numStr = strstream_substrLength(&stream, i + 4, 2);
-        idx = smallEndianValue(numStr, 2);
-        free(numStr);
+    for (int i = 0; i < stream.size; i += 4 + idxLen)
+    {
+        // read and parse id, then idx
+        id = smallEndianValue((unsigned char *)stream.str + i, 4);
+        idx = smallEndianValue((unsigned char *)stream.str + i + 4, idxLen);
+        if (!id || !idx)
+        {
+            return DV_INVALID_INPUT;
+        }
 
         // insert into btree
         btree_insert(&dv->idIdxMap, id, (void *)idx);
@@ -187,130 +303,303 @@ void readIdIdxMap(dv_app *dv, strstream stream)
         // update counter
         dv->maxEntryId = MAX(dv->maxEntryId, id);
     }
+
+    return DV_SUCCESS;
 }
 
-void readCatIdMap(dv_app *dv, strstream stream)
+int readCatIdMap(dv_app *dv, strstream stream)
 {
     int startOfEntryIdx = 0;
     char *name = NULL;
-    char *idStr = NULL;
+    bool varint = dv_catIdVarint(dv);
 
     for (int i = 0; i < stream.size; i++)
     {
         if (!stream.str[i])
         {
-            // encountered end of string
-            name = strstream_substrRange(&stream, startOfEntryIdx, i);
-            idStr = strstream_substrLength(&stream, i + 1, 1);
+            // encountered end of string, the id follows
+            if (i == startOfEntryIdx || i + 1 >= stream.size)
+            {
+                return DV_INVALID_INPUT;
+            }
 
-            unsigned int catId = smallEndianValue(idStr, 1);
+            unsigned int catId = (unsigned char)stream.str[i + 1];
+            int idLen = 1;
+            if (varint && !(idLen = varintValue((unsigned char *)stream.str + i + 1, stream.size - i - 1, &catId)))
+            {
+                return DV_INVALID_INPUT;
+            }
+            if (!catId)
+            {
+                return DV_INVALID_INPUT;
+            }
 
             // insert into map
-            dv->catIdMap = avl_insert(
-                dv->catIdMap,
-                name,
-                (void *)catId);
+            name = strstream_substrRange(&stream, startOfEntryIdx, i);
+            dv_insertCategory(dv, name, catId);
 
             // update cursors
-            startOfEntryIdx = i + 2;
-            i += 1;
+            startOfEntryIdx = i + 1 + idLen;
+            i += idLen;
+        }
+    }
 
-            free(idStr);
+    // name without its id
+    return startOfEntryIdx == stream.size ? DV_SUCCESS : DV_INVALID_INPUT;
+}
 
-            // update counter
-            dv->maxCatId = MAX(dv->maxCatId, catId);
+void dv_readMapJob(void *arg)
+{
+    dv_mapBuffer *buffer = (dv_mapBuffer *)arg;
+
+    file_struct file;
+    if (file_open(&file, buffer->path, "rb"))
+    {
+        buffer->exists = true;
+        buffer->len = file.len;
+        buffer->contents = file_read(&file, file.len);
+        file_close(&file);
+    }
+}
+
+void dv_startPrefetch(dv_prefetch *prefetch, bool readMaps)
+{
+    // read each map file on its own thread
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        prefetch->maps[i].path = dv_maps[i].path;
+        prefetch->maps[i].exists = false;
+        prefetch->maps[i].contents = NULL;
+        prefetch->maps[i].len = 0;
+        prefetch->threads[i].running = false;
+        if (readMaps)
+        {
+            thread_start(prefetch->threads + i, dv_readMapJob, prefetch->maps + i);
         }
     }
+
+    // warm the start of the data file for the first command
+    file_prefetch(data_fp, DV_PREFETCH_DATA_LEN);
 }
 
-int dv_parse(dv_app *dv, const char *path, unsigned int offset,
-             void (*readFunc)(dv_app *dv, strstream stream))
+void dv_endPrefetch(dv_prefetch *prefetch)
 {
-    char *enc = NULL;
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        thread_join(prefetch->threads + i);
+        conditionalFree(prefetch->maps[i].contents, free);
+        prefetch->maps[i].contents = NULL;
+    }
+}
+
+int dv_parse(dv_app *dv, int map, char *enc, int len)
+{
+    int retCode = DV_SUCCESS;
     unsigned char *dec = NULL;
     strstream stream;
 
-    file_struct file;
-    if (file_open(&file, path, "rb"))
+    // format 1 maps were written under the data key, without a header
+    bool legacy = dv->formatVersion == DV_FORMAT_V1;
+
+    // format: generation, encrypted map
+    dv->mapGeneration[map] = 0;
+    if (!legacy && len)
     {
-        if (file.len)
+        if (len < DV_MAP_HEADER_LEN)
+        {
+            return DV_INVALID_INPUT;
+        }
+
+        dv->mapGeneration[map] = smallEndianValue(enc, DV_MAP_HEADER_LEN);
+        enc += DV_MAP_HEADER_LEN;
+        len -= DV_MAP_HEADER_LEN;
+    }
+
+    if (len > 0)
+    {
+        unsigned char iv[16];
+        if (legacy)
+        {
+            // data key, map IV and the counter from before the carry fix
+            memcpy(iv, dv->random + *dv_maps[map].ivOffset, 16);
+            aes_decrypt_withSchedule(
+                enc, len,
+                dv->aes_key_schedule, AES_256_NR, AES_CTR_WRAP,
+                iv,
+                &dec);
+        }
+        else
         {
-            // read
-            enc = file_read(&file, file.len);
-            // decrypt
+            // decrypt with the subkey for this file
+            dv_mapIV(dv, map, dv->mapGeneration[map], iv);
             aes_decrypt_withSchedule(
-                enc, file.len,
-                dv->aes_key_schedule, AES_256_NR, AES_CTR,
-                dv->random + offset,
+                enc, len,
+                dv->map_key_schedules[map], AES_256_NR, AES_CTR,
+                iv,
                 &dec);
+        }
 
-            // pass to string stream
-            stream = strstream_alloc(file.len);
-            strstream_read(&stream, dec, file.len);
+        // pass to string stream
+        stream = strstream_alloc(len);
+        strstream_read(&stream, dec, len);
 
-            if (DV_DEBUG)
-            {
-                printHexString(stream.str, stream.size, path);
-            }
+        if (DV_DEBUG)
+        {
+            printHexString(stream.str, stream.size, dv_maps[map].path);
+        }
 
-            // free variables
-            free(enc);
-            free(dec);
-            file_close(&file);
+        memset(dec, 0, len);
+        free(dec);
 
-            // TODO: parse
-            readFunc(dv, stream);
+        // parse
+        retCode = dv_maps[map].readFunc(dv, stream);
 
-            strstream_clear(&stream);
+        memset(stream.str, 0, stream.size);
+        strstream_clear(&stream);
+
+        if (retCode && DV_DEBUG)
+        {
+            // left unloaded, so it is never written back
+            printf("[load] could not parse %s\n", dv_maps[map].path);
         }
-        else
+        else if (!retCode && legacy)
         {
-            file_close(&file);
+            // rewritten under its subkey by the migration
+            dv->mapDirty[map] = true;
         }
     }
-    else
-    {
-        return DV_FILE_DNE;
-    }
 
-    return DV_SUCCESS;
+    return retCode;
 }
 
-int dv_load(dv_app *dv)
+typedef struct
+{
+    dv_app *dv;
+    dv_prefetch *prefetch;
+    int map;
+    int retCode;
+    double elapsed;
+} dv_mapJob;
+
+void dv_parseJob(void *arg)
+{
+    dv_mapJob *job = (dv_mapJob *)arg;
+    dv_mapBuffer *buffer = job->prefetch->maps + job->map;
+
+    // wait for the file contents
+    thread_join(job->prefetch->threads + job->map);
+
+    double start = timing_now();
+    job->retCode = buffer->exists
+        ? dv_parse(job->dv, job->map, buffer->contents, buffer->len)
+        : DV_FILE_DNE;
+    job->elapsed = timing_since(start);
+}
+
+int dv_loadPrefetched(dv_app *dv, dv_prefetch *prefetch)
 {
     int retCode = DV_SUCCESS;
 
-    // main body
-    do
+    // allocate structures
+    for (int i = 0; i < DV_NO_MAPS; i++)
     {
-        // decrypt and load nameIdMap
-        dv->nameIdMap = avl_createEmptyRoot(strkeycmp);
-        if (retCode = dv_parse(
-                dv, nameIdMap_fp, nameIdIV_offset, readNameIdMap))
+        dv_maps[i].initFunc(dv);
+    }
+
+    // each map writes to its own structure, so decrypt and parse them concurrently
+    dv_mapJob jobs[DV_NO_MAPS];
+    thread_struct threads[DV_NO_MAPS];
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        jobs[i].dv = dv;
+        jobs[i].prefetch = prefetch;
+        jobs[i].map = i;
+        jobs[i].retCode = DV_SUCCESS;
+        jobs[i].elapsed = 0.0;
+        thread_start(threads + i, dv_parseJob, jobs + i);
+    }
+
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        thread_join(threads + i);
+        if (!retCode)
         {
-            break;
+            retCode = jobs[i].retCode;
         }
+        dv->mapLoaded[i] = !jobs[i].retCode;
 
-        // decrypt and load idIdxMap
-        dv->idIdxMap = btree_new(5);
-        if (retCode = dv_parse(
-                dv, idIdxMap_fp, idIdxIV_offset, readIdIdxMap))
+        // apply changes made since the last checkpoint
+        if (dv->mapLoaded[i] && !retCode)
         {
-            break;
+            retCode = dv_journalReplay(dv, i);
         }
 
-        // decrypt and load catIdMap
-        dv->catIdMap = avl_createEmptyRoot(strkeycmp);
-        if (retCode = dv_parse(
-                dv, categoryIdMap_fp, catIdIV_offset, readCatIdMap))
+        if (DV_DEBUG)
         {
-            break;
+            printf("[load] %s: %d bytes, parsed in %.3f ms\n",
+                   dv_maps[i].path, prefetch->maps[i].len, jobs[i].elapsed);
         }
-    } while (false);
+    }
 
     return retCode;
 }
 
+void dv_insertCategory(dv_app *dv, char *name, unsigned int catId)
+{
+    dv->catIdMap = avl_insert(dv->catIdMap, name, (void *)(uintptr_t)catId);
+    dv->maxCatId = MAX(dv->maxCatId, catId);
+
+    if (catId >= dv->catNamesLen)
+    {
+        // ids are handed out in order, the array doubles as they grow
+        unsigned int len = MAX(catId + 1, dv->catNamesLen << 1);
+        dv->catNames = realloc(dv->catNames, len * sizeof(char *));
+        memset(dv->catNames + dv->catNamesLen, 0, (len - dv->catNamesLen) * sizeof(char *));
+        dv->catNamesLen = len;
+    }
+    dv->catNames[catId] = name;
+}
+
+const char *dv_categoryName(dv_app *dv, unsigned int catId)
+{
+    return catId < dv->catNamesLen ? dv->catNames[catId] : NULL;
+}
+
+int dv_requireMap(dv_app *dv, int map)
+{
+    if (dv->mapLoaded[map])
+    {
+        return DV_SUCCESS;
+    }
+
+    // read on the calling thread
+    dv_mapBuffer buffer = { dv_maps[map].path, false, NULL, 0 };
+    dv_readMapJob(&buffer);
+    if (!buffer.exists)
+    {
+        return DV_FILE_DNE;
+    }
+
+    // decrypt and index
+    dv_maps[map].initFunc(dv);
+    int retCode = dv_parse(dv, map, buffer.contents, buffer.len);
+    conditionalFree(buffer.contents, free);
+
+    // apply changes made since the last checkpoint
+    if (!retCode)
+    {
+        retCode = dv_journalReplay(dv, map);
+    }
+
+    if (DV_DEBUG)
+    {
+        printf("[lazy] loaded %s: %d bytes\n", dv_maps[map].path, buffer.len);
+    }
+
+    dv->mapLoaded[map] = !retCode;
+    return retCode;
+}
+
 void writeStrId(strstream *out, avl *root, int idSize)
 {
     // do a postorder traversal
@@ -359,8 +648,9 @@ void writeIdIdx(strstream *out, btree_node *root)
             unsigned char *numStr = NULL;
             numStr = newSmallEndianStr(root->keys[i]);
             strstream_read(out, numStr, 4);
-            numStr = newSmallEndianStr((unsigned short)(unsigned int)root->vals[i]);
-            strstream_read(out, numStr, 2);
+            free(numStr);
+            numStr = newSmallEndianStr((unsigned int)root->vals[i]);
+            strstream_read(out, numStr, 4);
 
             free(numStr);
         }
@@ -372,32 +662,54 @@ void writeIdIdx(strstream *out, btree_node *root)
     }
 }
 
-void writeNameIdMap(void *nameIdMap, strstream *stream)
+void writeNameIdMap(dv_app *dv, strstream *stream)
+{
+    writeStrId(stream, dv->nameIdMap, sizeof(int));
+}
+
+void writeIdIdxMap(dv_app *dv, strstream *stream)
 {
-    writeStrId(stream, (avl *)nameIdMap, sizeof(int));
+    writeIdIdx(stream, dv->idIdxMap.root);
 }
 
-void writeIdIdxMap(void *idIdxMap, strstream *stream)
+// format: category.name, \0, varint(category.id)
+void writeCatIds(strstream *out, avl *root)
 {
-    writeIdIdx(stream, ((btree *)idIdxMap)->root);
+    if (root && root->key)
+    {
+        unsigned char idStr[VARINT_MAX_LEN];
+        strstream_read(out, root->key, strlen(root->key) + 1);
+        strstream_read(out, idStr, varintStr((unsigned int)(uintptr_t)root->val, idStr));
+
+        writeCatIds(out, root->left);
+        writeCatIds(out, root->right);
+    }
 }
 
-void writeCatIdMap(void *catIdMap, strstream *stream)
+void writeCatIdMap(dv_app *dv, strstream *stream)
 {
-    writeStrId(stream, (avl *)catIdMap, sizeof(char));
+    if (dv->formatVersion >= DV_FORMAT_V5)
+    {
+        writeCatIds(stream, dv->catIdMap);
+    }
+    else
+    {
+        // version 4 and earlier hold 255 categories
+        writeStrId(stream, dv->catIdMap, sizeof(char));
+    }
 }
 
-int dv_stringify(dv_app *dv, const char *path, unsigned int offset,
-                 void *structure, void (*dumpFunc)(void *structure, strstream *stream))
+int dv_stringify(dv_app *dv, int map, unsigned int generation, const char *path)
 {
-    strstream stream;
     file_struct file;
+    bool committed = false;
 
-    if (file_open(&file, path, "wb"))
+    // write beside the map, then swap it in
+    if (file_openTemp(&file, path))
     {
         // stringify
         strstream out = strstream_allocDefault();
-        dumpFunc(structure, &out);
+        dv_maps[map].dumpFunc(dv, &out);
 
         if (DV_DEBUG)
         {
@@ -406,53 +718,125 @@ int dv_stringify(dv_app *dv, const char *path, unsigned int offset,
         }
 
         // encrypt
+        unsigned char iv[16];
+        dv_mapIV(dv, map, generation, iv);
         unsigned char *encOut = NULL;
         aes_encrypt_withSchedule(
             out.str, out.size,
-            dv->aes_key_schedule, AES_256_NR, AES_CTR,
-            dv->random + offset,
+            dv->map_key_schedules[map], AES_256_NR, AES_CTR,
+            iv,
             &encOut);
 
         // write to file
+        unsigned char header[DV_MAP_HEADER_LEN];
+        smallEndianStr(generation, header, DV_MAP_HEADER_LEN);
+        file_write(&file, header, DV_MAP_HEADER_LEN);
         file_write(&file, encOut, out.size);
-        file_close(&file);
+        committed = file_commit(&file, path);
 
         // free variables
         strstream_clear(&out);
-        free(encOut);
+        conditionalFree(encOut, free);
     }
-    else
+
+    return committed ? DV_SUCCESS : DV_FILE_DNE;
+}
+
+/**
+ * generation for the next checkpoint, past every map an interrupted checkpoint
+ * already wrote so no map keystream is used twice
+ */
+unsigned int dv_nextGeneration(dv_app *dv)
+{
+    unsigned int ret = dv->generation;
+    for (int i = 0; i < DV_NO_MAPS; i++)
     {
-        return DV_FILE_DNE;
+        ret = MAX(ret, dv->mapGeneration[i]);
     }
 
-    return DV_SUCCESS;
+    return ret + 1;
 }
 
-int dv_save(dv_app *dv)
+int dv_checkpoint(dv_app *dv)
 {
     int retCode = DV_SUCCESS;
 
-    do
+    // every map must be in memory with the journal applied
+    for (int i = 0; i < DV_NO_MAPS; i++)
     {
-        if (retCode = dv_stringify(dv, nameIdMap_fp, nameIdIV_offset,
-                                   dv->nameIdMap, writeNameIdMap))
+        if (retCode = dv_requireMap(dv, i))
         {
-            break;
+            return retCode;
         }
+    }
 
-        if (retCode = dv_stringify(dv, idIdxMap_fp, idIdxIV_offset,
-                                   &dv->idIdxMap, writeIdIdxMap))
+    // unchanged maps keep their older generation, replay still applies to them
+    unsigned int generation = dv_nextGeneration(dv);
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        if (!dv->mapDirty[i])
         {
-            break;
+            if (DV_DEBUG)
+            {
+                printf("[save] %s unchanged\n", dv_maps[i].path);
+            }
+            continue;
         }
 
-        if (retCode = dv_stringify(dv, categoryIdMap_fp, catIdIV_offset,
-                                   dv->catIdMap, writeCatIdMap))
+        if (retCode = dv_stringify(dv, i, generation, dv_maps[i].path))
         {
-            break;
+            return retCode;
         }
-    } while (false);
 
-    return retCode;
+        dv->mapGeneration[i] = generation;
+        dv->mapFileGeneration = MAX(dv->mapFileGeneration, generation);
+        dv->mapDirty[i] = false;
+    }
+
+    if (DV_DEBUG)
+    {
+        printf("[journal] checkpoint %d after %d bytes\n", generation, dv->journal.size);
+    }
+
+    // maps written, start a journal for the new generation
+    return dv_journalReset(dv, generation);
+}
+
+int dv_mapFileLength()
+{
+    int ret = 0;
+
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        file_struct file;
+        if (file_open(&file, dv_maps[i].path, "rb"))
+        {
+            ret += file.len;
+            file_close(&file);
+        }
+    }
+
+    return ret;
+}
+
+int dv_save(dv_app *dv)
+{
+    if (!dv->journalRead || !dv->journal.size)
+    {
+        // no index changes this session
+        return DV_SUCCESS;
+    }
+
+    // changes are already journaled, fold them into the maps once the journal is large
+    int threshold = MAX(DV_JOURNAL_MIN_LEN, dv_mapFileLength() * DV_JOURNAL_RATIO);
+    if (dv->journal.size < threshold)
+    {
+        if (DV_DEBUG)
+        {
+            printf("[save] journal %d of %d bytes, no checkpoint\n", dv->journal.size, threshold);
+        }
+        return DV_SUCCESS;
+    }
+
+    return dv_checkpoint(dv);
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "../datavault.h"
+#include "../lib/ds/strstream.h"
+#include "../lib/util/thread.h"
 
 #ifndef DV_PERSISTENCE_H
 #define DV_PERSISTENCE_H
@@ -20,6 +22,40 @@ extern const char *categoryIdMap_fp;
 extern const char *pwd_fp;
 extern const char *dk_fp;
 
+typedef struct
+{
+    const char *path;
+    const unsigned int *ivOffset;
+
+    void (*initFunc)(dv_app *dv);
+    int (*readFunc)(dv_app *dv, strstream stream); // DV_INVALID_INPUT if the contents are malformed
+    void (*dumpFunc)(dv_app *dv, strstream *stream);
+} dv_mapFile;
+
+extern const dv_mapFile dv_maps[DV_NO_MAPS];
+
+// map file header: small endian checkpoint generation
+#define DV_MAP_HEADER_LEN 4
+
+// number of bytes at the start of data.dv to read ahead during login
+#define DV_PREFETCH_DATA_LEN (64 << 10)
+
+typedef struct
+{
+    const char *path;
+    bool exists;
+
+    char *contents;
+    int len;
+} dv_mapBuffer;
+
+// map files read in the background while the keys are derived
+typedef struct
+{
+    dv_mapBuffer maps[DV_NO_MAPS];
+    thread_struct threads[DV_NO_MAPS];
+} dv_prefetch;
+
 void dv_initPersistence();
 void dv_setUserDirectory(char *user);
 
@@ -27,7 +63,19 @@ int dv_initFiles(unsigned char *random);
 void dv_copyFiles(char *dstDir, char *srcDir);
 void dv_deleteFiles();
 
-int dv_load(dv_app *dv);
+void dv_deriveMapKeys(dv_app *dv);
+void dv_mapIV(dv_app *dv, int map, unsigned int generation, unsigned char iv[16]);
+
+void dv_startPrefetch(dv_prefetch *prefetch, bool readMaps);
+void dv_endPrefetch(dv_prefetch *prefetch);
+
+int dv_loadPrefetched(dv_app *dv, dv_prefetch *prefetch);
+int dv_requireMap(dv_app *dv, int map);
+void dv_insertCategory(dv_app *dv, char *name, unsigned int catId);
+const char *dv_categoryName(dv_app *dv, unsigned int catId);
+int dv_stringify(dv_app *dv, int map, unsigned int generation, const char *path);
+unsigned int dv_nextGeneration(dv_app *dv);
+int dv_checkpoint(dv_app *dv);
 int dv_save(dv_app *dv);
 
 #endif // DV_PERSISTENCE_H
\ No newline at end of file
@@ -0,0 +1,420 @@
+#include "dv_vacuum.h"
+#include "dv_persistence.h"
+#include "dv_format.h"
+#include "dv_journal.h"
+#include "dv_page.h"
+#include "dv_wal.h"
+
+#include "../lib/util/fileio.h"
+#include "../lib/util/mem.h"
+
+#include "../lib/cmathematics/util/numio.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * whether enough of data.dv is free to compact it,
+ * only known once the session has allocated
+ */
+bool dv_vacuumDue(dv_app *dv)
+{
+    if (!dv->freeSpace || dv->freeSpaceLen < DV_VACUUM_MIN_PAGES)
+    {
+        return false;
+    }
+
+    double noFree = 0;
+    for (unsigned int page = 1; page < dv->freeSpaceLen; page++)
+    {
+        noFree += dv->freeSpace[page];
+    }
+
+    return noFree >= DV_VACUUM_RATIO * (dv->freeSpaceLen - 1) * DV_PAGE_EMPTY;
+}
+
+// first empty page before the last one, 0 if there is none
+unsigned int dv_vacuumEmptyPage(dv_pageSet *s, unsigned int last)
+{
+    dv_pageLoadFreeSpace(s);
+    for (unsigned int page = 1; page < MIN(last, s->dv->freeSpaceLen); page++)
+    {
+        unsigned char *dec = s->dv->freeSpace[page] >= DV_PAGE_EMPTY ? dv_pageGet(s, page) : NULL;
+        if (dec && !dv_pageNoSlots(dec))
+        {
+            return page;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * move the last page of data.dv into an empty page before it as it is, if the format
+ * allows and there is one, relinking the chains through it; the homes it moves are added
+ */
+int dv_vacuumMovePage(dv_app *dv, dv_pageSet *s, unsigned int last, unsigned int **moved, int *noMoved)
+{
+    unsigned int to = s->version >= DV_FORMAT_V4 ? dv_vacuumEmptyPage(s, last) : 0;
+    if (!to)
+    {
+        return DV_FILE_FULL;
+    }
+
+    // every entry with a record in the page, once
+    unsigned char *dec = dv_pageGet(s, last);
+    unsigned int *entryIds = malloc(MAX(dv_pageNoSlots(dec), 1) * sizeof(unsigned int));
+    unsigned int *homes = malloc(MAX(dv_pageNoSlots(dec), 1) * sizeof(unsigned int));
+    int n = 0;
+    for (int i = 0; i < dv_pageNoSlots(dec); i++)
+    {
+        unsigned char *rec = dv_pageRecord(dec, i);
+        unsigned int entryId = rec ? smallEndianValue(rec, 4) : 0;
+        int j = 0;
+        while (j < n && entryIds[j] != entryId)
+        {
+            j++;
+        }
+        if (rec && j == n)
+        {
+            entryIds[n] = entryId;
+            homes[n++] = (unsigned int)(uintptr_t)btree_search(dv->idIdxMap, entryId);
+        }
+    }
+
+    unsigned int *oldHomes = malloc(MAX(n, 1) * sizeof(unsigned int));
+    memcpy(oldHomes, homes, n * sizeof(unsigned int));
+    int retCode = dv_pageMovePage(s, last, to, entryIds, homes, n);
+    for (int i = 0; i < n && !retCode; i++)
+    {
+        if (homes[i] != oldHomes[i])
+        {
+            *moved = realloc(*moved, (*noMoved + 1) * 3 * sizeof(unsigned int));
+            (*moved)[*noMoved * 3] = entryIds[i];
+            (*moved)[*noMoved * 3 + 1] = oldHomes[i];
+            (*moved)[*noMoved * 3 + 2] = homes[i];
+            (*noMoved)++;
+        }
+    }
+    free(entryIds);
+    free(homes);
+    free(oldHomes);
+
+    if (DV_DEBUG && !retCode)
+    {
+        printf("[vacuum] moved page %d to page %d as it is\n", last, to);
+    }
+
+    return retCode;
+}
+
+/**
+ * move every record in the last page of data.dv into earlier pages and cut it,
+ * committed as one group with the homes it moves, or not at all
+ */
+int dv_vacuumPage(dv_app *dv, bool *cut)
+{
+    *cut = false;
+
+    int retCode = DV_SUCCESS;
+    if (retCode = dv_requireMap(dv, DV_IDIDXMAP))
+    {
+        return retCode;
+    }
+
+    dv_walBatchBegin(dv);
+
+    dv_pageSet pages;
+    unsigned int *moved = NULL; // entryId, old home, new home
+    int noMoved = 0;
+    do
+    {
+        if (retCode = dv_pageOpen(&pages, dv, NULL))
+        {
+            break;
+        }
+
+        unsigned int last = pages.noPages - 1;
+        unsigned char *dec = dv_pageGet(&pages, last);
+        if (!dec)
+        {
+            // only the superblock
+            break;
+        }
+
+        // whole into an empty page if there is one, otherwise every move empties the page of one entry
+        int noSlots = dv_vacuumMovePage(dv, &pages, last, &moved, &noMoved) ? dv_pageNoSlots(dec) : 0;
+        for (int i = 0; i < noSlots && dv_pageNoSlots(dec); i++)
+        {
+            unsigned char *rec = dv_pageRecord(dec, 0);
+            if (!rec)
+            {
+                retCode = DV_INVALID_INPUT;
+                break;
+            }
+
+            unsigned int entryId = smallEndianValue(rec, 4);
+            unsigned int home = (unsigned int)(uintptr_t)btree_search(dv->idIdxMap, entryId);
+            unsigned int newHome = home;
+            if (retCode = dv_pageMoveRecords(&pages, entryId, &newHome, last))
+            {
+                break;
+            }
+
+            if (newHome != home)
+            {
+                moved = realloc(moved, (noMoved + 1) * 3 * sizeof(unsigned int));
+                moved[noMoved * 3] = entryId;
+                moved[noMoved * 3 + 1] = home;
+                moved[noMoved * 3 + 2] = newHome;
+                noMoved++;
+            }
+        }
+        if (retCode || dv_pageNoSlots(dec))
+        {
+            // records it could not move, the page stays as it was
+            break;
+        }
+
+        pages.noPages--;
+        dv_pageCutEmpty(&pages);
+        if (retCode = dv_pageCommit(&pages))
+        {
+            break;
+        }
+
+        // the index follows the moved homes, in the group in case the journal is lost
+        for (int i = 0; i < noMoved && !retCode; i++)
+        {
+            btree_insert(&dv->idIdxMap, moved[i * 3], (void *)(uintptr_t)moved[i * 3 + 2]);
+            dv->mapDirty[DV_IDIDXMAP] = true;
+            dv_walHome(dv, moved[i * 3], moved[i * 3 + 2]);
+            retCode = dv_journalStart(dv, moved[i * 3], moved[i * 3 + 2]);
+        }
+        *cut = !retCode;
+    } while (false);
+    dv_pageClose(&pages);
+
+    if (retCode || !*cut)
+    {
+        // the group and its journal records go together or not at all
+        dv_walAbort(dv);
+        dv_journalDiscardPending(dv);
+        *cut = false;
+    }
+
+    int commitCode = dv_walBatchEnd(dv);
+    if (commitCode || retCode)
+    {
+        // data.dv still has the old homes
+        for (int i = 0; i < noMoved; i++)
+        {
+            btree_insert(&dv->idIdxMap, moved[i * 3], (void *)(uintptr_t)moved[i * 3 + 1]);
+        }
+        *cut = false;
+    }
+    conditionalFree(moved, free);
+
+    if (DV_DEBUG)
+    {
+        printf("[vacuum] %s the last page, %d homes moved\n", *cut ? "cut" : "could not cut", noMoved);
+    }
+
+    if (retCode == DV_FILE_FULL)
+    {
+        // no room before the last page
+        retCode = DV_SUCCESS;
+    }
+
+    return retCode ? retCode : commitCode;
+}
+
+/**
+ * cut pages from the end of data.dv one group at a time,
+ * at most maxPages of them, every one it can if maxPages is 0
+ */
+int dv_vacuum(dv_app *dv, int maxPages)
+{
+    if (!dv->loggedIn)
+    {
+        return DV_LOGGED_OUT;
+    }
+
+    int retCode = DV_SUCCESS;
+    bool cut = true;
+    int noCut = 0;
+    while (cut && (!maxPages || noCut < maxPages))
+    {
+        if (retCode = dv_vacuumPage(dv, &cut))
+        {
+            break;
+        }
+        noCut += cut;
+    }
+
+    if (DV_DEBUG)
+    {
+        printf("[vacuum] cut %d pages\n", noCut);
+    }
+
+    return retCode;
+}
+
+/**
+ * a bounded step between commands,
+ * only once enough of data.dv is free
+ */
+int dv_vacuumIdle(dv_app *dv)
+{
+    if (!dv->loggedIn || !dv_vacuumDue(dv))
+    {
+        return DV_SUCCESS;
+    }
+
+    return dv_vacuum(dv, DV_VACUUM_IDLE_PAGES);
+}
+
+// state while rewriting data.dv with every chain in one run of pages
+typedef struct
+{
+    dv_pageSet in; // data.dv as it is
+    file_struct out;
+    unsigned int noEntries;
+    int retCode;
+} dv_defragState;
+
+void dv_defragNode(dv_defragState *d, btree_node *root)
+{
+    if (!root)
+    {
+        return;
+    }
+
+    // in order, so the entries follow each other by id
+    for (int i = 0; i <= root->n && !d->retCode; i++)
+    {
+        if (root->noChildren)
+        {
+            dv_defragNode(d, root->children[i]);
+        }
+        if (i == root->n || d->retCode)
+        {
+            break;
+        }
+
+        // every entry starts in the last page written, pages before it are full
+        dv_pageSet out;
+        dv_pageOpen(&out, d->in.dv, &d->out);
+        out.floor = out.noPages - 1;
+        out.append = true;
+
+        unsigned int home = 0;
+        d->retCode = dv_pageCopyEntry(&d->in, &out, root->keys[i], (unsigned int)(uintptr_t)root->vals[i], &home);
+        if (!d->retCode)
+        {
+            d->retCode = dv_pageCommit(&out);
+        }
+        dv_pageClose(&out);
+
+        // pages of the old file are read once
+        dv_pageForget(&d->in);
+
+        if (!d->retCode)
+        {
+            root->vals[i] = (void *)(uintptr_t)home;
+            d->noEntries++;
+        }
+    }
+}
+
+/**
+ * rewrite data.dv with the entries in id order, each chain in consecutive pages,
+ * so an entry is read with one sequential read and one run of CTR counters;
+ * replaced like a migration, so a crash leaves the old or the new file
+ */
+int dv_defrag(dv_app *dv)
+{
+    if (!dv->loggedIn)
+    {
+        return DV_LOGGED_OUT;
+    }
+
+    // the maps are staged with the journal applied, and it is emptied after
+    int retCode = DV_SUCCESS;
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        if (retCode = dv_requireMap(dv, i))
+        {
+            return retCode;
+        }
+    }
+    unsigned int generation = MAX(dv_nextGeneration(dv), dv_stagedGeneration() + 1);
+
+    // groups in the log must never be replayed onto the new file
+    if ((retCode = dv_walRecover(dv)) ||
+        (retCode = dv_walRecoverHomes(dv)))
+    {
+        return retCode;
+    }
+
+    dv_defragState d;
+    memset(&d, 0, sizeof(dv_defragState));
+    if (retCode = dv_pageOpen(&d.in, dv, NULL))
+    {
+        return retCode;
+    }
+    if (!file_openTemp(&d.out, data_fp))
+    {
+        dv_pageClose(&d.in);
+        return DV_FILE_DNE;
+    }
+
+    // free space is tracked for the new file
+    dv_pageClearFreeSpace(dv);
+
+    // page 0 holds the superblock
+    unsigned char page[DV_PAGE_LEN];
+    memset(page, 0, DV_PAGE_LEN);
+    dv_writeSuperblock(page, DV_FORMAT, generation);
+    file_pwrite(&d.out, 0, page, DV_PAGE_LEN);
+
+    dv_defragNode(&d, dv->idIdxMap.root);
+    retCode = d.retCode;
+    unsigned int noPages = d.in.filePages;
+    file_off len = d.out.len;
+    dv_pageClose(&d.in);
+
+    if (retCode)
+    {
+        file_abort(&d.out, data_fp);
+    }
+    else
+    {
+        retCode = dv_replaceData(dv, &d.out, generation);
+    }
+
+    if (retCode && dv->formatGeneration == generation)
+    {
+        // data.dv was replaced but not every map was, the next login moves the staged ones
+        dv_kill(dv);
+        return retCode;
+    }
+    if (retCode)
+    {
+        // the homes were changed in memory, read them again from the maps in place
+        dv_pageClearFreeSpace(dv);
+        dv->mapLoaded[DV_IDIDXMAP] = false;
+        dv_requireMap(dv, DV_IDIDXMAP);
+        return retCode;
+    }
+
+    if (DV_DEBUG)
+    {
+        printf("[vacuum] rewrote %d entries from %d into %lld pages at generation %d\n",
+               d.noEntries, noPages, (long long)(len / DV_PAGE_LEN), generation);
+    }
+
+    return DV_SUCCESS;
+}
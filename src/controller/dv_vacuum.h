@@ -0,0 +1,19 @@
+#include "../datavault.h"
+
+#ifndef DV_VACUUM_H
+#define DV_VACUUM_H
+
+// compact once this share of the space in the pages is free
+#define DV_VACUUM_RATIO 0.5
+// files shorter than this are left alone
+#define DV_VACUUM_MIN_PAGES 8
+// pages cut by one idle step
+#define DV_VACUUM_IDLE_PAGES 4
+
+bool dv_vacuumDue(dv_app *dv);
+int dv_vacuumPage(dv_app *dv, bool *cut);
+int dv_vacuum(dv_app *dv, int maxPages);
+int dv_vacuumIdle(dv_app *dv);
+int dv_defrag(dv_app *dv);
+
+#endif // DV_VACUUM_H
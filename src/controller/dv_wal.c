@@ -0,0 +1,535 @@
+#include "dv_wal.h"
+#include "dv_persistence.h"
+#include "dv_journal.h"
+
+#include "../lib/util/fileio.h"
+#include "../lib/util/mem.h"
+#include "../lib/util/thread.h"
+
+#include "../lib/cmathematics/util/numio.h"
+#include "../lib/cmathematics/data/hashing/sha.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+const char *wal_fp = "wal.dv";
+
+// committed group being applied to data.dv in the background
+typedef struct
+{
+    strstream group;
+    unsigned int noBlocks;
+    bool checkpoint;
+    int retCode;
+} dv_walJob;
+
+thread_struct walThread = { 0 };
+dv_walJob walJob = { 0 };
+
+void dv_walChecksum(unsigned char *group, int n, unsigned char *out)
+{
+    void *ctx = sha_initContext(SHA256);
+    sha_update(SHA256, ctx, group, n);
+
+    unsigned char *digest = NULL;
+    sha_digest(SHA256, ctx, &digest);
+    sha_free(ctx);
+
+    memcpy(out, digest, DV_WAL_CHECKSUM_LEN);
+    free(digest);
+}
+
+// length of the record at the start of a group, 0 if it is not a complete image
+int dv_walRecordLen(unsigned char *record, int n)
+{
+    if (record[0] == DV_WAL_PAGE && n >= DV_WAL_PAGE_LEN)
+    {
+        return DV_WAL_PAGE_LEN;
+    }
+    else if (record[0] == DV_WAL_BLOCK && n >= DV_WAL_BLOCK_LEN)
+    {
+        return DV_WAL_BLOCK_LEN;
+    }
+    else if (record[0] == DV_WAL_HOME && n >= DV_WAL_HOME_LEN)
+    {
+        return DV_WAL_HOME_LEN;
+    }
+
+    return 0;
+}
+
+/**
+ * write the page or block images of a committed group into data.dv,
+ * images are complete so applying a group twice is harmless
+ */
+void dv_walApply(file_struct *data, unsigned char *group, int n, unsigned int noBlocks)
+{
+    // scattered writes go to the kernel in batches instead of one at a time
+    file_request reqs[FILE_BATCH_LEN];
+    int noReqs = 0;
+
+    int i = 0;
+    int recordLen;
+    while (i < n && (recordLen = dv_walRecordLen(group + i, n - i)))
+    {
+        if (group[i] == DV_WAL_HOME)
+        {
+            // belongs to the index, not to data.dv
+            i += recordLen;
+            continue;
+        }
+
+        file_off pos = group[i] == DV_WAL_PAGE
+            ? (file_off)smallEndianValue(group + i + 1, 4) * DV_PAGE_LEN
+            : (file_off)smallEndianValue(group + i + 1, 4) << 4;
+        for (int j = 0; j < noReqs; j++)
+        {
+            if (reqs[j].pos == pos)
+            {
+                // a batch completes in any order, the later image must win
+                file_pwriteBatch(data, reqs, noReqs);
+                noReqs = 0;
+                break;
+            }
+        }
+
+        reqs[noReqs].pos = pos;
+        reqs[noReqs].buffer = group + i + 5;
+        reqs[noReqs].n = recordLen - 5;
+        if (++noReqs == FILE_BATCH_LEN)
+        {
+            file_pwriteBatch(data, reqs, noReqs);
+            noReqs = 0;
+        }
+
+        i += recordLen;
+    }
+    file_pwriteBatch(data, reqs, noReqs);
+
+    file_off len = (file_off)noBlocks << 4;
+    if (data->len > len)
+    {
+        // entries were removed
+        file_truncate(data, len);
+    }
+}
+
+// whether a group moves the home page of an entry
+bool dv_walMovesHomes(unsigned char *group, int n)
+{
+    int i = 0;
+    int recordLen;
+    while (i < n && (recordLen = dv_walRecordLen(group + i, n - i)))
+    {
+        if (group[i] == DV_WAL_HOME)
+        {
+            return true;
+        }
+        i += recordLen;
+    }
+
+    return false;
+}
+
+void dv_walApplyJob(void *arg)
+{
+    dv_walJob *job = arg;
+
+    file_struct data;
+    if (!file_openBlocks(&data, data_fp, "r+b", 16))
+    {
+        // left in the log, recovered on the next login
+        job->retCode = DV_FILE_DNE;
+        return;
+    }
+
+    dv_walApply(&data, job->group.str, job->group.size, job->noBlocks);
+
+    if (job->checkpoint)
+    {
+        // data.dv is durable, the log is no longer needed
+        if (file_sync(&data))
+        {
+            file_create(wal_fp);
+        }
+    }
+
+    file_close(&data);
+    job->retCode = DV_SUCCESS;
+}
+
+void dv_walBegin(dv_app *dv, unsigned int noBlocks)
+{
+    if (!dv->walGroup.str)
+    {
+        dv->walGroup = strstream_allocDefault();
+    }
+
+    if (!dv->walBatch)
+    {
+        dv->walGroup.size = 0;
+        dv->walNoRecords = 0;
+    }
+    dv->walNoBlocks = noBlocks;
+}
+
+/**
+ * encrypted image of a page in the group being built,
+ * pages written earlier in a batch are only found here
+ */
+unsigned char *dv_walPendingPage(dv_app *dv, unsigned int page)
+{
+    unsigned char *group = (unsigned char *)dv->walGroup.str;
+    int i = 0;
+    int recordLen;
+    while (i < dv->walGroup.size && (recordLen = dv_walRecordLen(group + i, dv->walGroup.size - i)))
+    {
+        if (group[i] == DV_WAL_PAGE && smallEndianValue(group + i + 1, 4) == page)
+        {
+            return group + i + 5;
+        }
+        i += recordLen;
+    }
+
+    return NULL;
+}
+
+void dv_walWritePage(dv_app *dv, unsigned int page, void *enc)
+{
+    dv->walNoBlocks = MAX(dv->walNoBlocks, (page + 1) * DV_PAGE_BLOCKS);
+
+    unsigned char *pending = dv_walPendingPage(dv, page);
+    if (pending)
+    {
+        // written again in the same batch, only the last image is logged
+        memcpy(pending, enc, DV_PAGE_LEN);
+        return;
+    }
+
+    // format: op, page, encrypted page
+    unsigned char header[5];
+    header[0] = DV_WAL_PAGE;
+    smallEndianStr(page, header + 1, 4);
+
+    strstream_read(&dv->walGroup, header, 5);
+    strstream_read(&dv->walGroup, enc, DV_PAGE_LEN);
+    dv->walNoRecords++;
+}
+
+void dv_walTruncate(dv_app *dv, unsigned int noBlocks)
+{
+    dv->walNoBlocks = noBlocks;
+}
+
+/**
+ * log the new home page of an entry with the pages that moved it,
+ * the journal record written after the group is lost if the process dies in between
+ */
+void dv_walHome(dv_app *dv, unsigned int entryId, unsigned int home)
+{
+    // format: op, entryId, home
+    unsigned char record[DV_WAL_HOME_LEN];
+    record[0] = DV_WAL_HOME;
+    smallEndianStr(entryId, record + 1, 4);
+    smallEndianStr(home, record + 5, 4);
+
+    strstream_read(&dv->walGroup, record, DV_WAL_HOME_LEN);
+    dv->walNoRecords++;
+}
+
+int dv_walCommit(dv_app *dv)
+{
+    if (dv->walBatch)
+    {
+        // committed with the rest of the batch
+        dv->walPending = true;
+        return DV_SUCCESS;
+    }
+
+    dv_walWait(dv);
+
+    // format: op, noBlocks, noRecords, checksum of the group
+    unsigned char commit[DV_WAL_COMMIT_LEN];
+    commit[0] = DV_WAL_COMMIT;
+    smallEndianStr(dv->walNoBlocks, commit + 1, 4);
+    smallEndianStr(dv->walNoRecords, commit + 5, 4);
+    dv_walChecksum(dv->walGroup.str, dv->walGroup.size, commit + 9);
+
+    // one sequential append and one sync for the whole group
+    file_struct wal;
+    if (!file_open(&wal, wal_fp, "ab"))
+    {
+        dv_walAbort(dv);
+        return DV_FILE_DNE;
+    }
+    file_write(&wal, dv->walGroup.str, dv->walGroup.size);
+    file_write(&wal, commit, DV_WAL_COMMIT_LEN);
+    bool synced = file_sync(&wal);
+    file_close(&wal);
+
+    if (!synced)
+    {
+        dv_walAbort(dv);
+        return DV_FILE_DNE;
+    }
+
+    dv->walLen += dv->walGroup.size + DV_WAL_COMMIT_LEN;
+
+    if (DV_DEBUG)
+    {
+        printf("[wal] commit %d images, %d blocks long, log %d bytes\n",
+               dv->walNoRecords, dv->walNoBlocks, dv->walLen);
+    }
+
+    // hand the group to the applier, the next group starts empty
+    strstream_clear(&walJob.group);
+    walJob.group = dv->walGroup;
+    walJob.noBlocks = dv->walNoBlocks;
+    // the log must outlive the journal records of moved homes, the next group checkpoints instead
+    walJob.checkpoint = dv->walLen >= DV_WAL_CHECKPOINT_LEN &&
+                        !dv_walMovesHomes(walJob.group.str, walJob.group.size);
+    if (walJob.checkpoint)
+    {
+        dv->walLen = 0;
+    }
+
+    dv->walGroup.str = NULL;
+    dv->walGroup.size = 0;
+    dv->walGroup.capacity = 0;
+    dv->walNoRecords = 0;
+
+    thread_start(&walThread, dv_walApplyJob, &walJob);
+
+    return DV_SUCCESS;
+}
+
+void dv_walAbort(dv_app *dv)
+{
+    dv->walGroup.size = 0;
+    dv->walNoRecords = 0;
+    dv->walPending = false;
+}
+
+void dv_walBatchBegin(dv_app *dv)
+{
+    if (!dv->walBatch++)
+    {
+        // reads in the batch see data.dv as of its start plus the group
+        dv_walWait(dv);
+        dv_walBegin(dv, 0);
+        dv->walPending = false;
+    }
+}
+
+/**
+ * commit every mutation since the outermost dv_walBatchBegin as one group
+ * with one sync, then the journal records that point into it
+ */
+int dv_walBatchEnd(dv_app *dv)
+{
+    if (--dv->walBatch)
+    {
+        return DV_SUCCESS;
+    }
+
+    int retCode = DV_SUCCESS;
+    if (dv->walPending)
+    {
+        dv->walPending = false;
+        retCode = dv_walCommit(dv);
+    }
+
+    if (retCode)
+    {
+        // index changes must not outlive the pages they name
+        dv_journalDiscardPending(dv);
+        return retCode;
+    }
+
+    return dv_journalFlush(dv);
+}
+
+void dv_walWait(dv_app *dv)
+{
+    // data.dv is current once the last group is applied
+    thread_join(&walThread);
+
+    if (DV_DEBUG && walJob.retCode)
+    {
+        printf("[wal] could not apply group, left in log\n");
+    }
+    walJob.retCode = DV_SUCCESS;
+}
+
+int dv_walRecover(dv_app *dv)
+{
+    dv_walWait(dv);
+    dv->walLen = 0;
+
+    file_struct wal;
+    if (!file_open(&wal, wal_fp, "rb"))
+    {
+        // nothing logged
+        return DV_SUCCESS;
+    }
+    int len = wal.len;
+    unsigned char *log = (unsigned char *)file_read(&wal, len);
+    file_close(&wal);
+
+    if (!log)
+    {
+        return DV_SUCCESS;
+    }
+
+    file_struct data;
+    if (!file_openBlocks(&data, data_fp, "r+b", 16))
+    {
+        free(log);
+        return DV_FILE_DNE;
+    }
+
+    // replay every complete group, a torn group at the end never committed
+    int noGroups = 0;
+    bool homes = false;
+    int groupStart = 0;
+    int noRecords = 0;
+    int i = 0;
+    int recordLen;
+    while (i < len)
+    {
+        if (recordLen = dv_walRecordLen(log + i, len - i))
+        {
+            noRecords++;
+            i += recordLen;
+        }
+        else if (log[i] == DV_WAL_COMMIT && i + DV_WAL_COMMIT_LEN <= len)
+        {
+            unsigned char checksum[DV_WAL_CHECKSUM_LEN];
+            dv_walChecksum(log + groupStart, i - groupStart, checksum);
+            if (smallEndianValue(log + i + 5, 4) != noRecords ||
+                memcmp(checksum, log + i + 9, DV_WAL_CHECKSUM_LEN))
+            {
+                break;
+            }
+
+            dv_walApply(&data, log + groupStart, i - groupStart, smallEndianValue(log + i + 1, 4));
+            homes |= dv_walMovesHomes(log + groupStart, i - groupStart);
+            noGroups++;
+
+            i += DV_WAL_COMMIT_LEN;
+            groupStart = i;
+            noRecords = 0;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    bool synced = file_sync(&data);
+    file_close(&data);
+    free(log);
+
+    if (DV_DEBUG)
+    {
+        printf("[wal] recovered %d groups from %d bytes\n", noGroups, len);
+    }
+
+    if (synced && homes)
+    {
+        // kept until dv_walRecoverHomes journals the moved homes, without the torn group
+        if (file_open(&wal, wal_fp, "r+b"))
+        {
+            file_truncate(&wal, groupStart);
+            file_close(&wal);
+        }
+        dv->walLen = groupStart;
+    }
+    else if (synced)
+    {
+        // groups are in data.dv, start an empty log
+        file_create(wal_fp);
+    }
+
+    return synced ? DV_SUCCESS : DV_FILE_DNE;
+}
+
+/**
+ * journal the home pages moved by the groups dv_walRecover kept,
+ * once the maps can be checkpointed
+ */
+int dv_walRecoverHomes(dv_app *dv)
+{
+    if (!dv->walLen)
+    {
+        return DV_SUCCESS;
+    }
+
+    file_struct wal;
+    if (!file_open(&wal, wal_fp, "rb"))
+    {
+        return DV_FILE_DNE;
+    }
+    int len = wal.len;
+    unsigned char *log = (unsigned char *)file_read(&wal, len);
+    file_close(&wal);
+
+    int retCode = DV_SUCCESS;
+    int noHomes = 0;
+    int i = 0;
+    int recordLen;
+    while (log && !retCode && i < len)
+    {
+        if (recordLen = dv_walRecordLen(log + i, len - i))
+        {
+            if (log[i] == DV_WAL_HOME)
+            {
+                unsigned int entryId = smallEndianValue(log + i + 1, 4);
+                unsigned int home = smallEndianValue(log + i + 5, 4);
+                if (dv->mapLoaded[DV_IDIDXMAP])
+                {
+                    btree_insert(&dv->idIdxMap, entryId, (void *)(uintptr_t)home);
+                    dv->mapDirty[DV_IDIDXMAP] = true;
+                }
+                retCode = dv_journalStart(dv, entryId, home);
+                noHomes++;
+            }
+            i += recordLen;
+        }
+        else
+        {
+            // only committed groups were kept
+            i += DV_WAL_COMMIT_LEN;
+        }
+    }
+    conditionalFree(log, free);
+
+    if (DV_DEBUG)
+    {
+        printf("[wal] journalled %d recovered homes\n", noHomes);
+    }
+
+    if (!retCode)
+    {
+        // the index no longer needs the log
+        file_create(wal_fp);
+        dv->walLen = 0;
+    }
+
+    return retCode;
+}
+
+void dv_walClear(dv_app *dv)
+{
+    dv_walWait(dv);
+
+    strstream_clear(&dv->walGroup);
+    strstream_clear(&walJob.group);
+    dv->walNoRecords = 0;
+    dv->walNoBlocks = 0;
+    dv->walLen = 0;
+    dv->walBatch = 0;
+    dv->walPending = false;
+}
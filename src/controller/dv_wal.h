@@ -0,0 +1,39 @@
+#include "../datavault.h"
+#include "dv_page.h"
+
+#ifndef DV_WAL_H
+#define DV_WAL_H
+
+extern const char *wal_fp;
+
+// records: op, payload
+#define DV_WAL_BLOCK 1  // block(4), encrypted block(16)   --> written at block in data.dv, format 2 and earlier
+#define DV_WAL_COMMIT 2 // noBlocks(4), noRecords(4), checksum(8)
+#define DV_WAL_PAGE 3   // page(4), encrypted page         --> written at page in data.dv
+#define DV_WAL_HOME 4   // entryId(4), home page(4)        --> journalled again if the group is recovered
+#define DV_WAL_BLOCK_LEN 21
+#define DV_WAL_COMMIT_LEN 17
+#define DV_WAL_PAGE_LEN (5 + DV_PAGE_LEN)
+#define DV_WAL_HOME_LEN 9
+#define DV_WAL_CHECKSUM_LEN 8
+
+// sync data.dv and empty the log once it is this long
+#define DV_WAL_CHECKPOINT_LEN (256 << 10)
+
+void dv_walBegin(dv_app *dv, unsigned int noBlocks);
+void dv_walWritePage(dv_app *dv, unsigned int page, void *enc);
+void dv_walTruncate(dv_app *dv, unsigned int noBlocks);
+void dv_walHome(dv_app *dv, unsigned int entryId, unsigned int home);
+int dv_walCommit(dv_app *dv);
+void dv_walAbort(dv_app *dv);
+unsigned char *dv_walPendingPage(dv_app *dv, unsigned int page);
+
+void dv_walBatchBegin(dv_app *dv);
+int dv_walBatchEnd(dv_app *dv);
+
+void dv_walWait(dv_app *dv);
+int dv_walRecover(dv_app *dv);
+int dv_walRecoverHomes(dv_app *dv);
+void dv_walClear(dv_app *dv);
+
+#endif // DV_WAL_H
@@ -1,5 +1,8 @@
 #include "datavault.h"
 #include "controller/dv_persistence.h"
+#include "controller/dv_journal.h"
+#include "controller/dv_wal.h"
+#include "controller/dv_page.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -17,6 +20,7 @@ int dv_init(dv_app *dv)
     // clear keys
     memset(dv->dataKey, 0, DV_KEYLEN);
     memset(dv->aes_key_schedule, 0, (AES_256_NR + 1) * AES_BLOCK_LEN);
+    memset(dv->map_key_schedules, 0, DV_NO_MAPS * (AES_256_NR + 1) * AES_BLOCK_LEN);
 
     // initialize pointers
     dv->random = NULL;
@@ -24,6 +28,43 @@ int dv_init(dv_app *dv)
     dv->nameIdMap = NULL;
     dv->idIdxMap.root = NULL;
     dv->catIdMap = NULL;
+    dv->catNames = NULL;
+    dv->catNamesLen = 0;
+    memset(dv->mapLoaded, 0, DV_NO_MAPS * sizeof(bool));
+    memset(dv->mapDirty, 0, DV_NO_MAPS * sizeof(bool));
+    memset(dv->mapGeneration, 0, DV_NO_MAPS * sizeof(unsigned int));
+
+    // clear journal
+    dv->journalRead = false;
+    dv->generation = 0;
+    dv->mapFilesRead = false;
+    dv->mapFileGeneration = 0;
+    memset(dv->journalNonce, 0, 16);
+    memset(dv->journal_key_schedule, 0, (AES_256_NR + 1) * AES_BLOCK_LEN);
+    dv->journal.str = NULL;
+    dv->journal.size = 0;
+    dv->journal.capacity = 0;
+    dv->journalPending.str = NULL;
+    dv->journalPending.size = 0;
+    dv->journalPending.capacity = 0;
+
+    // clear write-ahead log
+    dv->walGroup.str = NULL;
+    dv->walGroup.size = 0;
+    dv->walGroup.capacity = 0;
+    dv->walNoRecords = 0;
+    dv->walNoBlocks = 0;
+    dv->walLen = 0;
+    dv->walBatch = 0;
+    dv->walPending = false;
+
+    // format is read at login
+    dv->formatVersion = 0;
+    dv->formatGeneration = 0;
+
+    dv->freeSpace = NULL;
+    dv->freeSpaceLen = 0;
+    dv->freeSpaceSaved = true;
 
     dv->maxEntryId = 0;
     dv->maxCatId = 0;
@@ -41,6 +82,7 @@ int dv_kill(dv_app *dv)
     // clear keys
     memset(dv->dataKey, 0, DV_KEYLEN);
     memset(dv->aes_key_schedule, 0, (AES_256_NR + 1) * AES_BLOCK_LEN);
+    memset(dv->map_key_schedules, 0, DV_NO_MAPS * (AES_256_NR + 1) * AES_BLOCK_LEN);
 
     // free pointers
     conditionalFree(dv->random, free);
@@ -54,6 +96,21 @@ int dv_kill(dv_app *dv)
 
     avl_freeKey(dv->catIdMap);
     dv->catIdMap = NULL;
+    conditionalFree(dv->catNames, free);
+    dv->catNames = NULL;
+    dv->catNamesLen = 0;
+
+    memset(dv->mapLoaded, 0, DV_NO_MAPS * sizeof(bool));
+    memset(dv->mapDirty, 0, DV_NO_MAPS * sizeof(bool));
+    memset(dv->mapGeneration, 0, DV_NO_MAPS * sizeof(unsigned int));
+
+    // finish pending data writes
+    dv_walClear(dv);
+    dv_pageClearFreeSpace(dv);
+
+    // free journal
+    dv_journalClear(dv);
+    memset(dv->journal_key_schedule, 0, (AES_256_NR + 1) * AES_BLOCK_LEN);
 
     dv->maxEntryId = 0;
     dv->maxCatId = 0;
@@ -68,16 +125,20 @@ void printEntryId(avl *node)
     printf("%s --> %d --> %d\n", (const char *)node->key, (unsigned int)node->val, idx);
 }
 
-void printCategoryId(avl *node)
-{
-    printf("%s --> %d\n", (const char *)node->key, (unsigned int)node->val);
-}
-
 void dv_log(dv_app *dv)
 {
     printf("Logged in: %s\n", dv->loggedIn ? "true" : "false");
     if (dv->loggedIn)
     {
+        for (int i = 0; i < DV_NO_MAPS; i++)
+        {
+            if (dv_requireMap(dv, i))
+            {
+                printf("Could not load %s\n", dv_maps[i].path);
+                return;
+            }
+        }
+
         logDv = dv;
 
         printf("Entries==============\n");
@@ -88,8 +149,13 @@ void dv_log(dv_app *dv)
 
         printf("Categories===========\n");
         printf("Name --> id\n");
-        if (dv->catIdMap && dv->catIdMap->key) {
-            avl_inorderTraverse(dv->catIdMap, printCategoryId);
+        for (unsigned int catId = 1; catId <= dv->maxCatId; catId++)
+        {
+            const char *name = dv_categoryName(dv, catId);
+            if (name)
+            {
+                printf("%s --> %d\n", name, catId);
+            }
         }
 
         logDv = NULL;
@@ -3,6 +3,7 @@
 
 #include "lib/ds/avl.h"
 #include "lib/ds/btree.h"
+#include "lib/ds/strstream.h"
 
 #ifndef DATAVAULT_H
 #define DATAVAULT_H
@@ -47,15 +48,23 @@
 // parameters
 #define DV_KEYLEN 32
 
+// index maps, each stored in its own file under its own subkey
+#define DV_NO_MAPS 3
+#define DV_NAMEIDMAP 0
+#define DV_IDIDXMAP 1
+#define DV_CATIDMAP 2
+
 // return codes
 #define DV_SUCCESS 0
 #define DV_MEM_ERR 1
 #define DV_FILE_DNE 2
 #define DV_INVALID_INPUT 3
 #define DV_LOGGED_OUT 4
+#define DV_FILE_FULL 5
 
 // run mode
 extern int DV_DEBUG;
+extern int DV_LAZYLOAD; // load each index map on first use instead of at login
 
 // application data
 typedef struct
@@ -64,15 +73,48 @@ typedef struct
 
     unsigned char dataKey[DV_KEYLEN];
     unsigned char aes_key_schedule[AES_256_NR + 1][AES_BLOCK_SIDE][AES_BLOCK_SIDE];
+    unsigned char map_key_schedules[DV_NO_MAPS][AES_256_NR + 1][AES_BLOCK_SIDE][AES_BLOCK_SIDE];
 
     unsigned char *random;
 
     avl *nameIdMap;
     btree idIdxMap;
     avl *catIdMap;
+    char **catNames; // catIdMap's keys by id, NULL where there is none
+    unsigned int catNamesLen;
+    bool mapLoaded[DV_NO_MAPS];
+    bool mapDirty[DV_NO_MAPS]; // modified since the last checkpoint
+    unsigned int mapGeneration[DV_NO_MAPS];
+
+    // index journal, appended to as the maps are modified
+    bool journalRead;
+    unsigned int generation; // checkpoint generation the journal applies to
+    bool mapFilesRead;
+    unsigned int mapFileGeneration; // highest generation in the map files' headers, kept up as this process writes them
+    unsigned char journalNonce[16];
+    unsigned char journal_key_schedule[AES_256_NR + 1][AES_BLOCK_SIDE][AES_BLOCK_SIDE];
+    strstream journal; // decrypted records
+    strstream journalPending; // encrypted records held back until the pages of a batch are committed
+
+    // data.dv write-ahead log, one group of page images per mutation or batch of mutations
+    strstream walGroup;
+    int walNoRecords;
+    unsigned int walNoBlocks; // length of data.dv in blocks once the group is applied
+    int walLen;               // bytes in the log since the last checkpoint
+    int walBatch;             // open batches, their mutations share one group
+    bool walPending;          // a mutation in the batch is waiting for the group commit
+
+    // data.dv format from its superblock
+    unsigned char formatVersion;
+    unsigned int formatGeneration; // first map generation written in this format
+
+    // free bytes in each page of data.dv, read from freeSpace.dv or the page headers on the first write
+    unsigned short *freeSpace;
+    unsigned int freeSpaceLen;
+    bool freeSpaceSaved; // freeSpace.dv may still describe data.dv, removed before the first change
 
     unsigned int maxEntryId;
-    unsigned char maxCatId;
+    unsigned int maxCatId;
 } dv_app;
 
 // application-level functions
@@ -217,7 +217,7 @@ int aes_encrypt_withSchedule(unsigned char *in_text, int n,
     // allocate memory for CTR mode
     unsigned char *counter = NULL;
     unsigned char *tmp = NULL; // to write encrypted counter to
-    if (mode == AES_CTR)
+    if (mode == AES_CTR || mode == AES_CTR_WRAP)
     {
         counter = malloc(AES_BLOCK_LEN * sizeof(unsigned char));
         memcpy(counter, iv, AES_BLOCK_LEN * sizeof(unsigned char));
@@ -231,7 +231,7 @@ int aes_encrypt_withSchedule(unsigned char *in_text, int n,
 
     // allocate output
     int outLen = noBlocks * AES_BLOCK_LEN;
-    if (mode == AES_CTR)
+    if (mode == AES_CTR || mode == AES_CTR_WRAP)
     {
         // allocate for the length (not padded)
         *out = malloc(n * sizeof(unsigned char));
@@ -270,6 +270,7 @@ int aes_encrypt_withSchedule(unsigned char *in_text, int n,
             }
             break;
         case AES_CTR:
+        case AES_CTR_WRAP:
             // encrypt counter and write to the complete tmp block
             aes_encrypt_block(counter, AES_BLOCK_LEN,
                               subkeys, nr,
@@ -282,10 +283,10 @@ int aes_encrypt_withSchedule(unsigned char *in_text, int n,
                 (*out)[(i << 4) + j] = tmp[j] ^ in_text[(i << 4) + j];
             }
 
-            // increment the counter by 1 (RTL)
+            // increment the counter by 1 (RTL), without carrying out of the last byte in AES_CTR_WRAP
             for (int j = AES_BLOCK_LEN - 1; j >= 0; j--)
             {
-                if (counter[j] == ~0)
+                if (counter[j] == 0xff && mode == AES_CTR)
                 {
                     // max value, will have overflow and carry
                     counter[j] = 0;
@@ -309,7 +310,7 @@ int aes_encrypt_withSchedule(unsigned char *in_text, int n,
         };
     }
 
-    if (mode == AES_CTR)
+    if (mode == AES_CTR || mode == AES_CTR_WRAP)
     {
         free(counter);
         free(tmp);
@@ -483,7 +484,7 @@ int aes_decrypt_withSchedule(unsigned char *in_cipher, int n,
 
     // allocate memory for CTR variables
     unsigned char *counter = NULL;
-    if (mode == AES_CTR)
+    if (mode == AES_CTR || mode == AES_CTR_WRAP)
     {
         counter = malloc(AES_BLOCK_LEN * sizeof(unsigned char));
         memcpy(counter, iv, AES_BLOCK_LEN * sizeof(unsigned char));
@@ -529,6 +530,7 @@ int aes_decrypt_withSchedule(unsigned char *in_cipher, int n,
             }
             break;
         case AES_CTR:
+        case AES_CTR_WRAP:
             // encrypt counter
             aes_encrypt_block(counter, AES_BLOCK_LEN,
                               subkeys, nr,
@@ -541,10 +543,10 @@ int aes_decrypt_withSchedule(unsigned char *in_cipher, int n,
                 paddedOut[(i << 4) + j] ^= in_cipher[(i << 4) + j];
             }
 
-            // increment the counter by 1 (RTL)
+            // increment the counter by 1 (RTL), without carrying out of the last byte in AES_CTR_WRAP
             for (int j = AES_BLOCK_LEN - 1; j >= 0; j--)
             {
-                if (counter[j] == ~0)
+                if (counter[j] == 0xff && mode == AES_CTR)
                 {
                     // max value, will have overflow and carry
                     counter[j] = 0;
@@ -566,7 +568,7 @@ int aes_decrypt_withSchedule(unsigned char *in_cipher, int n,
 
     unsigned char noPadding = 0;
 
-    if (mode == AES_CTR)
+    if (mode == AES_CTR || mode == AES_CTR_WRAP)
     {
         // padding is considered as number of leftover characters in the incomplete block
         // if no extra, no padding because do not allocate an extra block in CTR mode
@@ -814,4 +816,20 @@ void aes_incrementCounter(unsigned char iv[AES_BLOCK_LEN], unsigned int inc)
 
         carry = (unsigned char)(sum >> 8);
     }
+}
+
+// CTR over a single block into a caller buffer, in and out may be the same
+void aes_ctr_block(unsigned char *in, int n,
+                   unsigned char subkeys[][AES_BLOCK_SIDE][AES_BLOCK_SIDE], int nr,
+                   unsigned char counter[AES_BLOCK_LEN],
+                   unsigned char *out)
+{
+    unsigned char keystream[AES_BLOCK_LEN];
+    aes_encrypt_block(counter, AES_BLOCK_LEN, subkeys, nr, NULL, keystream);
+
+    n = n < AES_BLOCK_LEN ? n : AES_BLOCK_LEN;
+    for (int i = 0; i < n; i++)
+    {
+        out[i] = in[i] ^ keystream[i];
+    }
 }
\ No newline at end of file
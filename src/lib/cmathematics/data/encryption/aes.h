@@ -27,6 +27,7 @@
 #define AES_ECB 0
 #define AES_CBC 1
 #define AES_CTR 2
+#define AES_CTR_WRAP 3 // CTR that only increments the last counter byte, as files written before the carry fix
 
 /*
     REFERENCE TABLES
@@ -109,5 +110,9 @@ void aes_generateKeySchedule192(unsigned char *in_key, unsigned char subkeys[AES
 void aes_generateKeySchedule256(unsigned char *in_key, unsigned char subkeys[AES_256_NR + 1][AES_BLOCK_SIDE][AES_BLOCK_SIDE]);
 
 void aes_incrementCounter(unsigned char iv[AES_BLOCK_LEN], unsigned int inc);
+void aes_ctr_block(unsigned char *in, int n,
+                   unsigned char subkeys[][AES_BLOCK_SIDE][AES_BLOCK_SIDE], int nr,
+                   unsigned char counter[AES_BLOCK_LEN],
+                   unsigned char *out);
 
 #endif // AES_H
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "chacha20.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../lib/arrays.h"
+#include "../../util/numio.h"
+
+// "expand 32-byte k" as four small endian words
+static const unsigned int chacha20_constants[4] = {
+    0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+
+/*
+    CORE FUNCTIONS
+*/
+
+void chacha20_quarterRound(unsigned int state[CHACHA20_STATE_LEN], int a, int b, int c, int d)
+{
+    state[a] += state[b]; state[d] ^= state[a]; state[d] = leftRotateI(state[d], 16);
+    state[c] += state[d]; state[b] ^= state[c]; state[b] = leftRotateI(state[b], 12);
+    state[a] += state[b]; state[d] ^= state[a]; state[d] = leftRotateI(state[d], 8);
+    state[c] += state[d]; state[b] ^= state[c]; state[b] = leftRotateI(state[b], 7);
+}
+
+void chacha20_initState(unsigned int state[CHACHA20_STATE_LEN],
+                        unsigned char key[CHACHA20_KEY_LEN],
+                        unsigned int counter,
+                        unsigned char nonce[CHACHA20_NONCE_LEN])
+{
+    // constants
+    memcpy(state, chacha20_constants, 4 * sizeof(unsigned int));
+
+    // key words
+    for (int i = 0; i < 8; i++)
+    {
+        state[4 + i] = smallEndianValue(key + (i << 2), 4);
+    }
+
+    // block counter
+    state[12] = counter;
+
+    // nonce words
+    for (int i = 0; i < 3; i++)
+    {
+        state[13 + i] = nonce ? smallEndianValue(nonce + (i << 2), 4) : 0;
+    }
+}
+
+void chacha20_block(unsigned int state[CHACHA20_STATE_LEN],
+                    unsigned char out[CHACHA20_BLOCK_LEN])
+{
+    unsigned int working[CHACHA20_STATE_LEN];
+    memcpy(working, state, CHACHA20_STATE_LEN * sizeof(unsigned int));
+
+    for (int i = 0; i < CHACHA20_NR; i++)
+    {
+        // column round
+        chacha20_quarterRound(working, 0, 4, 8, 12);
+        chacha20_quarterRound(working, 1, 5, 9, 13);
+        chacha20_quarterRound(working, 2, 6, 10, 14);
+        chacha20_quarterRound(working, 3, 7, 11, 15);
+
+        // diagonal round
+        chacha20_quarterRound(working, 0, 5, 10, 15);
+        chacha20_quarterRound(working, 1, 6, 11, 12);
+        chacha20_quarterRound(working, 2, 7, 8, 13);
+        chacha20_quarterRound(working, 3, 4, 9, 14);
+    }
+
+    // add the input state and serialize
+    for (int i = 0; i < CHACHA20_STATE_LEN; i++)
+    {
+        smallEndianStr(working[i] + state[i], out + (i << 2), 4);
+    }
+
+    memset(working, 0, sizeof(working));
+
+    // advance the block counter
+    state[12]++;
+}
+
+/*
+    STREAM FUNCTIONS
+*/
+
+void chacha20_keystream(unsigned char key[CHACHA20_KEY_LEN],
+                        unsigned int counter,
+                        unsigned char nonce[CHACHA20_NONCE_LEN],
+                        unsigned char *out, int n)
+{
+    unsigned int state[CHACHA20_STATE_LEN];
+    unsigned char block[CHACHA20_BLOCK_LEN];
+
+    chacha20_initState(state, key, counter, nonce);
+
+    // full blocks go straight into the output
+    while (n >= CHACHA20_BLOCK_LEN)
+    {
+        chacha20_block(state, out);
+        out += CHACHA20_BLOCK_LEN;
+        n -= CHACHA20_BLOCK_LEN;
+    }
+
+    // incomplete final block
+    if (n > 0)
+    {
+        chacha20_block(state, block);
+        memcpy(out, block, n);
+    }
+
+    memset(state, 0, sizeof(state));
+    memset(block, 0, sizeof(block));
+}
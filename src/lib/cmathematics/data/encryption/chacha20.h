@@ -0,0 +1,45 @@
+#include "../../cmathematics.h"
+
+/*
+ * Specification and test vectors:
+ * https://datatracker.ietf.org/doc/html/rfc8439
+ */
+
+#ifndef CHACHA20_H
+#define CHACHA20_H
+
+#define CHACHA20_KEY_LEN 32
+#define CHACHA20_NONCE_LEN 12
+#define CHACHA20_BLOCK_LEN 64
+
+// number of 32-bit words in the state
+#define CHACHA20_STATE_LEN 16
+
+// number of double rounds (column round + diagonal round)
+#define CHACHA20_NR 10
+
+/*
+    CORE FUNCTIONS
+*/
+
+void chacha20_quarterRound(unsigned int state[CHACHA20_STATE_LEN], int a, int b, int c, int d);
+
+void chacha20_initState(unsigned int state[CHACHA20_STATE_LEN],
+                        unsigned char key[CHACHA20_KEY_LEN],
+                        unsigned int counter,
+                        unsigned char nonce[CHACHA20_NONCE_LEN]);
+
+void chacha20_block(unsigned int state[CHACHA20_STATE_LEN],
+                    unsigned char out[CHACHA20_BLOCK_LEN]);
+
+/*
+    STREAM FUNCTIONS
+*/
+
+// write n bytes of keystream into out, starting at the block counter
+void chacha20_keystream(unsigned char key[CHACHA20_KEY_LEN],
+                        unsigned int counter,
+                        unsigned char nonce[CHACHA20_NONCE_LEN],
+                        unsigned char *out, int n);
+
+#endif // CHACHA20_H
@@ -0,0 +1,79 @@
+#include "hkdf.h"
+
+#include "sha.h"
+#include "hmac.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void hkdf_hmac_sha(unsigned char *ikm, int ikmLen,
+                   unsigned char *salt, int saltLen,
+                   unsigned char *info, int infoLen,
+                   char *sha_mode,
+                   int dkLen, unsigned char **out)
+{
+    *out = malloc(dkLen);
+    memset(*out, 0, dkLen);
+
+    // get sha parameters
+    int mode = sha_getModeNum(sha_mode);
+    int hLen = sha_getRetLenIdx(mode);
+
+    // EXTRACT: prk = HMAC(salt, ikm), salt defaults to hLen zero bytes
+    unsigned char *zeroSalt = NULL;
+    if (!salt || !saltLen)
+    {
+        zeroSalt = malloc(hLen);
+        memset(zeroSalt, 0, hLen);
+        salt = zeroSalt;
+        saltLen = hLen;
+    }
+
+    unsigned char *prk = NULL;
+    int prkLen = hmac_sha(salt, saltLen, ikm, ikmLen, sha_mode, &prk);
+
+    // EXPAND: T(i) = HMAC(prk, T(i - 1) | info | i)
+    unsigned char *input = malloc(hLen + infoLen + 1);
+    unsigned char *block = NULL;
+    int blockLen = 0;
+
+    int cursor = 0;
+    for (unsigned char i = 1; cursor < dkLen; i++)
+    {
+        // concatenate previous block, info and counter
+        int inputLen = 0;
+        if (block)
+        {
+            memcpy(input, block, blockLen);
+            inputLen += blockLen;
+            free(block);
+        }
+        memcpy(input + inputLen, info, infoLen);
+        inputLen += infoLen;
+        input[inputLen++] = i;
+
+        blockLen = hmac_sha(prk, prkLen, input, inputLen, sha_mode, &block);
+
+        // copy into the output
+        int n = MIN(blockLen, dkLen - cursor);
+        memcpy(*out + cursor, block, n);
+        cursor += n;
+    }
+
+    // clear intermediate key material
+    memset(prk, 0, prkLen);
+    memset(input, 0, hLen + infoLen + 1);
+    if (block)
+    {
+        memset(block, 0, blockLen);
+        free(block);
+    }
+
+    free(prk);
+    free(input);
+    if (zeroSalt)
+    {
+        free(zeroSalt);
+    }
+}
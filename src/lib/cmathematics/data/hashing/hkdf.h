@@ -0,0 +1,12 @@
+#include "../../cmathematics.h"
+
+#ifndef HKDF_H
+#define HKDF_H
+
+void hkdf_hmac_sha(unsigned char *ikm, int ikmLen,
+                   unsigned char *salt, int saltLen,
+                   unsigned char *info, int infoLen,
+                   char *sha_mode,
+                   int dkLen, unsigned char **out);
+
+#endif // HKDF_H
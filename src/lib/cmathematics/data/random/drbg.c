@@ -0,0 +1,203 @@
+#include "drbg.h"
+
+#ifdef _WIN32
+    #define _CRT_RAND_S
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <process.h>
+    #define DRBG_GETPID() _getpid()
+#else
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #ifdef __MACH__
+        #include <sys/random.h>
+    #elif defined(__linux__)
+        #include <sys/random.h>
+    #endif
+    #define DRBG_GETPID() getpid()
+#endif
+
+#ifdef _MSC_VER
+    #define DRBG_THREAD_LOCAL __declspec(thread)
+#else
+    #define DRBG_THREAD_LOCAL __thread
+#endif
+
+// each thread generates from its own state, so no locking is required
+static DRBG_THREAD_LOCAL drbg_context drbg_local;
+
+/*
+    ENTROPY SOURCE
+*/
+
+#ifndef _WIN32
+static bool drbg_urandom(unsigned char *out, int n)
+{
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    while (n > 0)
+    {
+        ssize_t res = read(fd, out, n);
+        if (res < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (res <= 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        out += res;
+        n -= res;
+    }
+
+    close(fd);
+    return true;
+}
+#endif
+
+bool drbg_osEntropy(unsigned char *out, int n)
+{
+#ifdef _WIN32
+    unsigned int word;
+    while (n > 0)
+    {
+        if (rand_s(&word))
+        {
+            return false;
+        }
+
+        int len = MIN(n, (int)sizeof(unsigned int));
+        memcpy(out, &word, len);
+        out += len;
+        n -= len;
+    }
+    word = 0;
+    return true;
+#elif defined(__MACH__)
+    while (n > 0)
+    {
+        // getentropy is capped at 256 bytes per call
+        int len = MIN(n, 256);
+        if (getentropy(out, len))
+        {
+            return drbg_urandom(out, n);
+        }
+        out += len;
+        n -= len;
+    }
+    return true;
+#elif defined(__linux__)
+    while (n > 0)
+    {
+        ssize_t res = getrandom(out, n, 0);
+        if (res < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // kernel without getrandom(2)
+            return drbg_urandom(out, n);
+        }
+
+        out += res;
+        n -= res;
+    }
+    return true;
+#else
+    return drbg_urandom(out, n);
+#endif
+}
+
+/*
+    CONTEXT FUNCTIONS
+*/
+
+void drbg_reseed(drbg_context *ctx)
+{
+    unsigned char seed[CHACHA20_KEY_LEN];
+    if (!drbg_osEntropy(seed, CHACHA20_KEY_LEN))
+    {
+        // never fall back to a predictable generator
+        fprintf(stderr, "drbg: could not read from the operating system entropy source\n");
+        abort();
+    }
+
+    // mix into the existing key so a weak source cannot undo previous seeding
+    for (int i = 0; i < CHACHA20_KEY_LEN; i++)
+    {
+        ctx->key[i] ^= seed[i];
+    }
+    memset(seed, 0, CHACHA20_KEY_LEN);
+
+    ctx->seeded = true;
+    ctx->pid = DRBG_GETPID();
+    ctx->sinceReseed = 0;
+
+    // discard output generated with the previous key
+    drbg_refill(ctx);
+}
+
+void drbg_refill(drbg_context *ctx)
+{
+    // one call generates the next key followed by the output buffer
+    chacha20_keystream(ctx->key, 0, NULL, ctx->buffer, CHACHA20_KEY_LEN + DRBG_BUF_LEN);
+
+    // replace the key immediately so served bytes cannot be recomputed
+    memcpy(ctx->key, ctx->buffer, CHACHA20_KEY_LEN);
+    memset(ctx->buffer, 0, CHACHA20_KEY_LEN);
+
+    ctx->cursor = CHACHA20_KEY_LEN;
+}
+
+void drbg_generate(drbg_context *ctx, unsigned char *out, int n)
+{
+    if (!out || n <= 0)
+    {
+        return;
+    }
+
+    if (!ctx->seeded ||
+        ctx->pid != DRBG_GETPID() ||
+        ctx->sinceReseed >= DRBG_RESEED_INTERVAL)
+    {
+        drbg_reseed(ctx);
+    }
+
+    while (n)
+    {
+        if (ctx->cursor == CHACHA20_KEY_LEN + DRBG_BUF_LEN)
+        {
+            drbg_refill(ctx);
+        }
+
+        int len = MIN(n, CHACHA20_KEY_LEN + DRBG_BUF_LEN - ctx->cursor);
+        memcpy(out, ctx->buffer + ctx->cursor, len);
+
+        // erase served bytes
+        memset(ctx->buffer + ctx->cursor, 0, len);
+
+        ctx->cursor += len;
+        ctx->sinceReseed += len;
+        out += len;
+        n -= len;
+    }
+}
+
+void drbg_randomBytes(unsigned char *out, int n)
+{
+    drbg_generate(&drbg_local, out, n);
+}
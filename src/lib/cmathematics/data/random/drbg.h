@@ -0,0 +1,49 @@
+#include "../../cmathematics.h"
+
+#include "../encryption/chacha20.h"
+
+/*
+ * Fast-key-erasure ChaCha20 generator:
+ * https://blog.cr.yp.to/20170723-random.html
+ */
+
+#ifndef DRBG_H
+#define DRBG_H
+
+// number of output bytes generated per ChaCha20 call
+#define DRBG_BUF_LEN (64 * CHACHA20_BLOCK_LEN)
+
+// number of output bytes served before mixing in fresh OS entropy
+#define DRBG_RESEED_INTERVAL (1 << 20)
+
+typedef struct drbg_context
+{
+    bool seeded;
+    int pid; // process the state was seeded in, reseed after fork
+
+    unsigned int sinceReseed; // output bytes since the last reseed
+    int cursor;               // next unread byte in the buffer
+
+    unsigned char key[CHACHA20_KEY_LEN];
+    unsigned char buffer[CHACHA20_KEY_LEN + DRBG_BUF_LEN];
+} drbg_context;
+
+/*
+    ENTROPY SOURCE
+*/
+
+// read n bytes from the operating system source (getrandom(2) on Linux)
+bool drbg_osEntropy(unsigned char *out, int n);
+
+/*
+    CONTEXT FUNCTIONS
+*/
+
+void drbg_reseed(drbg_context *ctx);
+void drbg_refill(drbg_context *ctx);
+void drbg_generate(drbg_context *ctx, unsigned char *out, int n);
+
+// generate n bytes with the calling thread's state
+void drbg_randomBytes(unsigned char *out, int n);
+
+#endif // DRBG_H
@@ -1,5 +1,7 @@
 #include "arrays.h"
 
+#include "../data/random/drbg.h"
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -44,10 +46,8 @@ void randomBytes(char *out, int n)
         return;
     }
 
-    while (n)
-    {
-        out[--n] = rand() & 0xff; // cap at 255
-    }
+    // buffered ChaCha20 generator, reseeded from the operating system
+    drbg_randomBytes((unsigned char *)out, n);
 }
 
 /**
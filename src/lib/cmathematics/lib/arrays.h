@@ -10,7 +10,7 @@
  */
 char arrContains(void **arr, int n, void *target);
 
-// random array generation
+// cryptographically secure random array generation
 char *newRandomBytes(int n);
 void randomBytes(char *out, int n);
 
@@ -178,3 +178,44 @@ void largeEndianStr(unsigned int val, unsigned char *out, int n)
         val >>= 8;
     }
 }
+
+int varintLen(unsigned int val)
+{
+    int ret = 1;
+    while (val >>= 7)
+    {
+        ret++;
+    }
+
+    return ret;
+}
+
+int varintStr(unsigned int val, unsigned char *out)
+{
+    // 7 bits per byte from the lowest, the high bit set on all but the last
+    int i = 0;
+    while (val >= 0x80)
+    {
+        out[i++] = (unsigned char)(val | 0x80);
+        val >>= 7;
+    }
+    out[i++] = (unsigned char)val;
+
+    return i;
+}
+
+int varintValue(unsigned char *str, int n, unsigned int *val)
+{
+    *val = 0;
+    for (int i = 0; i < n && i < VARINT_MAX_LEN; i++)
+    {
+        *val |= (unsigned int)(str[i] & 0x7f) << (7 * i);
+        if (!(str[i] & 0x80))
+        {
+            return i + 1;
+        }
+    }
+
+    // runs past the string
+    return 0;
+}
@@ -31,4 +31,31 @@ unsigned int largeEndianValue(unsigned char *str, int n);
 char *newLargeEndianStr(unsigned int val);
 void largeEndianStr(unsigned int val, unsigned char *out, int n);
 
+// longest varint of an unsigned int
+#define VARINT_MAX_LEN 5
+
+/**
+ * method to get the number of bytes a value takes as a varint
+ * @param val the value
+ * @return the number of bytes
+ */
+int varintLen(unsigned int val);
+
+/**
+ * method to write a value as a varint, 7 bits per byte from the lowest
+ * @param val the value
+ * @param out the output, at least VARINT_MAX_LEN bytes
+ * @return the number of bytes written
+ */
+int varintStr(unsigned int val, unsigned char *out);
+
+/**
+ * method to read a varint
+ * @param str the string
+ * @param n the number of bytes available
+ * @param val the value read
+ * @return the number of bytes read, 0 if the varint does not end within n bytes
+ */
+int varintValue(unsigned char *str, int n, unsigned int *val);
+
 #endif // NUMIO_H
\ No newline at end of file
@@ -1,16 +1,40 @@
 #include "fileio.h"
 
+#include "mem.h"
+#include "thread.h"
+#include "uring.h"
+#include "../../datavault.h"
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #ifdef DV_WINDOWS
     #include <io.h>
+    #include <windows.h>
+#else
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+#ifdef __linux__
+    #include <linux/fs.h>
+    #include <sys/ioctl.h>
+    #include <sys/sendfile.h>
+    #include <sys/syscall.h>
 #endif
-#include <sys/types.h>
-#include <sys/stat.h>
 
 char defaultPath[256] = { 0 };
 
+#ifdef DV_URING
+// ring shared by all batches, set up on first use
+uring_struct fileRing = { 0 };
+int fileRingState = 0; // 0 untried, 1 ready, -1 unavailable
+thread_mutex fileRingLock = THREAD_MUTEX_INIT;
+#endif
+
 void file_setDefaultPath(char *path)
 {
     if (path)
@@ -25,6 +49,18 @@ void file_setDefaultPath(char *path)
     printf("Default dir set to %s\n", defaultPath);
 }
 
+void file_fullPath(const char *path, char *out)
+{
+    if (defaultPath[0])
+    {
+        sprintf(out, "%s%s%s", defaultPath, PATH_SEPARATOR, path);
+    }
+    else
+    {
+        strcpy(out, path);
+    }
+}
+
 bool file_create(const char *path)
 {
     file_struct newFile;
@@ -46,9 +82,13 @@ char *file_readContents(const char *path)
     char *ret = NULL;
 
     file_struct f;
-    if (file_open(&f, path, "rb") && f.len)
+    if (file_open(&f, path, "rb"))
     {
-        ret = file_read(&f, f.len);
+        // whole file has to fit one buffer
+        if (f.len && f.len <= INT_MAX)
+        {
+            ret = file_read(&f, f.len);
+        }
         file_close(&f);
     }
 
@@ -63,11 +103,10 @@ bool file_writeContents(const char *path, void *buffer, int n)
     }
 
     file_struct f;
-    if (file_open(&f, path, "wb"))
+    if (file_openTemp(&f, path))
     {
         file_write(&f, buffer, n);
-        file_close(&f);
-        return true;
+        return file_commit(&f, path);
     }
     else
     {
@@ -83,12 +122,11 @@ bool file_writeContentBlocks(const char *path, void *buffer, int n, int blkSize)
     }
 
     file_struct f;
-    if (file_open(&f, path, "wb"))
+    if (file_openTemp(&f, path))
     {
         file_setBlockSize(&f, blkSize);
         file_writeBlocks(&f, buffer, n);
-        file_close(&f);
-        return true;
+        return file_commit(&f, path);
     }
     else
     {
@@ -96,33 +134,128 @@ bool file_writeContentBlocks(const char *path, void *buffer, int n, int blkSize)
     }
 }
 
+#ifdef __linux__
+/**
+ * copy inside the kernel, returns the number of bytes copied
+ * so the caller can finish any remainder itself
+ */
+file_off file_copyKernel(int out, int in, file_off n)
+{
+#ifdef FICLONE
+    // share the extents on copy-on-write filesystems
+    if (!ioctl(out, FICLONE, in))
+    {
+        return n;
+    }
+#endif
+
+    file_off copied = 0;
+
+#ifdef SYS_copy_file_range
+    while (copied < n)
+    {
+        long ret = syscall(SYS_copy_file_range, in, NULL, out, NULL, (size_t)(n - copied), 0);
+        if (ret <= 0)
+        {
+            break;
+        }
+        copied += ret;
+    }
+#endif
+
+    // older kernels and cross-filesystem copies
+    while (copied < n)
+    {
+        ssize_t ret = sendfile(out, in, NULL, n - copied);
+        if (ret <= 0)
+        {
+            break;
+        }
+        copied += ret;
+    }
+
+    return copied;
+}
+#endif
+
 bool file_copy(const char *dstPath, const char *srcPath)
 {
-    file_struct dst;
     file_struct src;
-    bool ret = file_open(&dst, dstPath, "wb") &&
-               file_open(&src, srcPath, "rb");
+    if (!file_open(&src, srcPath, "rb"))
+    {
+        return false;
+    }
 
-    if (ret)
+    file_struct dst;
+    if (!file_open(&dst, dstPath, "wb"))
+    {
+        file_close(&src);
+        return false;
+    }
+
+    bool ret = true;
+    file_off cursor = 0;
+
+#ifdef __linux__
+    if (src.fd >= 0 && dst.fd >= 0)
+    {
+        cursor = file_copyKernel(dst.fd, src.fd, src.len);
+    }
+#endif
+
+    if (cursor < src.len)
     {
-        int blkSize = 16;
-        int cursor = 0;
+        // one large chunk at a time, bypassing the windows
+        int bufferLen = (int)MIN(FILE_COPY_BUFFER_LEN, src.len - cursor);
+        char *buffer = malloc(bufferLen);
         while (cursor < src.len)
         {
-            int n = MIN(blkSize, src.len - cursor);
-            char *in = file_read(&src, n);
-            file_write(&dst, in, n);
-            free(in);
+            int n = file_pread(&src, cursor, buffer, bufferLen);
+            if (n <= 0)
+            {
+                ret = false;
+                break;
+            }
+            file_pwrite(&dst, cursor, buffer, n);
             cursor += n;
         }
+        free(buffer);
     }
 
+    ret = file_flush(&dst) && ret;
     file_close(&dst);
     file_close(&src);
 
     return ret;
 }
 
+void file_prefetch(const char *path, int n)
+{
+    file_struct f;
+    if (!file_open(&f, path, "rb"))
+    {
+        return;
+    }
+
+    n = (int)MIN(n, f.len);
+    if (n > 0)
+    {
+#if defined(POSIX_FADV_WILLNEED)
+        if (f.fd >= 0)
+        {
+            // ask the kernel to start reading ahead without waiting for it
+            posix_fadvise(f.fd, 0, n, POSIX_FADV_WILLNEED);
+        }
+#else
+        // pull the range into the cache
+        char *tmp = file_read(&f, n);
+        free(tmp);
+#endif
+    }
+
+    file_close(&f);
+}
+
 bool file_open(file_struct *f, const char *path, const char *mode)
 {
     return file_openBlocks(f, path, mode, 1);
@@ -131,21 +264,41 @@ bool file_open(file_struct *f, const char *path, const char *mode)
 bool file_openBlocks(file_struct *f, const char *path, const char *mode, unsigned int blockSize)
 {
     char fullPath[512];
-    if (defaultPath[0])
-    {
-        sprintf(fullPath, "%s%s%s", defaultPath, PATH_SEPARATOR, path);
-    }
-    else
+    file_fullPath(path, fullPath);
+
+    // translate the stdio mode
+    bool update = strchr(mode, '+') != NULL;
+    int flags = 0;
+    switch (mode[0])
     {
-        strcpy(fullPath, path);
+    case 'w':
+        flags = VFS_WRITE | VFS_CREATE | VFS_TRUNCATE | (update ? VFS_READ : 0);
+        break;
+    case 'a':
+        flags = VFS_WRITE | VFS_CREATE | VFS_APPEND | (update ? VFS_READ : 0);
+        break;
+    default: // 'r'
+        flags = VFS_READ | (update ? VFS_WRITE : 0);
+        break;
     }
 
-    f->fp = fopen(fullPath, mode);
-    if (!f->fp)
+    f->buffer = NULL;
+    f->bufferCap = FILE_BUFFER_LEN;
+    f->bufferPos = 0;
+    f->bufferLen = 0;
+    f->bufferDirty = false;
+    f->writeFailed = false;
+
+    f->vfs = vfs_active();
+    f->handle = f->vfs->open(fullPath, flags);
+    if (!f->handle)
     {
+        f->fd = -1;
         return false;
     }
+    f->fd = f->vfs->descriptor(f->handle);
 
+    f->append = mode[0] == 'a';
     f->cursor = 0;
     f->len = file_length(f);
     f->blockSize = blockSize;
@@ -153,16 +306,60 @@ bool file_openBlocks(file_struct *f, const char *path, const char *mode, unsigne
     return true;
 }
 
-int file_length(file_struct *f)
+bool file_openTemp(file_struct *f, const char *path)
 {
-    // move cursor to the end
-    fseek(f->fp, 0L, SEEK_END);
-    // get remaining length
-    int ret = ftell(f->fp) - f->cursor;
-    // return to original position
-    fseek(f->fp, f->cursor, SEEK_SET);
+    char tmpPath[256];
+    sprintf(tmpPath, "%s%s", path, TEMP_SUFFIX);
 
-    return ret;
+    // readable too, so pages written so far can be read back
+    return file_open(f, tmpPath, "w+b");
+}
+
+/**
+ * replace path with the file from file_openTemp,
+ * readers see either the old or the new contents even after a crash
+ */
+bool file_commit(file_struct *f, const char *path)
+{
+    // contents must be durable before the name points to them
+    bool ret = file_sync(f);
+    file_close(f);
+
+    char fullPath[512];
+    file_fullPath(path, fullPath);
+    char tmpPath[512];
+    sprintf(tmpPath, "%s%s", fullPath, TEMP_SUFFIX);
+
+    if (!ret || !vfs_active()->rename(tmpPath, fullPath))
+    {
+        vfs_active()->remove(tmpPath);
+        return false;
+    }
+
+    return true;
+}
+
+void file_abort(file_struct *f, const char *path)
+{
+    file_close(f);
+
+    char tmpPath[512];
+    file_fullPath(path, tmpPath);
+    strcat(tmpPath, TEMP_SUFFIX);
+    vfs_active()->remove(tmpPath);
+}
+
+file_off file_length(file_struct *f)
+{
+    if (!f->handle)
+    {
+        return 0;
+    }
+
+    // pending writes may extend past the end
+    file_off len = f->vfs->length(f->handle);
+    file_off pending = f->bufferDirty ? f->bufferPos + f->bufferLen : 0;
+    return MAX(len, pending);
 }
 
 void file_setBlockSize(file_struct *f, int size)
@@ -172,15 +369,13 @@ void file_setBlockSize(file_struct *f, int size)
 
 void file_advanceCursor(file_struct *f, int n)
 {
-    n = MIN(n, f->len - f->cursor);
+    n = (int)MIN(n, f->len - f->cursor);
 
-    if (n <= 0 || !f->fp)
+    if (n <= 0 || !f->handle)
     {
         return;
     }
 
-    fseek(f->fp, f->cursor + n, SEEK_SET);
-
     f->cursor += n;
 }
 
@@ -191,15 +386,13 @@ void file_advanceCursorBlocks(file_struct *f, int n)
 
 void file_retreatCursor(file_struct *f, int n)
 {
-    n = MIN(n, f->cursor);
+    n = (int)MIN(n, f->cursor);
 
-    if (n <= 0 || !f->fp)
+    if (n <= 0 || !f->handle)
     {
         return;
     }
 
-    fseek(f->fp, f->cursor - n, SEEK_SET);
-
     f->cursor -= n;
 }
 
@@ -208,18 +401,133 @@ void file_retreatCursorBlocks(file_struct *f, int n)
     file_retreatCursor(f, f->blockSize ? n * f->blockSize : n);
 }
 
+bool file_allocBuffer(file_struct *f)
+{
+    if (!f->buffer && f->bufferCap)
+    {
+        f->buffer = malloc(f->bufferCap);
+    }
+
+    return f->buffer != NULL;
+}
+
+/**
+ * read through the window, refilling it from pos when it misses;
+ * reads at least as long as the window go straight to the descriptor
+ */
+int file_readAt(file_struct *f, file_off pos, unsigned char *out, int n)
+{
+    if (f->bufferDirty)
+    {
+        file_flush(f);
+    }
+
+    int done = 0;
+    while (done < n)
+    {
+        file_off cur = pos + done;
+        if (f->bufferLen && cur >= f->bufferPos && cur < f->bufferPos + f->bufferLen)
+        {
+            int k = (int)MIN(n - done, f->bufferPos + f->bufferLen - cur);
+            memcpy(out + done, f->buffer + (cur - f->bufferPos), k);
+            done += k;
+            continue;
+        }
+
+        if (n - done >= f->bufferCap || !file_allocBuffer(f))
+        {
+            int ret = f->vfs->read(f->handle, out + done, n - done, cur);
+            if (ret <= 0)
+            {
+                break;
+            }
+            done += ret;
+            continue;
+        }
+
+        int ret = f->vfs->read(f->handle, f->buffer, f->bufferCap, cur);
+        if (ret <= 0)
+        {
+            f->bufferLen = 0;
+            break;
+        }
+        f->bufferPos = cur;
+        f->bufferLen = ret;
+    }
+
+    return done;
+}
+
+/**
+ * contiguous writes collect in the window until it fills,
+ * anything else flushes it first
+ */
+void file_writeAt(file_struct *f, file_off pos, const unsigned char *in, int n)
+{
+    if (f->bufferDirty &&
+        pos == f->bufferPos + f->bufferLen &&
+        f->bufferLen + n <= f->bufferCap)
+    {
+        memcpy(f->buffer + f->bufferLen, in, n);
+        f->bufferLen += n;
+        return;
+    }
+
+    file_flush(f);
+
+    if (n >= f->bufferCap || !file_allocBuffer(f))
+    {
+        if (f->vfs->write(f->handle, in, n, pos) != n)
+        {
+            f->writeFailed = true;
+        }
+        return;
+    }
+
+    memcpy(f->buffer, in, n);
+    f->bufferPos = pos;
+    f->bufferLen = n;
+    f->bufferDirty = true;
+}
+
+int file_readInto(file_struct *f, void *out, int n)
+{
+    n = (int)MIN(n, f->len - f->cursor);
+
+    if (n <= 0 || !f->handle)
+    {
+        return 0;
+    }
+
+    n = file_readAt(f, f->cursor, out, n);
+    f->cursor += n;
+
+    return n;
+}
+
+int file_pread(file_struct *f, file_off pos, void *out, int n)
+{
+    n = (int)MIN(n, f->len - pos);
+
+    if (n <= 0 || !f->handle)
+    {
+        return 0;
+    }
+
+    return file_readAt(f, pos, out, n);
+}
+
 char *file_read(file_struct *f, int n)
 {
-    n = MIN(n, f->len - f->cursor);
+    n = (int)MIN(n, f->len - f->cursor);
 
-    if (n <= 0 || !f->fp)
+    if (n <= 0 || !f->handle)
     {
         return NULL;
     }
 
     char *ret = malloc(n + 1);
-    fread(ret, 1, n, f->fp);
-    f->cursor += n;
+    n = file_readInto(f, ret, n);
 
     ret[n] = '\0';
 
@@ -233,38 +541,368 @@ char *file_readBlocks(file_struct *f, int n)
 
 void file_write(file_struct *f, void *buffer, int n)
 {
-    if (n <= 0 || !f->fp)
+    if (n <= 0 || !f->handle)
     {
         return;
     }
 
-    fwrite(buffer, 1, n, f->fp);
+    if (f->append)
+    {
+        // appends always land at the end
+        f->cursor = f->len;
+    }
+
+    file_writeAt(f, f->cursor, buffer, n);
     f->cursor += n;
+    f->len = MAX(f->len, f->cursor);
 }
 
 void file_writeBlocks(file_struct *f, void *buffer, int noBlocks)
 {
-    if (noBlocks <= 0 || !f->fp)
+    file_write(f, buffer, (f->blockSize ? f->blockSize : 1) * noBlocks);
+}
+
+void file_pwrite(file_struct *f, file_off pos, void *buffer, int n)
+{
+    if (n <= 0 || !f->handle)
     {
         return;
     }
 
-    int n = (f->blockSize ? f->blockSize : 1) * noBlocks;
-    fwrite(buffer, f->blockSize ? f->blockSize : 1, noBlocks, f->fp);
-    f->cursor += n;
+    file_writeAt(f, pos, buffer, n);
+    f->len = MAX(f->len, pos + n);
+}
+
+#ifdef DV_URING
+/**
+ * submit the batch to the ring FILE_BATCH_LEN requests at a time
+ * and wait for the whole submission, requests left with ret < 0 did not run
+ */
+void file_ringBatch(int fd, file_request *reqs, int n)
+{
+    thread_lock(&fileRingLock);
+
+    if (!fileRingState)
+    {
+        fileRingState = uring_init(&fileRing, FILE_BATCH_LEN) ? 1 : -1;
+    }
+
+    int i = 0;
+    while (fileRingState > 0 && i < n)
+    {
+        int k = 0;
+        while (i + k < n &&
+               uring_prep(&fileRing, IORING_OP_WRITE,
+                          fd, reqs[i + k].buffer, reqs[i + k].n, reqs[i + k].pos, i + k))
+        {
+            k++;
+        }
+
+        int reaped = 0;
+        int ret = uring_submit(&fileRing, k);
+        while (ret >= 0 && reaped < k)
+        {
+            uint64_t data;
+            int res;
+            if (uring_reap(&fileRing, &data, &res))
+            {
+                reqs[data].ret = res;
+                reaped++;
+            }
+            else
+            {
+                ret = uring_submit(&fileRing, k - reaped);
+            }
+        }
+
+        if (ret < 0)
+        {
+            // ring is in an unknown state, everything else blocks
+            uring_free(&fileRing);
+            fileRingState = -1;
+        }
+
+        i += k;
+    }
+
+    thread_unlock(&fileRingLock);
+}
+#endif
+
+/**
+ * write every request of the batch, through io_uring where the kernel has it
+ * and with blocking positional calls otherwise
+ */
+int file_pwriteBatch(file_struct *f, file_request *reqs, int n)
+{
+    if (!f->handle)
+    {
+        return 0;
+    }
+
+    // the window must not shadow the batch
+    file_flush(f);
+
+    for (int i = 0; i < n; i++)
+    {
+        reqs[i].ret = -1;
+    }
+
+#ifdef DV_URING
+    if (f->fd >= 0)
+    {
+        file_ringBatch(f->fd, reqs, n);
+    }
+#endif
+
+    int noComplete = 0;
+    for (int i = 0; i < n; i++)
+    {
+        file_request *r = reqs + i;
+        r->ret = MAX(r->ret, 0);
+
+        if (r->ret < r->n)
+        {
+            // not submitted, failed or short, finish it here
+            int ret = f->vfs->write(f->handle, (unsigned char *)r->buffer + r->ret, r->n - r->ret, r->pos + r->ret);
+            if (ret > 0)
+            {
+                r->ret += ret;
+            }
+        }
+
+        if (r->ret == r->n)
+        {
+            noComplete++;
+            f->len = MAX(f->len, r->pos + r->n);
+        }
+        else
+        {
+            f->writeFailed = true;
+        }
+    }
+
+    return noComplete;
+}
+
+bool file_flush(file_struct *f)
+{
+    bool ret = true;
+
+    if (f->bufferDirty)
+    {
+        ret = f->vfs->write(f->handle, f->buffer, f->bufferLen, f->bufferPos) == f->bufferLen;
+        f->writeFailed = f->writeFailed || !ret;
+        f->bufferDirty = false;
+    }
+
+    // the window no longer matches the file
+    f->bufferLen = 0;
+
+    return ret;
+}
+
+bool file_sync(file_struct *f)
+{
+    // an earlier write that failed is not made good by syncing the rest
+    if (!f->handle || !file_flush(f) || f->writeFailed)
+    {
+        return false;
+    }
+
+    // push the written data through to the device
+    return f->vfs->sync(f->handle);
+}
+
+bool file_truncate(file_struct *f, file_off len)
+{
+    if (!f->handle || !file_flush(f))
+    {
+        return false;
+    }
+
+    bool ret = f->vfs->truncate(f->handle, len);
+
+    if (ret)
+    {
+        f->len = len;
+        f->cursor = MIN(f->cursor, len);
+    }
+
+    return ret;
 }
 
 void file_close(file_struct *f)
 {
-    if (f->fp)
+    if (f->handle)
     {
-        fclose(f->fp);
-        f->fp = NULL;
+        file_flush(f);
+        f->vfs->close(f->handle);
+        f->handle = NULL;
+        f->fd = -1;
     }
+
+    if (f->buffer)
+    {
+        free(f->buffer);
+        f->buffer = NULL;
+    }
+}
+
+bool file_map(file_mapping *m, const char *path, unsigned int blockSize, bool writable)
+{
+    m->data = NULL;
+    m->len = 0;
+    m->blockSize = blockSize;
+    m->writable = writable;
+    m->copied = false;
+    m->handle = NULL;
+
+    file_struct f;
+    if (!file_open(&f, path, "rb"))
+    {
+        return false;
+    }
+
+    if (!f.len)
+    {
+        // nothing to map
+        file_close(&f);
+        return true;
+    }
+
+    if (f.fd < 0)
+    {
+        // backend has nothing to map, work on a copy
+        m->data = f.len <= INT_MAX ? (unsigned char *)file_read(&f, f.len) : NULL;
+        m->len = f.len;
+        m->copied = true;
+        file_close(&f);
+
+        return m->data != NULL;
+    }
+
+#ifdef DV_WINDOWS
+    HANDLE mapping = CreateFileMappingA((HANDLE)_get_osfhandle(f.fd), NULL,
+                                        writable ? PAGE_WRITECOPY : PAGE_READONLY,
+                                        0, 0, NULL);
+    if (mapping)
+    {
+        m->data = MapViewOfFile(mapping, writable ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+        m->handle = mapping;
+    }
+#else
+    // the whole file has to fit the address space
+    void *data = (size_t)f.len != f.len
+        ? MAP_FAILED
+        : mmap(NULL, f.len,
+               writable ? PROT_READ | PROT_WRITE : PROT_READ,
+               writable ? MAP_PRIVATE : MAP_SHARED,
+               f.fd, 0);
+    m->data = data == MAP_FAILED ? NULL : data;
+#endif
+
+    // the mapping stays valid once the descriptor is closed
+    m->len = f.len;
+    file_close(&f);
+
+    if (!m->data)
+    {
+        file_unmap(m);
+        return false;
+    }
+
+    return true;
+}
+
+unsigned char *file_mapBlocks(file_mapping *m, file_off blk, int n)
+{
+    file_off pos = m->blockSize ? blk * m->blockSize : blk;
+    file_off len = m->blockSize ? (file_off)n * m->blockSize : n;
+
+    if (!m->data || pos < 0 || pos + len > m->len)
+    {
+        return NULL;
+    }
+
+    return m->data + pos;
+}
+
+void file_mapWillNeed(file_mapping *m, file_off pos, file_off n)
+{
+#if !defined(DV_WINDOWS) && defined(MADV_WILLNEED)
+    if (!m->data || m->copied || pos >= m->len)
+    {
+        return;
+    }
+
+    // madvise needs a page aligned start
+    long pageSize = sysconf(_SC_PAGESIZE);
+    file_off start = pos - pos % pageSize;
+    n = MIN(n + (pos - start), m->len - start);
+    madvise(m->data + start, n, MADV_WILLNEED);
+#endif
+}
+
+void file_unmap(file_mapping *m)
+{
+    if (m->copied)
+    {
+        conditionalFree(m->data, free);
+    }
+#ifdef DV_WINDOWS
+    else if (m->data)
+    {
+        UnmapViewOfFile(m->data);
+    }
+    if (m->handle)
+    {
+        CloseHandle((HANDLE)m->handle);
+    }
+#else
+    else if (m->data)
+    {
+        munmap(m->data, m->len);
+    }
+#endif
+
+    m->data = NULL;
+    m->handle = NULL;
+    m->len = 0;
+}
+
+bool file_remove(const char *path)
+{
+    char fullPath[512];
+    file_fullPath(path, fullPath);
+
+    return vfs_active()->remove(fullPath);
+}
+
+/**
+ * give a file another name, replacing any file already there
+ */
+bool file_rename(const char *from, const char *to)
+{
+    char fromPath[512];
+    file_fullPath(from, fromPath);
+    char toPath[512];
+    file_fullPath(to, toPath);
+
+    return vfs_active()->rename(fromPath, toPath);
+}
+
+int file_list(void (*callback)(const char *name, void *arg), void *arg)
+{
+    return vfs_active()->list(defaultPath[0] ? defaultPath : ".", callback, arg);
 }
 
 bool directoryExists(const char *path)
 {
-    struct stat sb;
-    return stat(path, &sb) == 0 && S_ISDIR(sb.st_mode);
+    return vfs_active()->isDirectory(path);
+}
+
+bool directoryCreate(const char *path)
+{
+    return vfs_active()->makeDirectory(path);
 }
@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <stdint.h>
+
+#include "vfs.h"
 
 #include "../ds/strstream.h"
 #include "../cmathematics/cmathematics.h"
@@ -12,26 +15,76 @@
     #define PATH_SEPARATOR "/"
 #endif
 
+// suffix of the file written by file_openTemp before it replaces the original
+#define TEMP_SUFFIX ".tmp"
+
+// chunk size when file_copy has to go through user space
+#define FILE_COPY_BUFFER_LEN (1 << 20)
+
+// read-ahead/write-behind window of each file
+#define FILE_BUFFER_LEN (16 << 10)
+
+// most requests handed to the kernel in one batch submission
+#define FILE_BATCH_LEN 64
+
 typedef struct
 {
-    FILE *fp;
+    const vfs_struct *vfs;
+    void *handle; // NULL once closed
+    int fd;       // native descriptor behind the handle, -1 if the backend has none
+    bool append;
 
-    int cursor;
-    int len;
+    file_off cursor;
+    file_off len;
     int blockSize;
+
+    // window over [bufferPos, bufferPos + bufferLen), read ahead or pending write
+    unsigned char *buffer;
+    int bufferCap;
+    file_off bufferPos;
+    int bufferLen;
+    bool bufferDirty;
+
+    bool writeFailed; // a write since the file was opened came up short, syncing it fails
 } file_struct;
 
+// one positional write in a batch
+typedef struct
+{
+    file_off pos;
+    void *buffer;
+    int n;
+    int ret; // bytes written, negative on error
+} file_request;
+
+// whole file mapped into memory, blocks are read as pointers into it
+typedef struct
+{
+    unsigned char *data;
+    file_off len;
+    int blockSize;
+    bool writable; // private copy-on-write pages, changes never reach the file
+    bool copied;   // backend cannot map, data is a heap copy
+
+    void *handle; // mapping object on Windows
+} file_mapping;
+
 void file_setDefaultPath(char *path);
+void file_fullPath(const char *path, char *out);
 
 bool file_create(const char *path);
 char *file_readContents(const char *path);
 bool file_writeContents(const char *path, void *buffer, int n);
 bool file_writeContentBlocks(const char *path, void *buffer, int n, int blkSize);
 bool file_copy(const char *dstPath, const char *srcPath);
+void file_prefetch(const char *path, int n);
 
 bool file_open(file_struct *f, const char *path, const char *mode);
 bool file_openBlocks(file_struct *f, const char *path, const char *mode, unsigned int blockSize);
-int file_length(file_struct *f);
+bool file_openTemp(file_struct *f, const char *path);
+bool file_commit(file_struct *f, const char *path);
+void file_abort(file_struct *f, const char *path);
+file_off file_length(file_struct *f);
 void file_setBlockSize(file_struct *f, int size);
 
 void file_advanceCursor(file_struct *f, int n);
@@ -42,12 +95,31 @@ void file_retreatCursorBlocks(file_struct *f, int n);
 
 char *file_read(file_struct *f, int n);
 char *file_readBlocks(file_struct *f, int n);
+int file_readInto(file_struct *f, void *out, int n);
+int file_pread(file_struct *f, file_off pos, void *out, int n);
 
 void file_write(file_struct *f, void *buffer, int n);
 void file_writeBlocks(file_struct *f, void *buffer, int noBlocks);
+void file_pwrite(file_struct *f, file_off pos, void *buffer, int n);
+
+int file_pwriteBatch(file_struct *f, file_request *reqs, int n);
+
+bool file_flush(file_struct *f);
+bool file_sync(file_struct *f);
+bool file_truncate(file_struct *f, file_off len);
 
 void file_close(file_struct *f);
 
+bool file_map(file_mapping *m, const char *path, unsigned int blockSize, bool writable);
+unsigned char *file_mapBlocks(file_mapping *m, file_off blk, int n);
+void file_mapWillNeed(file_mapping *m, file_off pos, file_off n);
+void file_unmap(file_mapping *m);
+
+bool file_remove(const char *path);
+bool file_rename(const char *from, const char *to);
+int file_list(void (*callback)(const char *name, void *arg), void *arg);
+
 bool directoryExists(const char *absolutePath);
+bool directoryCreate(const char *absolutePath);
 
-#endif // FILEIO_H
\ No newline at end of file
+#endif // FILEIO_H
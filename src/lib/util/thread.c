@@ -0,0 +1,72 @@
+#include "thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef DV_WINDOWS
+static DWORD WINAPI thread_entry(LPVOID param)
+#else
+static void *thread_entry(void *param)
+#endif
+{
+    thread_struct *t = (thread_struct *)param;
+    t->func(t->arg);
+
+    return 0;
+}
+
+bool thread_start(thread_struct *t, void (*func)(void *arg), void *arg)
+{
+    t->func = func;
+    t->arg = arg;
+
+#ifdef DV_WINDOWS
+    t->handle = CreateThread(NULL, 0, thread_entry, t, 0, NULL);
+    t->running = t->handle != NULL;
+#else
+    t->running = !pthread_create(&t->handle, NULL, thread_entry, t);
+#endif
+
+    if (!t->running)
+    {
+        // could not spawn, run on the calling thread instead
+        func(arg);
+    }
+
+    return t->running;
+}
+
+void thread_join(thread_struct *t)
+{
+    if (!t->running)
+    {
+        return;
+    }
+
+#ifdef DV_WINDOWS
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+#else
+    pthread_join(t->handle, NULL);
+#endif
+
+    t->running = false;
+}
+
+void thread_lock(thread_mutex *m)
+{
+#ifdef DV_WINDOWS
+    AcquireSRWLockExclusive(m);
+#else
+    pthread_mutex_lock(m);
+#endif
+}
+
+void thread_unlock(thread_mutex *m)
+{
+#ifdef DV_WINDOWS
+    ReleaseSRWLockExclusive(m);
+#else
+    pthread_mutex_unlock(m);
+#endif
+}
@@ -0,0 +1,33 @@
+#include "../../datavault.h"
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#ifdef DV_WINDOWS
+    #include <windows.h>
+    typedef HANDLE thread_handle;
+    typedef SRWLOCK thread_mutex;
+    #define THREAD_MUTEX_INIT SRWLOCK_INIT
+#else
+    #include <pthread.h>
+    typedef pthread_t thread_handle;
+    typedef pthread_mutex_t thread_mutex;
+    #define THREAD_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#endif
+
+typedef struct
+{
+    thread_handle handle;
+    bool running;
+
+    void (*func)(void *arg);
+    void *arg;
+} thread_struct;
+
+bool thread_start(thread_struct *t, void (*func)(void *arg), void *arg);
+void thread_join(thread_struct *t);
+
+void thread_lock(thread_mutex *m);
+void thread_unlock(thread_mutex *m);
+
+#endif // THREAD_H
@@ -0,0 +1,26 @@
+#include "timing.h"
+
+#ifdef DV_WINDOWS
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif
+
+double timing_now()
+{
+#ifdef DV_WINDOWS
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart * 1000.0 / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+#endif
+}
+
+double timing_since(double start)
+{
+    return timing_now() - start;
+}
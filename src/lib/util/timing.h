@@ -0,0 +1,12 @@
+#include "../../datavault.h"
+
+#ifndef TIMING_H
+#define TIMING_H
+
+// monotonic wall clock time in milliseconds
+double timing_now();
+
+// milliseconds elapsed since a previous timing_now()
+double timing_since(double start);
+
+#endif // TIMING_H
@@ -0,0 +1,199 @@
+#include "uring.h"
+
+#ifdef DV_URING
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+int uring_enter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+bool uring_init(uring_struct *u, unsigned int entries)
+{
+    memset(u, 0, sizeof(uring_struct));
+    u->fd = -1;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = uring_setup(entries, &p);
+    if (fd < 0)
+    {
+        // old kernel or blocked by a sandbox
+        return false;
+    }
+
+    u->fd = fd;
+    u->entries = p.sq_entries;
+    u->sqRingLen = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cqRingLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        // both rings live in one region
+        u->sqRingLen = u->cqRingLen = MAX(u->sqRingLen, u->cqRingLen);
+    }
+
+    u->sqRing = mmap(NULL, u->sqRingLen, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (u->sqRing == MAP_FAILED)
+    {
+        u->sqRing = NULL;
+        uring_free(u);
+        return false;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        u->cqRing = u->sqRing;
+    }
+    else
+    {
+        u->cqRing = mmap(NULL, u->cqRingLen, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (u->cqRing == MAP_FAILED)
+        {
+            u->cqRing = NULL;
+            uring_free(u);
+            return false;
+        }
+    }
+
+    u->sqes = mmap(NULL, u->sqesLen, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+    {
+        u->sqes = NULL;
+        uring_free(u);
+        return false;
+    }
+
+    unsigned char *sq = u->sqRing;
+    u->sqHead = (unsigned int *)(sq + p.sq_off.head);
+    u->sqTail = (unsigned int *)(sq + p.sq_off.tail);
+    u->sqMask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    u->sqArray = (unsigned int *)(sq + p.sq_off.array);
+
+    unsigned char *cq = u->cqRing;
+    u->cqHead = (unsigned int *)(cq + p.cq_off.head);
+    u->cqTail = (unsigned int *)(cq + p.cq_off.tail);
+    u->cqMask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return true;
+}
+
+/**
+ * queue a read or write at pos, nothing reaches the kernel until uring_submit
+ */
+bool uring_prep(uring_struct *u, int op, int fd, void *buffer, unsigned int n, int64_t pos, uint64_t data)
+{
+    unsigned int tail = *u->sqTail;
+    if (tail - __atomic_load_n(u->sqHead, __ATOMIC_ACQUIRE) >= u->entries)
+    {
+        // ring is full
+        return false;
+    }
+
+    unsigned int idx = tail & *u->sqMask;
+    struct io_uring_sqe *sqe = u->sqes + idx;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer;
+    sqe->len = n;
+    sqe->off = (uint64_t)pos;
+    sqe->user_data = data;
+
+    u->sqArray[idx] = idx;
+    // entry must be visible before the kernel sees the new tail
+    __atomic_store_n(u->sqTail, tail + 1, __ATOMIC_RELEASE);
+    u->sqPending++;
+
+    return true;
+}
+
+/**
+ * hand every queued entry to the kernel in one call
+ * and block until waitFor completions are ready
+ */
+int uring_submit(uring_struct *u, unsigned int waitFor)
+{
+    int submitted = 0;
+    while (u->sqPending || waitFor)
+    {
+        int ret = uring_enter(u->fd, u->sqPending, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        submitted += ret;
+        u->sqPending -= MIN((unsigned int)ret, u->sqPending);
+        if (!u->sqPending)
+        {
+            break;
+        }
+    }
+
+    return submitted;
+}
+
+/**
+ * take one completion off the ring if there is one
+ */
+bool uring_reap(uring_struct *u, uint64_t *data, int *res)
+{
+    unsigned int head = *u->cqHead;
+    if (head == __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+
+    struct io_uring_cqe *cqe = u->cqes + (head & *u->cqMask);
+    *data = cqe->user_data;
+    *res = cqe->res;
+
+    __atomic_store_n(u->cqHead, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+void uring_free(uring_struct *u)
+{
+    if (u->sqes)
+    {
+        munmap(u->sqes, u->sqesLen);
+    }
+    if (u->cqRing && u->cqRing != u->sqRing)
+    {
+        munmap(u->cqRing, u->cqRingLen);
+    }
+    if (u->sqRing)
+    {
+        munmap(u->sqRing, u->sqRingLen);
+    }
+    if (u->fd >= 0)
+    {
+        close(u->fd);
+    }
+
+    memset(u, 0, sizeof(uring_struct));
+    u->fd = -1;
+}
+
+#endif // DV_URING
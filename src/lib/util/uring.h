@@ -0,0 +1,57 @@
+#include "../../datavault.h"
+
+#include <stdint.h>
+
+#ifndef URING_H
+#define URING_H
+
+#ifdef __linux__
+    #include <linux/io_uring.h>
+    #include <sys/syscall.h>
+    #ifdef __NR_io_uring_setup
+        #define DV_URING
+    #endif
+#endif
+
+#ifdef DV_URING
+
+/**
+ * submission and completion rings shared with the kernel,
+ * set up with raw system calls so there is no library dependency
+ */
+typedef struct
+{
+    int fd;
+    unsigned int entries;
+
+    // submission queue
+    unsigned int *sqHead;
+    unsigned int *sqTail;
+    unsigned int *sqMask;
+    unsigned int *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned int sqPending;
+
+    // completion queue
+    unsigned int *cqHead;
+    unsigned int *cqTail;
+    unsigned int *cqMask;
+    struct io_uring_cqe *cqes;
+
+    // mapped regions
+    void *sqRing;
+    size_t sqRingLen;
+    void *cqRing;
+    size_t cqRingLen;
+    size_t sqesLen;
+} uring_struct;
+
+bool uring_init(uring_struct *u, unsigned int entries);
+bool uring_prep(uring_struct *u, int op, int fd, void *buffer, unsigned int n, int64_t pos, uint64_t data);
+int uring_submit(uring_struct *u, unsigned int waitFor);
+bool uring_reap(uring_struct *u, uint64_t *data, int *res);
+void uring_free(uring_struct *u);
+
+#endif // DV_URING
+
+#endif // URING_H
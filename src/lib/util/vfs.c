@@ -0,0 +1,835 @@
+#include "vfs.h"
+#include "fileio.h"
+#include "thread.h"
+#include "mem.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef DV_WINDOWS
+    #include <io.h>
+    #include <direct.h>
+    #include <windows.h>
+#else
+    #include <unistd.h>
+    #include <dirent.h>
+    #include <sys/mman.h>
+#endif
+
+#ifdef DV_WINDOWS
+    #define O_BINARY_FLAG _O_BINARY
+#else
+    #define O_BINARY_FLAG 0
+#endif
+
+// mappings grow in steps of this many bytes
+#define VFS_MMAP_GROW (1 << 20)
+
+const vfs_struct *activeBackend = &vfs_disk;
+
+const vfs_struct *vfs_find(const char *name)
+{
+    const vfs_struct *backends[] = { &vfs_disk, &vfs_mmap, &vfs_memory };
+
+    for (int i = 0; name && i < 3; i++)
+    {
+        if (!strcmp(name, backends[i]->name))
+        {
+            return backends[i];
+        }
+    }
+
+    return NULL;
+}
+
+void vfs_use(const vfs_struct *backend)
+{
+    activeBackend = backend ? backend : &vfs_disk;
+}
+
+const vfs_struct *vfs_active()
+{
+    return activeBackend;
+}
+
+/*
+    disk
+*/
+
+typedef struct
+{
+    int fd;
+} vfs_diskFile;
+
+int vfs_diskFlags(int flags)
+{
+    int ret = O_BINARY_FLAG;
+
+    if (flags & VFS_WRITE)
+    {
+        ret |= flags & VFS_READ ? O_RDWR : O_WRONLY;
+    }
+    else
+    {
+        ret |= O_RDONLY;
+    }
+
+    if (flags & VFS_CREATE)
+    {
+        ret |= O_CREAT;
+    }
+    if (flags & VFS_TRUNCATE)
+    {
+        ret |= O_TRUNC;
+    }
+    if (flags & VFS_APPEND)
+    {
+        ret |= O_APPEND;
+    }
+
+    return ret;
+}
+
+int vfs_diskOpenDescriptor(const char *path, int flags)
+{
+#ifdef DV_WINDOWS
+    return _open(path, vfs_diskFlags(flags), _S_IREAD | _S_IWRITE);
+#else
+    return open(path, vfs_diskFlags(flags), 0600);
+#endif
+}
+
+void *vfs_diskOpen(const char *path, int flags)
+{
+    int fd = vfs_diskOpenDescriptor(path, flags);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    vfs_diskFile *h = malloc(sizeof(vfs_diskFile));
+    h->fd = fd;
+
+    return h;
+}
+
+/**
+ * positional reads and writes, these do not move a shared offset
+ * except on Windows where each handle owns its descriptor
+ */
+int vfs_diskRead(void *h, void *out, int n, file_off pos)
+{
+    int fd = ((vfs_diskFile *)h)->fd;
+#ifdef DV_WINDOWS
+    if (_lseeki64(fd, pos, SEEK_SET) < 0)
+    {
+        return -1;
+    }
+    return _read(fd, out, n);
+#else
+    return pread(fd, out, n, pos);
+#endif
+}
+
+int vfs_diskWrite(void *h, const void *in, int n, file_off pos)
+{
+    int fd = ((vfs_diskFile *)h)->fd;
+
+    int done = 0;
+    while (done < n)
+    {
+#ifdef DV_WINDOWS
+        int ret = _lseeki64(fd, pos + done, SEEK_SET) < 0
+            ? -1
+            : _write(fd, (const char *)in + done, n - done);
+#else
+        int ret = pwrite(fd, (const char *)in + done, n - done, pos + done);
+#endif
+        if (ret <= 0)
+        {
+            return -1;
+        }
+        done += ret;
+    }
+
+    return done;
+}
+
+file_off vfs_diskLength(void *h)
+{
+    // one stat instead of seeking to the end and back
+#ifdef DV_WINDOWS
+    struct _stati64 sb;
+    if (_fstati64(((vfs_diskFile *)h)->fd, &sb))
+#else
+    struct stat sb;
+    if (fstat(((vfs_diskFile *)h)->fd, &sb))
+#endif
+    {
+        return 0;
+    }
+
+    return sb.st_size;
+}
+
+bool vfs_diskTruncate(void *h, file_off len)
+{
+#ifdef DV_WINDOWS
+    return !_chsize_s(((vfs_diskFile *)h)->fd, len);
+#else
+    return !ftruncate(((vfs_diskFile *)h)->fd, len);
+#endif
+}
+
+bool vfs_diskSync(void *h)
+{
+    // push the written data through to the device
+#ifdef DV_WINDOWS
+    return !_commit(((vfs_diskFile *)h)->fd);
+#else
+    return !fsync(((vfs_diskFile *)h)->fd);
+#endif
+}
+
+void vfs_diskClose(void *h)
+{
+#ifdef DV_WINDOWS
+    _close(((vfs_diskFile *)h)->fd);
+#else
+    close(((vfs_diskFile *)h)->fd);
+#endif
+    free(h);
+}
+
+int vfs_diskDescriptor(void *h)
+{
+    return ((vfs_diskFile *)h)->fd;
+}
+
+bool vfs_diskRename(const char *from, const char *to)
+{
+#ifdef DV_WINDOWS
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    if (rename(from, to))
+    {
+        return false;
+    }
+
+    // persist the directory entry
+    char dirPath[512];
+    strcpy(dirPath, to);
+    char *sep = strrchr(dirPath, PATH_SEPARATOR[0]);
+    if (sep)
+    {
+        *sep = '\0';
+    }
+    else
+    {
+        strcpy(dirPath, ".");
+    }
+
+    int dir = open(sep && !dirPath[0] ? PATH_SEPARATOR : dirPath, O_RDONLY);
+    if (dir >= 0)
+    {
+        fsync(dir);
+        close(dir);
+    }
+
+    return true;
+#endif
+}
+
+bool vfs_diskRemove(const char *path)
+{
+    return !remove(path);
+}
+
+bool vfs_diskMakeDirectory(const char *path)
+{
+#ifdef DV_WINDOWS
+    return !_mkdir(path);
+#else
+    return !mkdir(path, 0700);
+#endif
+}
+
+bool vfs_diskIsDirectory(const char *path)
+{
+    struct stat sb;
+    return stat(path, &sb) == 0 && S_ISDIR(sb.st_mode);
+}
+
+int vfs_diskList(const char *dir, void (*callback)(const char *name, void *arg), void *arg)
+{
+    int n = 0;
+
+#ifdef DV_WINDOWS
+    char pattern[512];
+    sprintf(pattern, "%s%s*", dir, PATH_SEPARATOR);
+
+    WIN32_FIND_DATAA entry;
+    HANDLE search = FindFirstFileA(pattern, &entry);
+    if (search == INVALID_HANDLE_VALUE)
+    {
+        return 0;
+    }
+
+    do
+    {
+        if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+        {
+            callback(entry.cFileName, arg);
+            n++;
+        }
+    } while (FindNextFileA(search, &entry));
+    FindClose(search);
+#else
+    DIR *d = opendir(dir);
+    if (!d)
+    {
+        return 0;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(d)))
+    {
+        if (entry->d_name[0] != '.')
+        {
+            callback(entry->d_name, arg);
+            n++;
+        }
+    }
+    closedir(d);
+#endif
+
+    return n;
+}
+
+const vfs_struct vfs_disk = {
+    "disk",
+    vfs_diskOpen,
+    vfs_diskRead,
+    vfs_diskWrite,
+    vfs_diskLength,
+    vfs_diskTruncate,
+    vfs_diskSync,
+    vfs_diskClose,
+    vfs_diskDescriptor,
+    vfs_diskRename,
+    vfs_diskRemove,
+    vfs_diskMakeDirectory,
+    vfs_diskIsDirectory,
+    vfs_diskList
+};
+
+/*
+    mmap
+*/
+
+#ifdef DV_WINDOWS
+
+// views cannot grow in place on Windows, go through the descriptor
+const vfs_struct vfs_mmap = {
+    "mmap",
+    vfs_diskOpen,
+    vfs_diskRead,
+    vfs_diskWrite,
+    vfs_diskLength,
+    vfs_diskTruncate,
+    vfs_diskSync,
+    vfs_diskClose,
+    vfs_diskDescriptor,
+    vfs_diskRename,
+    vfs_diskRemove,
+    vfs_diskMakeDirectory,
+    vfs_diskIsDirectory,
+    vfs_diskList
+};
+
+#else
+
+typedef struct
+{
+    int fd;
+    bool writable;
+
+    unsigned char *data;
+    file_off len;
+    file_off cap; // bytes mapped, may run past the end of the file
+} vfs_mmapFile;
+
+/**
+ * make the mapping cover len bytes, growing it in VFS_MMAP_GROW steps
+ */
+bool vfs_mmapResize(vfs_mmapFile *h, file_off len)
+{
+    if (len > h->cap)
+    {
+        file_off cap = (len + VFS_MMAP_GROW - 1) / VFS_MMAP_GROW * VFS_MMAP_GROW;
+        if (h->data)
+        {
+            munmap(h->data, h->cap);
+        }
+
+        void *data = mmap(NULL, cap,
+                          h->writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                          MAP_SHARED, h->fd, 0);
+        if (data == MAP_FAILED)
+        {
+            h->data = NULL;
+            h->cap = 0;
+            h->len = 0;
+            return false;
+        }
+        h->data = data;
+        h->cap = cap;
+    }
+
+    h->len = len;
+    return true;
+}
+
+/**
+ * pick up changes made through the descriptor
+ */
+bool vfs_mmapRefresh(vfs_mmapFile *h)
+{
+    struct stat sb;
+    if (fstat(h->fd, &sb))
+    {
+        return false;
+    }
+
+    return vfs_mmapResize(h, sb.st_size);
+}
+
+void *vfs_mmapOpen(const char *path, int flags)
+{
+    // shared writable pages need a descriptor that can also read
+    int fd = vfs_diskOpenDescriptor(path, flags & VFS_WRITE ? (flags | VFS_READ) & ~VFS_APPEND : flags);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    vfs_mmapFile *h = malloc(sizeof(vfs_mmapFile));
+    h->fd = fd;
+    h->writable = flags & VFS_WRITE;
+    h->data = NULL;
+    h->len = 0;
+    h->cap = 0;
+
+    if (!vfs_mmapRefresh(h))
+    {
+        close(fd);
+        free(h);
+        return NULL;
+    }
+
+    return h;
+}
+
+int vfs_mmapRead(void *handle, void *out, int n, file_off pos)
+{
+    vfs_mmapFile *h = handle;
+    if (pos + n > h->len && !vfs_mmapRefresh(h))
+    {
+        return -1;
+    }
+
+    n = (int)MIN(n, h->len - pos);
+    if (n <= 0)
+    {
+        return 0;
+    }
+
+    memcpy(out, h->data + pos, n);
+    return n;
+}
+
+int vfs_mmapWrite(void *handle, const void *in, int n, file_off pos)
+{
+    vfs_mmapFile *h = handle;
+    if (!h->writable)
+    {
+        return -1;
+    }
+
+    if (pos + n > h->len)
+    {
+        // extend the file first, pages past the end cannot be touched
+        if (ftruncate(h->fd, pos + n) || !vfs_mmapResize(h, pos + n))
+        {
+            return -1;
+        }
+    }
+
+    memcpy(h->data + pos, in, n);
+    return n;
+}
+
+file_off vfs_mmapLength(void *handle)
+{
+    vfs_mmapFile *h = handle;
+    vfs_mmapRefresh(h);
+
+    return h->len;
+}
+
+bool vfs_mmapTruncate(void *handle, file_off len)
+{
+    vfs_mmapFile *h = handle;
+    if (ftruncate(h->fd, len))
+    {
+        return false;
+    }
+
+    return vfs_mmapResize(h, len);
+}
+
+bool vfs_mmapSync(void *handle)
+{
+    vfs_mmapFile *h = handle;
+    if (h->data && h->len && msync(h->data, h->len, MS_SYNC))
+    {
+        return false;
+    }
+
+    return !fsync(h->fd);
+}
+
+void vfs_mmapClose(void *handle)
+{
+    vfs_mmapFile *h = handle;
+    if (h->data)
+    {
+        munmap(h->data, h->cap);
+    }
+    close(h->fd);
+    free(h);
+}
+
+int vfs_mmapDescriptor(void *handle)
+{
+    return ((vfs_mmapFile *)handle)->fd;
+}
+
+const vfs_struct vfs_mmap = {
+    "mmap",
+    vfs_mmapOpen,
+    vfs_mmapRead,
+    vfs_mmapWrite,
+    vfs_mmapLength,
+    vfs_mmapTruncate,
+    vfs_mmapSync,
+    vfs_mmapClose,
+    vfs_mmapDescriptor,
+    vfs_diskRename,
+    vfs_diskRemove,
+    vfs_diskMakeDirectory,
+    vfs_diskIsDirectory,
+    vfs_diskList
+};
+
+#endif
+
+/*
+    memory
+*/
+
+typedef struct vfs_memoryFile
+{
+    char *path;
+    unsigned char *data;
+    file_off len;
+    file_off cap;
+
+    int refs;     // open handles
+    bool removed; // unlinked, freed once the last handle closes
+
+    struct vfs_memoryFile *next;
+} vfs_memoryFile;
+
+vfs_memoryFile *memoryFiles = NULL;
+thread_mutex memoryLock = THREAD_MUTEX_INIT;
+
+vfs_memoryFile *vfs_memoryFind(const char *path)
+{
+    for (vfs_memoryFile *f = memoryFiles; f; f = f->next)
+    {
+        if (!strcmp(f->path, path))
+        {
+            return f;
+        }
+    }
+
+    return NULL;
+}
+
+void vfs_memoryFree(vfs_memoryFile *f)
+{
+    free(f->path);
+    if (f->data)
+    {
+        free(f->data);
+    }
+    free(f);
+}
+
+void vfs_memoryUnlink(vfs_memoryFile *target)
+{
+    vfs_memoryFile **link = &memoryFiles;
+    while (*link && *link != target)
+    {
+        link = &(*link)->next;
+    }
+    if (*link)
+    {
+        *link = target->next;
+    }
+
+    if (target->refs)
+    {
+        target->removed = true;
+    }
+    else
+    {
+        vfs_memoryFree(target);
+    }
+}
+
+void *vfs_memoryOpen(const char *path, int flags)
+{
+    thread_lock(&memoryLock);
+
+    vfs_memoryFile *f = vfs_memoryFind(path);
+    if (!f && (flags & VFS_CREATE))
+    {
+        f = malloc(sizeof(vfs_memoryFile));
+        f->path = malloc(strlen(path) + 1);
+        strcpy(f->path, path);
+        f->data = NULL;
+        f->len = 0;
+        f->cap = 0;
+        f->refs = 0;
+        f->removed = false;
+        f->next = memoryFiles;
+        memoryFiles = f;
+    }
+
+    if (f)
+    {
+        f->refs++;
+        if (flags & VFS_TRUNCATE)
+        {
+            f->len = 0;
+        }
+    }
+
+    thread_unlock(&memoryLock);
+
+    return f;
+}
+
+int vfs_memoryRead(void *h, void *out, int n, file_off pos)
+{
+    vfs_memoryFile *f = h;
+
+    thread_lock(&memoryLock);
+    n = (int)MIN(n, f->len - pos);
+    if (n > 0)
+    {
+        memcpy(out, f->data + pos, n);
+    }
+    thread_unlock(&memoryLock);
+
+    return MAX(n, 0);
+}
+
+int vfs_memoryWrite(void *h, const void *in, int n, file_off pos)
+{
+    vfs_memoryFile *f = h;
+
+    thread_lock(&memoryLock);
+
+    file_off end = pos + n;
+    if (end > f->cap)
+    {
+        file_off cap = MAX(f->cap << 1, end);
+        unsigned char *data = realloc(f->data, cap);
+        if (!data)
+        {
+            thread_unlock(&memoryLock);
+            return -1;
+        }
+        f->data = data;
+        f->cap = cap;
+    }
+
+    if (pos > f->len)
+    {
+        // gap reads back as zeros like a sparse file
+        memset(f->data + f->len, 0, pos - f->len);
+    }
+    memcpy(f->data + pos, in, n);
+    f->len = MAX(f->len, end);
+
+    thread_unlock(&memoryLock);
+
+    return n;
+}
+
+file_off vfs_memoryLength(void *h)
+{
+    thread_lock(&memoryLock);
+    file_off len = ((vfs_memoryFile *)h)->len;
+    thread_unlock(&memoryLock);
+
+    return len;
+}
+
+bool vfs_memoryTruncate(void *h, file_off len)
+{
+    vfs_memoryFile *f = h;
+
+    thread_lock(&memoryLock);
+    if (len > f->len)
+    {
+        thread_unlock(&memoryLock);
+
+        // grow with zeros
+        unsigned char zero = 0;
+        return vfs_memoryWrite(h, &zero, 1, len - 1) == 1;
+    }
+    f->len = len;
+    thread_unlock(&memoryLock);
+
+    return true;
+}
+
+bool vfs_memorySync(void *h)
+{
+    // nothing below memory
+    return true;
+}
+
+void vfs_memoryClose(void *h)
+{
+    vfs_memoryFile *f = h;
+
+    thread_lock(&memoryLock);
+    if (!--f->refs && f->removed)
+    {
+        vfs_memoryFree(f);
+    }
+    thread_unlock(&memoryLock);
+}
+
+int vfs_memoryDescriptor(void *h)
+{
+    return -1;
+}
+
+bool vfs_memoryRename(const char *from, const char *to)
+{
+    thread_lock(&memoryLock);
+
+    vfs_memoryFile *f = vfs_memoryFind(from);
+    if (f)
+    {
+        vfs_memoryFile *old = vfs_memoryFind(to);
+        if (old && old != f)
+        {
+            vfs_memoryUnlink(old);
+        }
+
+        char *path = malloc(strlen(to) + 1);
+        strcpy(path, to);
+        free(f->path);
+        f->path = path;
+    }
+
+    thread_unlock(&memoryLock);
+
+    return f != NULL;
+}
+
+bool vfs_memoryRemove(const char *path)
+{
+    thread_lock(&memoryLock);
+
+    vfs_memoryFile *f = vfs_memoryFind(path);
+    if (f)
+    {
+        vfs_memoryUnlink(f);
+    }
+
+    thread_unlock(&memoryLock);
+
+    return f != NULL;
+}
+
+bool vfs_memoryMakeDirectory(const char *path)
+{
+    // directories only exist as path prefixes
+    return true;
+}
+
+bool vfs_memoryIsDirectory(const char *path)
+{
+    return true;
+}
+
+int vfs_memoryList(const char *dir, void (*callback)(const char *name, void *arg), void *arg)
+{
+    int n = 0;
+    int dirLen = strlen(dir);
+    char **names = NULL;
+
+    thread_lock(&memoryLock);
+    for (vfs_memoryFile *f = memoryFiles; f; f = f->next)
+    {
+        // direct children only
+        if (!strncmp(f->path, dir, dirLen) &&
+            f->path[dirLen] == PATH_SEPARATOR[0] &&
+            !strchr(f->path + dirLen + 1, PATH_SEPARATOR[0]))
+        {
+            names = realloc(names, (n + 1) * sizeof(char *));
+            names[n] = malloc(strlen(f->path + dirLen + 1) + 1);
+            strcpy(names[n], f->path + dirLen + 1);
+            n++;
+        }
+    }
+    thread_unlock(&memoryLock);
+
+    // outside the lock so the callback may open or remove files
+    for (int i = 0; i < n; i++)
+    {
+        callback(names[i], arg);
+        free(names[i]);
+    }
+    conditionalFree(names, free);
+
+    return n;
+}
+
+const vfs_struct vfs_memory = {
+    "memory",
+    vfs_memoryOpen,
+    vfs_memoryRead,
+    vfs_memoryWrite,
+    vfs_memoryLength,
+    vfs_memoryTruncate,
+    vfs_memorySync,
+    vfs_memoryClose,
+    vfs_memoryDescriptor,
+    vfs_memoryRename,
+    vfs_memoryRemove,
+    vfs_memoryMakeDirectory,
+    vfs_memoryIsDirectory,
+    vfs_memoryList
+};
@@ -0,0 +1,53 @@
+#include "../../datavault.h"
+
+#include <stdint.h>
+
+#ifndef VFS_H
+#define VFS_H
+
+// file offsets are 64-bit so files may exceed 2 GiB
+typedef int64_t file_off;
+
+// open flags, file_open translates the stdio mode into these
+#define VFS_READ 0x01
+#define VFS_WRITE 0x02
+#define VFS_CREATE 0x04
+#define VFS_TRUNCATE 0x08
+#define VFS_APPEND 0x10
+
+/**
+ * storage backend under fileio, every path is a full path;
+ * handles come from open and are only passed back to the same backend
+ */
+typedef struct
+{
+    const char *name;
+
+    void *(*open)(const char *path, int flags);
+    int (*read)(void *h, void *out, int n, file_off pos);
+    int (*write)(void *h, const void *in, int n, file_off pos);
+    file_off (*length)(void *h);
+    bool (*truncate)(void *h, file_off len);
+    bool (*sync)(void *h);
+    void (*close)(void *h);
+    int (*descriptor)(void *h); // native descriptor for kernel fast paths, -1 if there is none
+
+    bool (*rename)(const char *from, const char *to); // atomically replaces to
+    bool (*remove)(const char *path);
+    bool (*makeDirectory)(const char *path);
+    bool (*isDirectory)(const char *path);
+    int (*list)(const char *dir, void (*callback)(const char *name, void *arg), void *arg);
+} vfs_struct;
+
+// files on disk through positional reads and writes
+extern const vfs_struct vfs_disk;
+// files on disk through a shared mapping of each open file
+extern const vfs_struct vfs_mmap;
+// files only in memory, gone when the process exits
+extern const vfs_struct vfs_memory;
+
+const vfs_struct *vfs_find(const char *name);
+void vfs_use(const vfs_struct *backend);
+const vfs_struct *vfs_active();
+
+#endif // VFS_H
@@ -28,6 +28,14 @@ int main(int argc, char *argv[])
 
         init();
 
+        chacha20Vector();
+        aesCounter();
+        drbgOutput();
+        drbgVector();
+        hkdfVector();
+        batchFallback();
+        writeFailure();
+
         createAccount("test", "testPwd");
         loginFail("test", "test");
 
@@ -52,10 +60,25 @@ int main(int argc, char *argv[])
             accessData(GOOGLE, PASSWORD, GG_PWD2);
             modifyData(GOOGLE, USERNAME, GG_USER);
             accessData(GOOGLE, USERNAME, GG_USER);
+            largeDataFile(GOOGLE, USERNAME, GG_USER, (file_off)65 << 30);
 
             logout();
         }
 
+        walReplay();
+        journalCheckpoint();
+        failedCommit();
+        freeSpaceReuse();
+        vacuumCompact();
+        defragChains();
+        chainExtents();
+        tailAppend();
+        categoryDirectory();
+        pageRelocate();
+        binaryValues();
+        wideCategories();
+        v1Migration();
+
         printMetrics();
         cleanup();
 
@@ -7,6 +7,7 @@
 #include "../../datavault.h"
 #include "../../controller/dv_controller.h"
 #include "../../controller/dv_persistence.h"
+#include "../../controller/dv_vacuum.h"
 #include "../../lib/cmathematics/cmathematics.h"
 #include "../../lib/ds/strstream.h"
 #include "../../lib/util/consoleio.h"
@@ -14,6 +15,7 @@
 
 dv_app terminal_app;
 int DV_DEBUG = 0;
+int DV_LAZYLOAD = 0;
 
 void printHelp()
 {
@@ -39,6 +41,8 @@ void printHelp()
     printf("  logout                           Logout the current user.\n");
     printf("  log                              Print all the entries and categories for the current user.\n");
     printf("  print                            Print the encrypted and decrypted data file contents.\n");
+    printf("  vacuum                           Move data into free space and shrink the data file.\n");
+    printf("  defrag                           Rewrite the data file with the data of each entry together.\n");
     printf("  createAct                        Create an account. Prompted for username and password.\n");
     printf("  login                            Login to an existing account. Prompted for username and password.\n");
     printf("  create <entry>                   Create an entry.\n");
@@ -46,6 +50,8 @@ void printHelp()
     printf("  copy <entry> <category>          Put the data for an entry under a category onto the clipboard.\n");
     printf("  del <entry> <category>           Delete the data for an entry under a category.\n");
     printf("  set <entry> <category> [<data>]  Set the data for an entry under a category. Prompted for data if not entered in the command.\n");
+    printf("  import <entry> <category> <file> Set the data for an entry under a category to the contents of a file.\n");
+    printf("  export <entry> <category> <file> Write the data for an entry under a category to a file.\n");
 }
 
 int processCommand(strstream *cmd)
@@ -129,6 +135,14 @@ int processCommand(strstream *cmd)
         {
             dv_printDataFile(&terminal_app);
         }
+        else if (TOKEN_EQ("vacuum"))
+        {
+            retCode = dv_vacuum(&terminal_app, 0);
+        }
+        else if (TOKEN_EQ("defrag"))
+        {
+            retCode = dv_defrag(&terminal_app);
+        }
         else if (TOKEN_EQ("createAct"))
         {
             char *user = getMaskedInput("USERNAME> ");
@@ -225,6 +239,45 @@ int processCommand(strstream *cmd)
             printf("Setting data for %s under %s: %s\n", argTokens[0], argTokens[1], argTokens[2]);
             retCode = dv_setEntryData(&terminal_app, argTokens[0], argTokens[1], argTokens[2]);
         }
+        else if (TOKEN_EQ("import"))
+        {
+            // any bytes, the file is outside the vault
+            printf("Importing %s for %s under %s\n", argTokens[2], argTokens[0], argTokens[1]);
+            FILE *f = fopen(argTokens[2], "rb");
+            retCode = DV_FILE_DNE;
+            if (f)
+            {
+                fseek(f, 0, SEEK_END);
+                long len = ftell(f);
+                fseek(f, 0, SEEK_SET);
+                char *data = malloc(len > 0 ? len : 1);
+                if (len >= 0 && fread(data, 1, len, f) == (size_t)len)
+                {
+                    retCode = dv_setEntryBytes(&terminal_app, argTokens[0], argTokens[1], data, (int)len);
+                }
+                fclose(f);
+                free(data);
+            }
+        }
+        else if (TOKEN_EQ("export"))
+        {
+            printf("Exporting data for %s under %s to %s\n", argTokens[0], argTokens[1], argTokens[2]);
+            char *out = NULL;
+            int len = 0;
+            if (!(retCode = dv_accessEntryBytes(&terminal_app, argTokens[0], argTokens[1], &out, &len)))
+            {
+                FILE *f = fopen(argTokens[2], "wb");
+                if (!f || fwrite(out, 1, len, f) != (size_t)len)
+                {
+                    retCode = DV_FILE_DNE;
+                }
+                if (f)
+                {
+                    fclose(f);
+                }
+                free(out);
+            }
+        }
 
         freeStringList(tokens, n);
         if (argTokens)
@@ -282,6 +335,12 @@ int terminal()
             break;
         }
         strstream_clear(&cmd);
+
+        // compact a few pages while waiting for the next command
+        if (res != DV_EXIT)
+        {
+            dv_vacuumIdle(&terminal_app);
+        }
     }
 
     return dv_kill(&terminal_app);
@@ -309,6 +368,9 @@ int singleCmd(int argc, char **argv)
 
         dv_init(&terminal_app);
 
+        // a single command only touches the maps it needs
+        DV_LAZYLOAD = 1;
+
         // find username
         if (i < argc - 1 && ARGV_EQ("-u"))
         {
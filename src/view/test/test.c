@@ -1,5 +1,6 @@
 #include "test.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -7,6 +8,23 @@
 
 #include "../../datavault.h"
 #include "../../controller/dv_controller.h"
+#include "../../controller/dv_persistence.h"
+#include "../../controller/dv_wal.h"
+#include "../../controller/dv_page.h"
+#include "../../controller/dv_journal.h"
+#include "../../controller/dv_format.h"
+#include "../../controller/dv_vacuum.h"
+#include "../../lib/util/fileio.h"
+#include "../../lib/util/vfs.h"
+#include "../../lib/util/mem.h"
+#include "../../lib/util/uring.h"
+#include "../../lib/cmathematics/util/numio.h"
+#include "../../lib/cmathematics/lib/arrays.h"
+#include "../../lib/cmathematics/data/encryption/aes.h"
+#include "../../lib/cmathematics/data/encryption/chacha20.h"
+#include "../../lib/cmathematics/data/random/drbg.h"
+#include "../../lib/cmathematics/data/hashing/hkdf.h"
+#include "../../lib/cmathematics/data/hashing/sha.h"
 
 dv_app test_app;
 int retCode = 0;
@@ -14,6 +32,10 @@ char *buf = NULL;
 unsigned int noTests = 0;
 unsigned int noSuccesses = 0;
 
+#ifdef DV_URING
+extern int fileRingState;
+#endif
+
 bool logTest(bool success, const char *format, ...)
 {
     char *totalFormat = malloc(5 + strlen(format) + 1);
@@ -50,6 +72,29 @@ bool loginFail(const char *username, const char *pwd)
     return logTest(retCode == DV_INVALID_INPUT, "Fail login with password %s: %d\n", pwd, retCode);
 }
 
+// login of a test that logs its own result
+bool loginSilent(const char *username, const char *pwd)
+{
+    return dv_login(&test_app, (unsigned char *)username, (unsigned char *)pwd, strlen(pwd)) == DV_SUCCESS;
+}
+
+// account of a test, created and logged in
+bool openAccount(const char *username, const char *pwd)
+{
+    return dv_createAccount(&test_app, (unsigned char *)username, (unsigned char *)pwd, strlen(pwd)) == DV_SUCCESS &&
+           loginSilent(username, pwd);
+}
+
+// n copies of c as a string, freed by the caller
+char *filledValue(char c, int n)
+{
+    char *ret = malloc(n + 1);
+    memset(ret, c, n);
+    ret[n] = 0;
+
+    return ret;
+}
+
 bool logout()
 {
     retCode = dv_logout(&test_app);
@@ -74,6 +119,7 @@ bool accessData(const char *entryName, const char *categoryName, const char *exp
     bool matches = !strcmp((const char *)buf, expected);
     bool ret = logTest(matches, "Access %s for entry %s: %s: %d\n", categoryName, entryName, buf, retCode);
     free(buf);
+    buf = NULL;
     return ret;
 }
 
@@ -82,6 +128,7 @@ bool accessDataFailure(const char *entryName, const char *categoryName)
     retCode = dv_accessEntryData(&test_app, entryName, categoryName, &buf);
     bool ret = logTest(retCode == DV_INVALID_INPUT, "Access non-existent %s for entry %s: %d\n", categoryName, entryName, retCode);
     free(buf);
+    buf = NULL;
     return ret;
 }
 
@@ -103,6 +150,994 @@ bool deleteDataFailure(const char *entryName, const char *categoryName)
     return logTest(retCode == DV_INVALID_INPUT, "Delete non-existent %s for entry %s: %d\n", categoryName, entryName);
 }
 
+bool largeDataFile(const char *entryName, const char *categoryName, const char *expected, file_off len)
+{
+    if (vfs_active() == &vfs_memory)
+    {
+        // memory files are not sparse
+        printf("(S) Sparse data file skipped in memory\n");
+        return true;
+    }
+    if (!getenv("DV_TEST_SPARSE"))
+    {
+        // needs a file system with sparse files, run on request
+        printf("(S) Sparse data file skipped, set DV_TEST_SPARSE to run it\n");
+        return true;
+    }
+
+    // pending blocks must be in data.dv before it is resized
+    dv_walWait(&test_app);
+
+    // extend data.dv with a hole, only the existing blocks take space
+    file_struct dataFile;
+    if (!file_open(&dataFile, data_fp, "r+b"))
+    {
+        return logTest(false, "Open data file\n");
+    }
+    file_off originalLen = dataFile.len;
+    bool ret = file_truncate(&dataFile, len) && file_length(&dataFile) == len;
+    file_close(&dataFile);
+
+    // existing entries still read
+    retCode = dv_accessEntryData(&test_app, entryName, categoryName, &buf);
+    ret = ret && retCode == DV_SUCCESS && !strcmp(buf, expected);
+    free(buf);
+    buf = NULL;
+
+    // pages past the last addressable one are refused instead of wrapping around
+    char *large = filledValue('x', DV_PAGE_LEN);
+    retCode = dv_createEntryData(&test_app, entryName, categoryName, large);
+    ret = ret && retCode == DV_FILE_FULL;
+    free(large);
+
+    // restore
+    if (file_open(&dataFile, data_fp, "r+b"))
+    {
+        ret = file_truncate(&dataFile, originalLen) && ret;
+        file_close(&dataFile);
+    }
+
+    return logTest(ret, "Sparse data file of %lld bytes: %d\n", (long long)len, retCode);
+}
+
+bool chacha20Vector()
+{
+    // RFC 8439 2.3.2: key 00..1f, counter 1
+    unsigned char key[CHACHA20_KEY_LEN];
+    for (int i = 0; i < CHACHA20_KEY_LEN; i++)
+    {
+        key[i] = i;
+    }
+    unsigned char nonce[CHACHA20_NONCE_LEN] = { 0, 0, 0, 0x09, 0, 0, 0, 0x4a, 0, 0, 0, 0 };
+    unsigned char expected[CHACHA20_BLOCK_LEN] = {
+        0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15, 0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+        0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03, 0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+        0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09, 0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+        0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9, 0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e
+    };
+
+    unsigned char out[CHACHA20_BLOCK_LEN + 5];
+    chacha20_keystream(key, 1, nonce, out, CHACHA20_BLOCK_LEN + 5);
+    bool ret = !memcmp(out, expected, CHACHA20_BLOCK_LEN);
+
+    // a partial block continues from the next counter
+    unsigned char next[CHACHA20_BLOCK_LEN];
+    chacha20_keystream(key, 2, nonce, next, CHACHA20_BLOCK_LEN);
+    ret = ret && !memcmp(out + CHACHA20_BLOCK_LEN, next, 5);
+
+    return logTest(ret, "ChaCha20 block test vector\n");
+}
+
+bool aesCounter()
+{
+    unsigned char key[32];
+    unsigned char iv[AES_BLOCK_LEN];
+    for (int i = 0; i < 32; i++)
+    {
+        key[i] = i;
+    }
+    memset(iv, 0, AES_BLOCK_LEN);
+    iv[AES_BLOCK_LEN - 1] = 0xf0;
+
+    unsigned char schedule[AES_256_NR + 1][AES_BLOCK_SIDE][AES_BLOCK_SIDE];
+    aes_generateKeySchedule(key, AES_256, schedule);
+
+    // 300 blocks cross the low counter byte more than once
+    int n = 300 * AES_BLOCK_LEN;
+    unsigned char *zeros = malloc(n);
+    memset(zeros, 0, n);
+    unsigned char *ctr = NULL;
+    unsigned char *wrap = NULL;
+    aes_encrypt_withSchedule(zeros, n, schedule, AES_256_NR, AES_CTR, iv, &ctr);
+    aes_encrypt_withSchedule(zeros, n, schedule, AES_256_NR, AES_CTR_WRAP, iv, &wrap);
+
+    // AES_CTR carries like aes_incrementCounter
+    bool ret = true;
+    unsigned char block[AES_BLOCK_LEN];
+    unsigned char counter[AES_BLOCK_LEN];
+    for (int i = 0; ret && i < 300; i++)
+    {
+        memcpy(counter, iv, AES_BLOCK_LEN);
+        aes_incrementCounter(counter, i);
+        aes_ctr_block(zeros, AES_BLOCK_LEN, schedule, AES_256_NR, counter, block);
+        ret = !memcmp(ctr + (i << 4), block, AES_BLOCK_LEN);
+    }
+
+    // AES_CTR_WRAP agrees until the low byte wraps, then repeats every 256 blocks
+    ret = ret && !memcmp(ctr, wrap, 16 * AES_BLOCK_LEN);
+    ret = ret && memcmp(ctr + 16 * AES_BLOCK_LEN, wrap + 16 * AES_BLOCK_LEN, AES_BLOCK_LEN);
+    ret = ret && !memcmp(wrap, wrap + 256 * AES_BLOCK_LEN, 44 * AES_BLOCK_LEN);
+
+    // and decrypts what it encrypted
+    unsigned char *dec = NULL;
+    aes_decrypt_withSchedule(wrap, n, schedule, AES_256_NR, AES_CTR_WRAP, iv, &dec);
+    ret = ret && !memcmp(dec, zeros, n);
+
+    free(zeros);
+    free(ctr);
+    free(wrap);
+    free(dec);
+
+    return logTest(ret, "AES counter modes\n");
+}
+
+bool drbgOutput()
+{
+    drbg_context ctx;
+    memset(&ctx, 0, sizeof(drbg_context));
+
+    // a request larger than the buffer refills it on the way
+    int n = DRBG_BUF_LEN + 100;
+    unsigned char *out1 = malloc(n);
+    unsigned char *out2 = malloc(n);
+    memset(out1, 0, n);
+    drbg_generate(&ctx, out1, n);
+    drbg_generate(&ctx, out2, n);
+
+    bool ret = ctx.seeded && ctx.sinceReseed == (unsigned int)(n << 1);
+    ret = ret && memcmp(out1, out2, n);
+
+    // no 16 byte run of zeros in the output
+    for (int i = 0; ret && i + 16 <= n; i += 16)
+    {
+        unsigned char zero[16] = { 0 };
+        ret = memcmp(out1 + i, zero, 16);
+    }
+
+    // served bytes and the key that generated them are erased
+    unsigned char key[CHACHA20_KEY_LEN];
+    memcpy(key, ctx.key, CHACHA20_KEY_LEN);
+    for (int i = 0; ret && i < ctx.cursor; i++)
+    {
+        ret = !ctx.buffer[i];
+    }
+    drbg_refill(&ctx);
+    ret = ret && memcmp(key, ctx.key, CHACHA20_KEY_LEN);
+
+    // past the reseed interval new entropy is mixed in
+    ctx.sinceReseed = DRBG_RESEED_INTERVAL;
+    drbg_generate(&ctx, out1, 16);
+    ret = ret && ctx.sinceReseed == 16;
+
+    memset(&ctx, 0, sizeof(drbg_context));
+    free(out1);
+    free(out2);
+
+    return logTest(ret, "DRBG output\n");
+}
+
+bool drbgVector()
+{
+    // RFC 8439 A.1 #1: the keystream of the zero key is the next key, then the output
+    unsigned char expected[CHACHA20_BLOCK_LEN] = {
+        0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90, 0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28,
+        0xbd, 0xd2, 0x19, 0xb8, 0xa0, 0x8d, 0xed, 0x1a, 0xa8, 0x36, 0xef, 0xcc, 0x8b, 0x77, 0x0d, 0xc7,
+        0xda, 0x41, 0x59, 0x7c, 0x51, 0x57, 0x48, 0x8d, 0x77, 0x24, 0xe0, 0x3f, 0xb8, 0xd8, 0x4a, 0x37,
+        0x6a, 0x43, 0xb8, 0xf4, 0x15, 0x18, 0xa1, 0x1c, 0xc3, 0x87, 0xb6, 0x69, 0xb2, 0xee, 0x65, 0x86
+    };
+
+    drbg_context ctx;
+    memset(&ctx, 0, sizeof(drbg_context));
+    drbg_refill(&ctx);
+
+    bool ret = !memcmp(ctx.key, expected, CHACHA20_KEY_LEN);
+    ret = ret && !memcmp(ctx.buffer + CHACHA20_KEY_LEN, expected + CHACHA20_KEY_LEN, CHACHA20_KEY_LEN);
+    ret = ret && ctx.cursor == CHACHA20_KEY_LEN;
+
+    memset(&ctx, 0, sizeof(drbg_context));
+
+    return logTest(ret, "DRBG test vector\n");
+}
+
+bool hkdfVector()
+{
+    // RFC 5869 A.1
+    unsigned char ikm[22];
+    memset(ikm, 0x0b, 22);
+    unsigned char salt[13];
+    for (int i = 0; i < 13; i++)
+    {
+        salt[i] = i;
+    }
+    unsigned char info[10];
+    for (int i = 0; i < 10; i++)
+    {
+        info[i] = 0xf0 + i;
+    }
+    unsigned char expected[42] = {
+        0x3c, 0xb2, 0x5f, 0x25, 0xfa, 0xac, 0xd5, 0x7a, 0x90, 0x43, 0x4f, 0x64, 0xd0, 0x36,
+        0x2f, 0x2a, 0x2d, 0x2d, 0x0a, 0x90, 0xcf, 0x1a, 0x5a, 0x4c, 0x5d, 0xb0, 0x2d, 0x56,
+        0xec, 0xc4, 0xc5, 0xbf, 0x34, 0x00, 0x72, 0x08, 0xd5, 0xb8, 0x87, 0x18, 0x58, 0x65
+    };
+
+    unsigned char *okm = NULL;
+    hkdf_hmac_sha(ikm, 22, salt, 13, info, 10, SHA256_STR, 42, &okm);
+    bool ret = okm && !memcmp(okm, expected, 42);
+    conditionalFree(okm, free);
+
+    return logTest(ret, "HKDF test vector\n");
+}
+
+bool batchFallback()
+{
+    const char *path = "batch.dv";
+    int n = 100;
+    unsigned char *written = malloc(n << 4);
+    unsigned char *read = malloc(n << 4);
+    file_request reqs[100];
+    bool ret = true;
+
+    // through the ring where there is one, then with blocking calls
+    for (int pass = 0; pass < 2; pass++)
+    {
+#ifdef DV_URING
+        int ringState = fileRingState;
+        if (pass)
+        {
+            fileRingState = -1;
+        }
+#endif
+
+        // scattered blocks, written back to front
+        randomBytes((char *)written, n << 4);
+        file_struct f;
+        ret = ret && file_open(&f, path, "w+b");
+        for (int i = 0; i < n; i++)
+        {
+            reqs[i].pos = (file_off)(n - 1 - i) * 48;
+            reqs[i].buffer = written + (i << 4);
+            reqs[i].n = 16;
+        }
+        ret = ret && file_pwriteBatch(&f, reqs, n) == n;
+
+        memset(read, 0, n << 4);
+        for (int i = 0; i < n; i++)
+        {
+            ret = ret && file_pread(&f, reqs[i].pos, read + (i << 4), 16) == 16;
+        }
+        ret = ret && !memcmp(written, read, n << 4);
+        file_close(&f);
+
+#ifdef DV_URING
+        fileRingState = ringState;
+#endif
+    }
+
+    file_remove(path);
+    free(written);
+    free(read);
+
+    return logTest(ret, "Batched writes through the ring and the blocking fallback\n");
+}
+
+// backend that comes up short on whole-window writes
+vfs_struct shortVfs;
+const vfs_struct *shortBackend;
+int shortWrite(void *h, const void *in, int n, file_off pos)
+{
+    return n >= FILE_BUFFER_LEN ? n - 1 : shortBackend->write(h, in, n, pos);
+}
+
+bool writeFailure()
+{
+    const char *path = "short.dv";
+    bool ret = file_writeContents(path, "old", 3);
+
+    // a failed write early on fails the sync, though the writes after it succeed
+    char *large = calloc(FILE_BUFFER_LEN, 1);
+    shortBackend = vfs_active();
+    shortVfs = *shortBackend;
+    shortVfs.write = shortWrite;
+    vfs_use(&shortVfs);
+    file_struct f;
+    if (ret && (ret = file_openTemp(&f, path)))
+    {
+        file_write(&f, large, FILE_BUFFER_LEN);
+        file_write(&f, "new", 3);
+        ret = !file_commit(&f, path);
+    }
+    vfs_use(shortBackend);
+    free(large);
+
+    // and the original is not replaced
+    if (ret && (ret = file_open(&f, path, "rb")))
+    {
+        char *contents = file_read(&f, f.len);
+        ret = f.len == 3 && contents && !memcmp(contents, "old", 3);
+        conditionalFree(contents, free);
+        file_close(&f);
+    }
+    file_remove(path);
+
+    return logTest(ret, "Fail the commit of a file after a short write\n");
+}
+
+bool accessSilent(const char *entryName, const char *categoryName, const char *expected)
+{
+    retCode = dv_accessEntryData(&test_app, entryName, categoryName, &buf);
+    bool ret = retCode == DV_SUCCESS && buf && !strcmp(buf, expected);
+    conditionalFree(buf, free);
+    buf = NULL;
+
+    return ret;
+}
+
+file_off fileLength(const char *path)
+{
+    file_struct f;
+    if (!file_open(&f, path, "rb"))
+    {
+        return -1;
+    }
+    file_off ret = f.len;
+    file_close(&f);
+
+    return ret;
+}
+
+// length of data.dv once the logged pages are written into it
+file_off dataLength()
+{
+    dv_walWait(&test_app);
+    return fileLength(data_fp);
+}
+
+bool walReplay()
+{
+    // groups committed to the log but lost from data.dv by a crash
+    bool ret = openAccount("wal", "walPwd");
+    ret = ret && dv_createEntryData(&test_app, "Entry", "First", "before") == DV_SUCCESS;
+
+    dv_walWait(&test_app);
+    file_struct f;
+    char *snapshot = NULL;
+    int len = 0;
+    if (ret && file_open(&f, data_fp, "rb"))
+    {
+        len = f.len;
+        snapshot = file_read(&f, len);
+        file_close(&f);
+    }
+    ret = ret && snapshot;
+
+    ret = ret && dv_createEntryData(&test_app, "Entry", "Second", "after") == DV_SUCCESS;
+    ret = ret && dv_setEntryData(&test_app, "Entry", "First", "changed") == DV_SUCCESS;
+    dv_walWait(&test_app);
+    ret = ret && file_writeContents(data_fp, snapshot, len);
+    conditionalFree(snapshot, free);
+
+    // and a group torn by the crash
+    if (ret && file_open(&f, wal_fp, "ab"))
+    {
+        unsigned char torn[7] = { DV_WAL_PAGE, 1, 0, 0, 0, 0x5a, 0x5a };
+        file_write(&f, torn, 7);
+        file_close(&f);
+    }
+
+    // no logout, the maps are not saved
+    dv_kill(&test_app);
+
+    ret = ret && loginSilent("wal", "walPwd");
+    ret = ret && fileLength(wal_fp) == 0;
+    ret = ret && accessSilent("Entry", "First", "changed");
+    ret = ret && accessSilent("Entry", "Second", "after");
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+
+    return logTest(ret, "Replay the write-ahead log after a crash\n");
+}
+
+bool journalCheckpoint()
+{
+    // index changes are only in the journal until a checkpoint
+    bool ret = openAccount("journal", "journalPwd");
+    ret = ret && dv_createEntryData(&test_app, "A", "Cat", "a") == DV_SUCCESS;
+    ret = ret && dv_createEntryData(&test_app, "B", "Other", "b") == DV_SUCCESS;
+    ret = ret && fileLength(journal_fp) > DV_JOURNAL_HEADER_LEN;
+    dv_kill(&test_app);
+
+    // replayed in the next session
+    ret = ret && loginSilent("journal", "journalPwd");
+    ret = ret && accessSilent("A", "Cat", "a") && accessSilent("B", "Other", "b");
+
+    // a checkpoint writes the maps at the next generation and empties the journal
+    unsigned int generation = test_app.generation;
+    ret = ret && dv_checkpoint(&test_app) == DV_SUCCESS;
+    ret = ret && test_app.generation > generation;
+    for (int i = 0; i < DV_NO_MAPS; i++)
+    {
+        ret = ret && test_app.mapGeneration[i] == test_app.generation && !test_app.mapDirty[i];
+    }
+    ret = ret && fileLength(journal_fp) == DV_JOURNAL_HEADER_LEN;
+
+    // records after it apply on top of the checkpointed maps
+    ret = ret && dv_createEntryData(&test_app, "C", "Cat", "c") == DV_SUCCESS;
+    dv_kill(&test_app);
+
+    ret = ret && loginSilent("journal", "journalPwd");
+    ret = ret && accessSilent("A", "Cat", "a") && accessSilent("B", "Other", "b") && accessSilent("C", "Cat", "c");
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+
+    return logTest(ret, "Replay the journal across sessions and checkpoint it\n");
+}
+
+// backend whose syncs fail, so every log commit does
+vfs_struct failingVfs;
+bool failSync(void *h)
+{
+    return false;
+}
+
+bool failedCommit()
+{
+    bool ret = openAccount("failed", "failedPwd");
+    ret = ret && dv_createEntryData(&test_app, "A", "First", "a") == DV_SUCCESS;
+
+    // a batch that is not committed leaves neither journal records nor map entries
+    const vfs_struct *backend = vfs_active();
+    failingVfs = *backend;
+    failingVfs.sync = failSync;
+    vfs_use(&failingVfs);
+    ret = ret && dv_createEntryData(&test_app, "B", "Second", "b") != DV_SUCCESS;
+    vfs_use(backend);
+    ret = ret && !accessSilent("B", "Second", "b") && dv_requireMap(&test_app, DV_CATIDMAP) == DV_SUCCESS;
+    ret = ret && !avl_get(test_app.catIdMap, (void *)"Second") && !avl_get(test_app.nameIdMap, (void *)"B");
+
+    // and the next record is appended where the file ends
+    ret = ret && dv_createEntryData(&test_app, "C", "Third", "c") == DV_SUCCESS;
+    dv_kill(&test_app);
+
+    ret = ret && loginSilent("failed", "failedPwd");
+    ret = ret && accessSilent("A", "First", "a") && accessSilent("C", "Third", "c");
+    ret = ret && !accessSilent("B", "Second", "b");
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+
+    return logTest(ret, "Drop the index changes of a batch that failed to commit\n");
+}
+
+bool freeSpaceReuse()
+{
+    char *value = filledValue('f', 3000);
+
+    // deleted space is taken by the next value instead of growing data.dv
+    bool ret = openAccount("free", "freePwd");
+    ret = ret && dv_createEntryData(&test_app, "A", "Cat", value) == DV_SUCCESS;
+    ret = ret && dv_createEntryData(&test_app, "B", "Cat", value) == DV_SUCCESS;
+    ret = ret && dv_createEntryData(&test_app, "C", "Cat", value) == DV_SUCCESS;
+    ret = ret && dv_deleteEntryData(&test_app, "A", "Cat") == DV_SUCCESS;
+    file_off len = dataLength();
+    ret = ret && dv_logout(&test_app) == DV_SUCCESS;
+
+    // and the next session knows where it is without reading the pages
+    ret = ret && fileLength(freeSpace_fp) == DV_FREESPACE_HEADER_LEN + (len / DV_PAGE_LEN) * 2;
+    ret = ret && loginSilent("free", "freePwd");
+    ret = ret && dv_createEntryData(&test_app, "D", "Cat", value) == DV_SUCCESS;
+    ret = ret && fileLength(freeSpace_fp) < 0;
+    ret = ret && dataLength() == len;
+    ret = ret && accessSilent("B", "Cat", value) && accessSilent("D", "Cat", value);
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+    free(value);
+
+    return logTest(ret, "Reuse deleted space across sessions\n");
+}
+
+bool vacuumCompact()
+{
+    // fills the home page of its entry
+    char *value = filledValue('v', 4027);
+
+    // a page each, two small entries after them, then only links left in the full pages
+    bool ret = openAccount("vacuum", "vacuumPwd");
+    char name[2] = { 0 };
+    for (name[0] = 'A'; name[0] <= 'F'; name[0]++)
+    {
+        ret = ret && dv_createEntryData(&test_app, name, "Cat", value) == DV_SUCCESS;
+    }
+    ret = ret && dv_createEntryData(&test_app, "G", "Cat", "g") == DV_SUCCESS;
+    ret = ret && dv_createEntryData(&test_app, "H", "Cat", "h") == DV_SUCCESS;
+    for (name[0] = 'A'; name[0] <= 'F'; name[0]++)
+    {
+        ret = ret && dv_deleteEntryData(&test_app, name, "Cat") == DV_SUCCESS;
+    }
+    ret = ret && dv_vacuumDue(&test_app);
+    file_off len = dataLength();
+
+    // journal as it was before the homes moved
+    file_struct f;
+    char *journal = NULL;
+    int journalLen = 0;
+    if (ret && file_open(&f, journal_fp, "rb"))
+    {
+        journalLen = f.len;
+        journal = file_read(&f, journalLen);
+        file_close(&f);
+    }
+    ret = ret && journal;
+
+    // the records move into the first page with their homes and data.dv shrinks
+    ret = ret && dv_vacuum(&test_app, 0) == DV_SUCCESS;
+    ret = ret && dataLength() == 2 * DV_PAGE_LEN && len == 8 * DV_PAGE_LEN && !dv_vacuumDue(&test_app);
+    ret = ret && accessSilent("G", "Cat", "g") && accessSilent("H", "Cat", "h");
+
+    // a crash that loses the journal records, the log still names the new homes
+    dv_kill(&test_app);
+    ret = ret && file_writeContents(journal_fp, journal, journalLen);
+    conditionalFree(journal, free);
+
+    ret = ret && loginSilent("vacuum", "vacuumPwd");
+    ret = ret && fileLength(wal_fp) == 0;
+    ret = ret && accessSilent("G", "Cat", "g") && accessSilent("H", "Cat", "h");
+    ret = ret && dv_createEntryData(&test_app, "A", "Cat", value) == DV_SUCCESS;
+    ret = ret && accessSilent("A", "Cat", value);
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+    free(value);
+
+    return logTest(ret, "Compact data.dv and recover the moved homes\n");
+}
+
+// whether the chain of an entry is one run of pages in file order
+bool chainContiguous(const char *name)
+{
+    unsigned int entryId = (unsigned int)(uintptr_t)avl_get(test_app.nameIdMap, (void *)name);
+    unsigned int home = (unsigned int)(uintptr_t)btree_search(test_app.idIdxMap, entryId);
+
+    dv_pageSet pages;
+    if (dv_pageOpen(&pages, &test_app, NULL))
+    {
+        return false;
+    }
+    unsigned int *chain = NULL;
+    int noChain = dv_pageChain(&pages, entryId, home, &chain);
+    bool ret = noChain > 1;
+    for (int i = 1; i < noChain; i++)
+    {
+        ret = ret && chain[i] == chain[i - 1] + 1;
+    }
+    conditionalFree(chain, free);
+    dv_pageClose(&pages);
+
+    return ret;
+}
+
+bool defragChains()
+{
+    char *a = filledValue('a', 5000);
+    char *b = filledValue('b', 5000);
+
+    // values of two entries written in turn interleave their chains
+    bool ret = openAccount("defrag", "defragPwd");
+    ret = ret && dv_createEntryData(&test_app, "A", "First", a) == DV_SUCCESS;
+    ret = ret && dv_createEntryData(&test_app, "B", "First", b) == DV_SUCCESS;
+    ret = ret && dv_createEntryData(&test_app, "A", "Second", a) == DV_SUCCESS;
+    ret = ret && dv_createEntryData(&test_app, "B", "Second", b) == DV_SUCCESS;
+    ret = ret && dv_createEntryData(&test_app, "A", "Third", "short") == DV_SUCCESS;
+    ret = ret && dv_deleteEntryData(&test_app, "B", "First") == DV_SUCCESS;
+    ret = ret && !chainContiguous("A");
+    file_off len = dataLength();
+
+    // each chain becomes one run of pages, the file no longer than before
+    ret = ret && dv_defrag(&test_app) == DV_SUCCESS;
+    ret = ret && dataLength() <= len && fileLength(wal_fp) == 0;
+    ret = ret && chainContiguous("A") && chainContiguous("B");
+    ret = ret && accessSilent("A", "First", a) && accessSilent("A", "Second", a) && accessSilent("A", "Third", "short");
+    ret = ret && accessSilent("B", "Second", b) && !accessSilent("B", "First", b);
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+
+    // the staged maps are in place for the next session
+    ret = ret && loginSilent("defrag", "defragPwd");
+    ret = ret && accessSilent("A", "Second", a) && accessSilent("B", "Second", b);
+    ret = ret && dv_setEntryData(&test_app, "B", "First", "again") == DV_SUCCESS;
+    ret = ret && accessSilent("B", "First", "again");
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+    free(a);
+    free(b);
+
+    return logTest(ret, "Defragment the chains into runs of pages\n");
+}
+
+// pages the home page lists for the entry, -1 if it does not match the links
+int chainListed(const char *name)
+{
+    unsigned int entryId = (unsigned int)(uintptr_t)avl_get(test_app.nameIdMap, (void *)name);
+    unsigned int home = (unsigned int)(uintptr_t)btree_search(test_app.idIdxMap, entryId);
+
+    dv_pageSet pages;
+    if (dv_pageOpen(&pages, &test_app, NULL))
+    {
+        return -1;
+    }
+    unsigned int *chain = NULL;
+    int noChain = dv_pageChain(&pages, entryId, home, &chain);
+    unsigned char *dec = dv_pageGet(&pages, home);
+    int slot = dec ? dv_pageFindChain(dec, entryId) : -1;
+
+    int ret = 0;
+    if (slot >= 0)
+    {
+        unsigned char *rec = dv_pageRecord(dec, slot);
+        for (int i = 0; i < smallEndianValue(rec + 6, 2); i += DV_EXTENT_LEN)
+        {
+            unsigned int first = smallEndianValue(rec + DV_RECORD_HEADER_LEN + i, 4);
+            unsigned int count = smallEndianValue(rec + DV_RECORD_HEADER_LEN + i + 4, 2);
+            for (unsigned int j = 0; j < count; j++)
+            {
+                ret = ret >= 0 && ret + 1 < noChain && chain[ret + 1] == first + j ? ret + 1 : -1;
+            }
+        }
+    }
+    ret = ret >= 0 && ret + 1 == noChain ? ret : -1;
+    conditionalFree(chain, free);
+    dv_pageClose(&pages);
+
+    return ret;
+}
+
+bool chainExtents()
+{
+    char *a = filledValue('a', 9000);
+
+    // a value over several pages lists the ones after the home page
+    bool ret = openAccount("extents", "extentsPwd");
+    ret = ret && dv_createEntryData(&test_app, "A", "First", "short") == DV_SUCCESS;
+    ret = ret && chainListed("A") == 0;
+    ret = ret && dv_createEntryData(&test_app, "A", "Second", a) == DV_SUCCESS;
+    ret = ret && chainListed("A") > 1;
+    ret = ret && accessSilent("A", "Second", a) && accessSilent("A", "First", "short");
+
+    // the list follows the chain as it shrinks and moves
+    ret = ret && dv_setEntryData(&test_app, "A", "Second", "shorter") == DV_SUCCESS;
+    ret = ret && chainListed("A") == 0;
+    ret = ret && dv_setEntryData(&test_app, "A", "Second", a) == DV_SUCCESS;
+    ret = ret && dv_defrag(&test_app) == DV_SUCCESS;
+    ret = ret && chainListed("A") > 1;
+    ret = ret && accessSilent("A", "Second", a) && accessSilent("A", "First", "short");
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+    free(a);
+
+    return logTest(ret, "List the chain pages in the home page\n");
+}
+
+bool tailAppend()
+{
+    char *a = filledValue('a', 20000);
+
+    bool ret = openAccount("tail", "tailPwd");
+    ret = ret && dv_createEntryData(&test_app, "A", "First", a) == DV_SUCCESS;
+    ret = ret && chainListed("A") > 4;
+
+    // a value added to a long chain reads its home page and tail, not the full pages between
+    unsigned int entryId = (unsigned int)(uintptr_t)avl_get(test_app.nameIdMap, (void *)"A");
+    unsigned int home = (unsigned int)(uintptr_t)btree_search(test_app.idIdxMap, entryId);
+    unsigned int catId = (unsigned int)(uintptr_t)avl_get(test_app.catIdMap, (void *)"First");
+    dv_pageSet pages;
+    ret = ret && dv_pageOpen(&pages, &test_app, NULL) == DV_SUCCESS;
+    if (ret)
+    {
+        ret = dv_pageWriteData(&pages, entryId, home, catId + 1, "short", 5) == DV_SUCCESS && pages.n <= 2;
+        dv_pageClose(&pages);
+    }
+
+    ret = ret && dv_createEntryData(&test_app, "A", "Second", "short") == DV_SUCCESS;
+    ret = ret && dv_createEntryData(&test_app, "A", "Third", a) == DV_SUCCESS;
+    ret = ret && chainListed("A") > 9;
+    ret = ret && accessSilent("A", "First", a) && accessSilent("A", "Second", "short") && accessSilent("A", "Third", a);
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+    free(a);
+
+    return logTest(ret, "Add values to a chain from its listed tail\n");
+}
+
+bool categoryDirectory()
+{
+    char *a = filledValue('a', 1000);
+
+    bool ret = openAccount("directory", "directoryPwd");
+    char category[8];
+    for (int i = 0; ret && i < 30; i++)
+    {
+        sprintf(category, "c%d", i);
+        ret = dv_createEntryData(&test_app, "A", category, a) == DV_SUCCESS;
+    }
+    ret = ret && chainListed("A") > 6 && dv_deleteEntryData(&test_app, "A", "c0") == DV_SUCCESS;
+
+    // a late category reads the home page and its own pages, a missing one only the home page
+    unsigned int entryId = (unsigned int)(uintptr_t)avl_get(test_app.nameIdMap, (void *)"A");
+    unsigned int home = (unsigned int)(uintptr_t)btree_search(test_app.idIdxMap, entryId);
+    unsigned int first = (unsigned int)(uintptr_t)avl_get(test_app.catIdMap, (void *)"c0");
+    unsigned int second = (unsigned int)(uintptr_t)avl_get(test_app.catIdMap, (void *)"c1");
+    unsigned int last = (unsigned int)(uintptr_t)avl_get(test_app.catIdMap, (void *)"c29");
+    dv_pageSet pages;
+    ret = ret && dv_pageOpen(&pages, &test_app, NULL) == DV_SUCCESS;
+    if (ret)
+    {
+        strstream out = strstream_allocDefault();
+        ret = dv_pageReadData(&pages, entryId, home, last, &out) == DV_SUCCESS && out.size == 1000 && pages.n <= 3;
+        dv_pageClose(&pages);
+        ret = ret && dv_pageOpen(&pages, &test_app, NULL) == DV_SUCCESS;
+        ret = ret && dv_pageReadData(&pages, entryId, home, first, &out) != DV_SUCCESS && pages.n == 1;
+
+        // a directory that names the wrong page falls back to the chain
+        unsigned char *dec = dv_pageGet(&pages, home);
+        unsigned int page = dec ? dv_pageDirectoryStart(dec, dv_pageFindDirectory(dec, entryId), second) : 0;
+        dv_pageSetDirectory(&pages, entryId, home, last, 0);
+        dv_pageSetDirectory(&pages, entryId, home, last, page);
+        strstream_clear(&out);
+        out = strstream_allocDefault();
+        ret = ret && page && dv_pageReadData(&pages, entryId, home, last, &out) == DV_SUCCESS && out.size == 1000;
+        dv_pageClose(&pages);
+        strstream_clear(&out);
+    }
+
+    ret = ret && accessSilent("A", "c29", a) && accessSilent("A", "c1", a);
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+    ret = ret && loginSilent("directory", "directoryPwd");
+    ret = ret && accessSilent("A", "c15", a) && !accessSilent("A", "c0", a);
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+    free(a);
+
+    return logTest(ret, "Read a late category through the entry's directory\n");
+}
+
+// ciphertext of a page of data.dv, NULL if the file is shorter
+char *readPage(unsigned int page)
+{
+    file_struct f;
+    char *ret = NULL;
+    if (file_open(&f, data_fp, "rb"))
+    {
+        if (f.len >= (file_off)(page + 1) * DV_PAGE_LEN)
+        {
+            ret = malloc(DV_PAGE_LEN);
+            if (file_pread(&f, (file_off)page * DV_PAGE_LEN, ret, DV_PAGE_LEN) != DV_PAGE_LEN)
+            {
+                free(ret);
+                ret = NULL;
+            }
+        }
+        file_close(&f);
+    }
+
+    return ret;
+}
+
+bool pageRelocate()
+{
+    char *a = filledValue('a', 5000);
+    char *b = filledValue('b', 5000);
+
+    // the pieces of A leave an empty page before the last piece of B
+    bool ret = openAccount("relocate", "relocatePwd");
+    ret = ret && dv_createEntryData(&test_app, "A", "Cat", a) == DV_SUCCESS;
+    ret = ret && dv_createEntryData(&test_app, "B", "Cat", b) == DV_SUCCESS;
+    ret = ret && dv_deleteEntryData(&test_app, "A", "Cat") == DV_SUCCESS;
+    file_off len = dataLength();
+    char *last = readPage(len / DV_PAGE_LEN - 1);
+
+    // the last page lands in the first empty one byte for byte
+    ret = ret && last && len == 5 * DV_PAGE_LEN;
+    ret = ret && dv_vacuum(&test_app, 1) == DV_SUCCESS;
+    ret = ret && dataLength() == len - DV_PAGE_LEN;
+    char *moved = readPage(2);
+    ret = ret && moved && !memcmp(moved, last, DV_PAGE_LEN);
+    ret = ret && accessSilent("B", "Cat", b) && chainListed("B") > 0;
+
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+    ret = ret && loginSilent("relocate", "relocatePwd");
+    ret = ret && accessSilent("B", "Cat", b);
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+    conditionalFree(last, free);
+    conditionalFree(moved, free);
+    free(a);
+    free(b);
+
+    return logTest(ret, "Move a whole page without the cipher\n");
+}
+
+// whether a value reads back as exactly the n bytes expected
+bool accessBytes(const char *entryName, const char *categoryName, const char *expected, int n)
+{
+    int len = -1;
+    retCode = dv_accessEntryBytes(&test_app, entryName, categoryName, &buf, &len);
+    bool ret = retCode == DV_SUCCESS && buf && len == n && !memcmp(buf, expected, n);
+    conditionalFree(buf, free);
+    buf = NULL;
+
+    return ret;
+}
+
+bool binaryValues()
+{
+    // zeros throughout, over several pages
+    char *bytes = malloc(9000);
+    for (int i = 0; i < 9000; i++)
+    {
+        bytes[i] = (char)(i * 7);
+    }
+
+    bool ret = openAccount("binary", "binaryPwd");
+    ret = ret && dv_setEntryBytes(&test_app, "A", "Large", bytes, 9000) == DV_SUCCESS;
+    ret = ret && dv_setEntryBytes(&test_app, "A", "Small", "\0a\0", 3) == DV_SUCCESS;
+    ret = ret && dv_setEntryBytes(&test_app, "A", "Empty", "", 0) == DV_SUCCESS;
+    ret = ret && accessBytes("A", "Large", bytes, 9000) && accessBytes("A", "Small", "\0a\0", 3);
+    ret = ret && accessBytes("A", "Empty", "", 0);
+
+    // the string form stops at the first zero
+    ret = ret && accessSilent("A", "Small", "");
+    ret = ret && dv_setEntryBytes(&test_app, "A", "Small", "b\0", 2) == DV_SUCCESS;
+    ret = ret && accessSilent("A", "Small", "b") && accessBytes("A", "Small", "b\0", 2);
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+
+    ret = ret && loginSilent("binary", "binaryPwd");
+    ret = ret && accessBytes("A", "Large", bytes, 9000) && accessBytes("A", "Small", "b\0", 2);
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+    free(bytes);
+
+    return logTest(ret, "Store values holding any bytes\n");
+}
+
+bool wideCategories()
+{
+    char *a = filledValue('a', 9000);
+
+    bool ret = openAccount("wide", "widePwd");
+    char category[8];
+    for (int i = 0; ret && i < 300; i++)
+    {
+        sprintf(category, "w%d", i);
+        ret = dv_createEntryData(&test_app, "A", category, i == 299 ? a : "v") == DV_SUCCESS;
+    }
+
+    // ids past 255 in records, the journal and the names by id
+    const char *name = dv_categoryName(&test_app, 300);
+    ret = ret && test_app.maxCatId == 300 && name && !strcmp(name, "w299");
+    ret = ret && accessSilent("A", "w299", a) && accessSilent("A", "w260", "v") && accessSilent("A", "w0", "v");
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+
+    ret = ret && loginSilent("wide", "widePwd");
+    ret = ret && accessSilent("A", "w299", a) && dv_checkpoint(&test_app) == DV_SUCCESS;
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+
+    // and in catIdMap.dv, then through defrag
+    ret = ret && loginSilent("wide", "widePwd");
+    ret = ret && accessSilent("A", "w299", a) && accessSilent("A", "w280", "v");
+    ret = ret && dv_createEntryData(&test_app, "B", "w300", "b") == DV_SUCCESS;
+    ret = ret && dv_deleteEntryData(&test_app, "A", "w270") == DV_SUCCESS && dv_defrag(&test_app) == DV_SUCCESS;
+    ret = ret && accessSilent("A", "w299", a) && accessSilent("B", "w300", "b") && !accessSilent("A", "w270", "v");
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+    free(a);
+
+    return logTest(ret, "Keep more than 255 categories\n");
+}
+
+/**
+ * format 1 chain: 14 bytes of the payload and the next block in each block,
+ * the rest of the last block filled with 0x22
+ */
+unsigned int writeV1Chain(strstream *data, unsigned char *payload, int n)
+{
+    unsigned int first = data->size >> 4;
+    for (int i = 0; i < n; i += 14)
+    {
+        unsigned char block[16];
+        memset(block, 0x22, 16);
+        memcpy(block, payload + i, MIN(14, n - i));
+        unsigned int next = i + 14 < n ? (data->size >> 4) + 1 : 0;
+        smallEndianStr(next, block + 14, 2);
+        strstream_read(data, block, 16);
+    }
+
+    return first;
+}
+
+void writeV1Map(int map, strstream *plain)
+{
+    // data key, map IV and the counter of the first format
+    unsigned char *enc = NULL;
+    aes_encrypt_withSchedule(plain->str, plain->size,
+                             test_app.aes_key_schedule, AES_256_NR, AES_CTR_WRAP,
+                             test_app.random + *dv_maps[map].ivOffset, &enc);
+    file_writeContents(dv_maps[map].path, enc, plain->size);
+    free(enc);
+}
+
+bool v1Migration()
+{
+    // a vault as the first format wrote it, under the keys of a new account
+    bool ret = openAccount("v1", "v1Pwd");
+    if (!ret)
+    {
+        return logTest(ret, "Migrate a format 1 vault\n");
+    }
+
+    // block 0 is random
+    strstream data = strstream_allocDefault();
+    unsigned char block[16];
+    randomBytes((char *)block, 16);
+    strstream_read(&data, block, 16);
+
+    // payload: catId, value, '\0' for every category
+    unsigned char gitHub[] = "\x01michaelg29\0\x02" "a password longer than a few blocks";
+    unsigned char google[] = "\x02gg_pwd";
+    unsigned int gitHubBlock = writeV1Chain(&data, gitHub, sizeof(gitHub));
+    unsigned int googleBlock = writeV1Chain(&data, google, sizeof(google));
+
+    unsigned char *enc = NULL;
+    aes_encrypt_withSchedule(data.str, data.size,
+                             test_app.aes_key_schedule, AES_256_NR, AES_CTR,
+                             test_app.random + dataIV_offset, &enc);
+    file_writeContents(data_fp, enc, data.size);
+    free(enc);
+
+    // nameIdMap: name, '\0', id(4); idIdxMap: id(4), block(2); catIdMap: name, '\0', catId(1)
+    strstream map = strstream_allocDefault();
+    unsigned char num[4];
+    strstream_read(&map, "GitHub", 7);
+    smallEndianStr(1, num, 4);
+    strstream_read(&map, num, 4);
+    strstream_read(&map, "Google", 7);
+    smallEndianStr(2, num, 4);
+    strstream_read(&map, num, 4);
+    writeV1Map(DV_NAMEIDMAP, &map);
+
+    map.size = 0;
+    smallEndianStr(1, num, 4);
+    strstream_read(&map, num, 4);
+    smallEndianStr(gitHubBlock, num, 2);
+    strstream_read(&map, num, 2);
+    smallEndianStr(2, num, 4);
+    strstream_read(&map, num, 4);
+    smallEndianStr(googleBlock, num, 2);
+    strstream_read(&map, num, 2);
+    writeV1Map(DV_IDIDXMAP, &map);
+
+    map.size = 0;
+    strstream_read(&map, "Username\0\x01Password\0\x02", 20);
+    writeV1Map(DV_CATIDMAP, &map);
+
+    strstream_clear(&map);
+    strstream_clear(&data);
+
+    // the first format had neither log
+    dv_kill(&test_app);
+    file_remove(journal_fp);
+    file_remove(wal_fp);
+
+    ret = loginSilent("v1", "v1Pwd");
+    ret = ret && test_app.formatVersion == DV_FORMAT;
+    ret = ret && accessSilent("GitHub", "Username", "michaelg29");
+    ret = ret && accessSilent("GitHub", "Password", "a password longer than a few blocks");
+    ret = ret && accessSilent("Google", "Password", "gg_pwd");
+    ret = ret && dv_createEntryData(&test_app, "Google", "Username", "michaelgrieco27") == DV_SUCCESS;
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+
+    // and reads in the current format from then on
+    ret = ret && loginSilent("v1", "v1Pwd");
+    ret = ret && accessSilent("GitHub", "Password", "a password longer than a few blocks");
+    ret = ret && accessSilent("Google", "Username", "michaelgrieco27");
+    ret = dv_logout(&test_app) == DV_SUCCESS && ret;
+
+    return logTest(ret, "Migrate a format 1 vault\n");
+}
+
 void printMetrics()
 {
     printf("%d tests run, %d successes: %.2f%%\n", noTests, noSuccesses, (float)noSuccesses / (float)noTests * 100.0f);
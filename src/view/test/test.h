@@ -1,4 +1,5 @@
 #include "../../lib/cmathematics/cmathematics.h"
+#include "../../lib/util/vfs.h"
 
 bool createAccount(const char *user, const char *pwd);
 bool login(const char *user, const char *pwd);
@@ -11,6 +12,27 @@ bool accessDataFailure(const char *entryName, const char *categoryName);
 bool deleteData(const char *entryName, const char *categoryName);
 bool modifyData(const char *entryName, const char *categoryName, const char *newData);
 bool deleteDataFailure(const char *entryName, const char *categoryName);
+bool largeDataFile(const char *entryName, const char *categoryName, const char *expected, file_off len);
+bool chacha20Vector();
+bool aesCounter();
+bool drbgOutput();
+bool drbgVector();
+bool hkdfVector();
+bool batchFallback();
+bool writeFailure();
+bool walReplay();
+bool journalCheckpoint();
+bool failedCommit();
+bool freeSpaceReuse();
+bool vacuumCompact();
+bool defragChains();
+bool chainExtents();
+bool tailAppend();
+bool categoryDirectory();
+bool pageRelocate();
+bool binaryValues();
+bool wideCategories();
+bool v1Migration();
 void printMetrics();
 void init();
 void cleanup();